@@ -9,31 +9,64 @@
 -T apr_int32_t
 -T apr_mmap_t
 -T apr_off_t
+-T apr_os_file_t
 -T apr_pool_t
 -T apr_size_t
 -T apr_status_t
+-T apr_thread_cond_t
 -T apr_thread_mutex_t
+-T apr_thread_t
 -T apr_uint32_t
 -T check_heap_numbers_t
+-T check_slab_record_t
+-T cmp_ctx_t
 -T filling_t
 -T ft_chksum_t
 -T ft_conf_t
+-T ft_digest_ctx_t
+-T ft_digest_t
+-T ft_dir_t
 -T ft_file_t
 -T ft_fsize_t
+-T ft_group_t
+-T ft_job_t
+-T ft_kernel_t
+-T ft_report_group_t
+-T ft_uring_t
+-T ft_window_t
+-T ft_worker_t
+-T ft_workers_t
 -T function_callback_fn_t
 -T get_key_callback_fn_t
 -T get_key_len_callback_fn_t
 -T hash_callback_fn_t
 -T key_cmp_callback_fn_t
+-T lanes_ctx_t
+-T lockstep_t
 -T napr_cell_t
+-T napr_dheap_node_t
+-T napr_dheap_t
 -T napr_hash_index_t
+-T napr_hash_stats_t
 -T napr_hash_t
 -T napr_heap_cmp_callback_fn_t
 -T napr_heap_del_callback_fn_t
 -T napr_heap_display_callback_fn_t
+-T napr_heap_stats_t
 -T napr_heap_t
 -T napr_list_t
+-T napr_mqueue_shard_t
+-T napr_mqueue_slot_t
+-T napr_mqueue_t
+-T napr_queue_slot_t
+-T napr_queue_t
+-T napr_slab_chunk_t
+-T napr_slab_stats_t
+-T napr_slab_t
+-T pipe_chunk_t
+-T pipe_stream_t
 -T pthread_mutex_t
+-T read_chunk_callback_fn_t
 -T size_t
 -T time_t
 -T uint16_t
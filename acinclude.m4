@@ -330,3 +330,46 @@ AC_DEFUN([BZ2],[
 	AC_SUBST([BZ2_LDFLAGS])
 	AC_SUBST([BZ2_LDADD])
     ])
+
+#
+# io_uring is used to keep many reads in flight, through its system calls
+#
+AC_DEFUN([IO_URING],[
+	AC_ARG_ENABLE( io-uring, AC_HELP_STRING([--disable-io-uring], [don't read files through io_uring on Linux]), [io_uring=$enableval],[io_uring=yes])
+	with_io_uring=no
+	if test "x$io_uring" != "xno"
+	    then
+	    AC_CHECK_HEADER(linux/io_uring.h, [with_io_uring=yes])
+	fi
+	if test "x$with_io_uring" = "xyes"
+	    then
+	    AC_DEFINE([HAVE_IO_URING], 1, [for asynchronous reads])
+	else
+	    AC_DEFINE([HAVE_IO_URING], 0, [for asynchronous reads])
+	fi
+	AC_SUBST([with_io_uring])
+    ])
+
+#
+# extended attributes keep the digests on the files themselves, with the calls of Linux
+#
+AC_DEFUN([XATTR],[
+	AC_ARG_ENABLE( xattr, AC_HELP_STRING([--disable-xattr], [don't keep digests in extended attributes]), [xattr=$enableval],[xattr=yes])
+	with_xattr=no
+	if test "x$xattr" != "xno"
+	    then
+	    AC_MSG_CHECKING([for getxattr and setxattr])
+	    AC_LINK_IFELSE([AC_LANG_PROGRAM([[#include <sys/types.h>
+#include <sys/xattr.h>]],
+		[[return getxattr("/", "user.ftwin", 0, 0) + setxattr("/", "user.ftwin", "", 0, 0);]])],
+		[with_xattr=yes])
+	    AC_MSG_RESULT([$with_xattr])
+	fi
+	if test "x$with_xattr" = "xyes"
+	    then
+	    AC_DEFINE([HAVE_XATTR], 1, [for digests kept in extended attributes])
+	else
+	    AC_DEFINE([HAVE_XATTR], 0, [for digests kept in extended attributes])
+	fi
+	AC_SUBST([with_xattr])
+    ])
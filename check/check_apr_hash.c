@@ -16,12 +16,14 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 
 #include <apr_hash.h>
 #include <apr_strings.h>
 
 #include "debug.h"
+#include "napr_hash.h"
 
 extern apr_pool_t *main_pool;
 apr_pool_t *pool;
@@ -74,6 +76,46 @@ START_TEST(test_apr_hash_int)
 END_TEST
 /* *INDENT-ON* */
 
+START_TEST(test_napr_hash_stats)
+{
+    napr_hash_stats_t stats;
+    napr_hash_t *hash;
+    apr_uint32_t hash_value;
+    char *keys[100];
+    int i;
+
+    /* 4 buckets of 2 elements at most, the table has to grow */
+    hash = napr_hash_str_make(pool, 4, 2);
+    fail_unless(NULL != hash, "error calling napr_hash_str_make");
+    napr_hash_get_stats(hash, &stats);
+    fail_unless((0 == stats.nel) && (0 == stats.used) && (0 == stats.nb_rebuilds), "wrong stats of an empty table");
+
+    for (i = 0; i < 100; i++) {
+	keys[i] = apr_psprintf(pool, "key%d", i);
+	fail_unless(NULL == napr_hash_search(hash, keys[i], strlen(keys[i]), &hash_value), "key found before set");
+	fail_unless(APR_SUCCESS == napr_hash_set(hash, keys[i], hash_value), "error calling napr_hash_set");
+    }
+    napr_hash_get_stats(hash, &stats);
+    fail_unless(100 == stats.nel, "wrong number of elements");
+    fail_unless(stats.size == napr_hash_get_size(hash), "wrong number of buckets");
+    fail_unless(0 < stats.nb_rebuilds, "the table has not grown");
+    fail_unless((0 < stats.used) && (stats.used <= stats.size), "wrong number of buckets used");
+    fail_unless((0 < stats.max_chain) && (2 >= stats.max_chain), "wrong fullest bucket");
+    fail_unless(((double) stats.nel / (double) stats.used) == stats.avg_chain, "wrong average chain");
+    fail_unless(0 < stats.bytes, "no bytes counted");
+
+    for (i = 0; i < 50; i++) {
+	fail_unless(NULL != napr_hash_search(hash, keys[i], strlen(keys[i]), &hash_value), "key not found");
+	napr_hash_remove(hash, keys[i], hash_value);
+    }
+    napr_hash_get_stats(hash, &stats);
+    fail_unless(50 == stats.nel, "wrong number of elements after remove");
+    fail_unless(stats.nel == napr_hash_get_nel(hash), "stats and napr_hash_get_nel differ");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
 Suite *make_apr_hash_suite(void)
 {
     Suite *s;
@@ -83,6 +125,7 @@ Suite *make_apr_hash_suite(void)
 
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_apr_hash_int);
+    tcase_add_test(tc_core, test_napr_hash_stats);
     suite_add_tcase(s, tc_core);
 
     return s;
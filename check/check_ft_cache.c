@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+
+#include "debug.h"
+#include "ft_cache.h"
+
+extern apr_pool_t *main_pool;
+apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+#define FINFO_WANTED (APR_FINFO_SIZE | APR_FINFO_IDENT | APR_FINFO_MTIME | APR_FINFO_CTIME)
+
+/* a new, empty, cache file and a file to cache, stated in finfo */
+static void make_cache(char *cname, char *fname, apr_finfo_t *finfo)
+{
+    int fd;
+
+    fd = mkstemp(cname);
+    fail_unless(0 <= fd, "mkstemp failed");
+    close(fd);
+    fd = mkstemp(fname);
+    fail_unless(0 <= fd, "mkstemp failed");
+    fail_unless(5 == write(fd, "ftwin", 5), "write failed");
+    close(fd);
+    fail_unless(APR_SUCCESS == apr_stat(finfo, fname, FINFO_WANTED, pool), "apr_stat failed");
+}
+
+START_TEST(test_cache_lookup)
+{
+    char cname[] = "/tmp/check_ftwin.XXXXXX", fname[] = "/tmp/check_ftwin.XXXXXX";
+    apr_uint32_t head[FT_DIGEST_WORDS] = { 1, 2 }, full[FT_DIGEST_WORDS] = { 3, 4 };
+    ft_cache_stats_t stats;
+    ft_cache_entry_t *entry;
+    ft_cache_t *cache;
+    apr_finfo_t finfo;
+    apr_status_t status;
+
+    make_cache(cname, fname, &finfo);
+
+    status = ft_cache_open(&cache, cname, &ft_digest_murmur3, pool);
+    fail_unless(APR_SUCCESS == status, "opening an empty cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    fail_unless(0 == entry->flags, "digests found in an empty cache");
+    memcpy(entry->head, head, sizeof(head));
+    memcpy(entry->full, full, sizeof(full));
+    entry->flags = FT_CACHE_HEAD | FT_CACHE_FULL;
+    fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+    ft_cache_get_stats(cache, &stats);
+    fail_unless((0 == stats.nb_hits) && (1 == stats.nb_misses) && (1 == stats.nb_saved), "wrong stats");
+
+    /* the next run finds the digests */
+    status = ft_cache_open(&cache, cname, &ft_digest_murmur3, pool);
+    fail_unless(APR_SUCCESS == status, "reopening the cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    fail_unless((FT_CACHE_HEAD | FT_CACHE_FULL) == entry->flags, "digests not found");
+    fail_unless(0 == memcmp(entry->head, head, sizeof(head)), "wrong head digest");
+    fail_unless(0 == memcmp(entry->full, full, sizeof(full)), "wrong full digest");
+    ft_cache_get_stats(cache, &stats);
+    fail_unless((1 == stats.nb_hits) && (0 == stats.nb_misses), "wrong stats");
+    fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+
+    /* unless the file has changed since */
+    finfo.mtime++;
+    status = ft_cache_open(&cache, cname, &ft_digest_murmur3, pool);
+    fail_unless(APR_SUCCESS == status, "reopening the cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    fail_unless(0 == entry->flags, "digests of a changed file found");
+    fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+    ft_cache_get_stats(cache, &stats);
+    fail_unless((1 == stats.nb_misses) && (1 == stats.nb_stale), "wrong stats");
+    fail_unless((0 == stats.nb_saved) && (1 == stats.nb_dropped), "stale entry not dropped");
+
+    /* nor is a digest used for another */
+    entry->flags = FT_CACHE_FULL;
+    fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+    status = ft_cache_open(&cache, cname, &ft_digest_sha256, pool);
+    fail_unless(APR_SUCCESS == status, "reopening the cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    fail_unless(0 == entry->flags, "digests of another digest found");
+
+    unlink(cname);
+    unlink(fname);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_cache_compaction)
+{
+    char cname[] = "/tmp/check_ftwin.XXXXXX", fname[] = "/tmp/check_ftwin.XXXXXX";
+    ft_cache_stats_t stats;
+    ft_cache_entry_t *entry;
+    ft_cache_t *cache;
+    apr_finfo_t finfo;
+    int run;
+
+    make_cache(cname, fname, &finfo);
+
+    fail_unless(APR_SUCCESS == ft_cache_open(&cache, cname, &ft_digest_murmur3, pool), "opening the cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    entry->flags = FT_CACHE_FULL;
+    fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+
+    /* runs that don't see the file keep its entry a while */
+    for (run = 1; run < FT_CACHE_KEEP; run++) {
+	fail_unless(APR_SUCCESS == ft_cache_open(&cache, cname, &ft_digest_murmur3, pool), "opening the cache failed");
+	fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+	ft_cache_get_stats(cache, &stats);
+	fail_unless((1 == stats.nb_saved) && (0 == stats.nb_dropped), "entry dropped too soon");
+    }
+    fail_unless(APR_SUCCESS == ft_cache_open(&cache, cname, &ft_digest_murmur3, pool), "opening the cache failed");
+    fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+    ft_cache_get_stats(cache, &stats);
+    fail_unless((0 == stats.nb_saved) && (1 == stats.nb_dropped), "entry not dropped");
+
+    fail_unless(APR_SUCCESS == ft_cache_open(&cache, cname, &ft_digest_murmur3, pool), "opening the cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    fail_unless(0 == entry->flags, "dropped entry found");
+
+    unlink(cname);
+    unlink(fname);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_cache_not_a_cache)
+{
+    char cname[] = "/tmp/check_ftwin.XXXXXX", fname[] = "/tmp/check_ftwin.XXXXXX";
+    const char text[] = "this is not a cache file, it must not be overwritten\n";
+    apr_finfo_t finfo;
+    ft_cache_t *cache;
+    FILE *f;
+
+    make_cache(cname, fname, &finfo);
+    f = fopen(cname, "w");
+    fail_unless(NULL != f, "fopen failed");
+    fputs(text, f);
+    fclose(f);
+
+    fail_unless(APR_SUCCESS != ft_cache_open(&cache, cname, &ft_digest_murmur3, pool), "not a cache file opened");
+    fail_unless(APR_SUCCESS == apr_stat(&finfo, cname, APR_FINFO_SIZE, pool), "apr_stat failed");
+    fail_unless(sizeof(text) - 1 == finfo.size, "not a cache file changed");
+
+    unlink(cname);
+    unlink(fname);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_cache_xattr)
+{
+    char cname[] = "/tmp/check_ftwin.XXXXXX", fname[] = "/tmp/check_ftwin.XXXXXX";
+    apr_uint32_t full[FT_DIGEST_WORDS] = { 5, 6, 7 };
+    ft_cache_stats_t stats;
+    ft_cache_entry_t *entry;
+    ft_cache_t *cache;
+    apr_finfo_t finfo;
+    apr_status_t status;
+
+    make_cache(cname, fname, &finfo);
+
+    fail_unless(APR_SUCCESS == ft_cache_open(&cache, NULL, &ft_digest_murmur3, pool), "opening no cache failed");
+    entry = ft_cache_lookup(cache, &finfo);
+    fail_unless(0 == ft_cache_xattr_get(cache, entry, fname), "attribute found on a new file");
+    memcpy(entry->full, full, sizeof(full));
+    entry->flags = FT_CACHE_FULL;
+    status = ft_cache_xattr_set(cache, entry, fname, pool);
+    /* not every file system has extended attributes */
+    if (APR_SUCCESS == status) {
+	fail_unless(APR_SUCCESS == ft_cache_open(&cache, cname, &ft_digest_murmur3, pool), "opening the cache failed");
+	entry = ft_cache_lookup(cache, &finfo);
+	fail_unless(FT_CACHE_FULL == ft_cache_xattr_get(cache, entry, fname), "attribute not found");
+	fail_unless((FT_CACHE_FULL | FT_CACHE_XATTR(FT_CACHE_FULL)) == entry->flags, "entry not completed");
+	fail_unless(0 == memcmp(entry->full, full, sizeof(full)), "wrong full digest");
+	/* anyone who can write the file can forge its attribute, the cache file only keeps what was computed */
+	fail_unless(APR_SUCCESS == ft_cache_save(cache), "saving the cache failed");
+	ft_cache_get_stats(cache, &stats);
+	fail_unless(0 == stats.nb_saved, "digest of an attribute saved");
+
+	/* each digest has its own attribute */
+	fail_unless(APR_SUCCESS == ft_cache_open(&cache, NULL, &ft_digest_sha256, pool), "opening no cache failed");
+	entry = ft_cache_lookup(cache, &finfo);
+	fail_unless(0 == ft_cache_xattr_get(cache, entry, fname), "attribute of another digest found");
+
+	finfo.mtime++;
+	fail_unless(APR_SUCCESS == ft_cache_open(&cache, NULL, &ft_digest_murmur3, pool), "opening no cache failed");
+	entry = ft_cache_lookup(cache, &finfo);
+	fail_unless(0 == ft_cache_xattr_get(cache, entry, fname), "attribute of a changed file found");
+	fail_unless(0 == entry->flags, "entry of a changed file completed");
+    }
+
+    unlink(cname);
+    unlink(fname);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_cache_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Cache");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_cache_lookup);
+    tcase_add_test(tc_core, test_cache_compaction);
+    tcase_add_test(tc_core, test_cache_not_a_cache);
+    tcase_add_test(tc_core, test_cache_xattr);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <apr_time.h>
+
+#include "debug.h"
+#include "ft_digest.h"
+#include "ft_kernel.h"
+
+extern apr_pool_t *main_pool;
+apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+static void digest_hex(const ft_digest_t *digest, const void *data, apr_size_t len, char *hex)
+{
+    apr_uint32_t out[FT_DIGEST_WORDS];
+    ft_digest_ctx_t ctx;
+    apr_size_t i;
+
+    ft_digest_init(&ctx, digest);
+    ft_digest_update(&ctx, data, len);
+    ft_digest_final(&ctx, out);
+    for (i = 0; i < digest->width; i++)
+	sprintf(hex + 2 * i, "%02x", (unsigned int) (out[i / 4] >> (8 * (i % 4))) & 0xff);
+}
+
+START_TEST(test_ft_digest_vectors)
+{
+    const char *fox = "The quick brown fox jumps over the lazy dog";
+    char hex[2 * FT_DIGEST_WORDS * sizeof(apr_uint32_t) + 1];
+
+    digest_hex(&ft_digest_sha256, "abc", 3, hex);
+    fail_unless(0 == strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"),
+		"bad sha256 of abc: %s", hex);
+    digest_hex(&ft_digest_sha256, "", 0, hex);
+    fail_unless(0 == strcmp(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"),
+		"bad sha256 of the empty string: %s", hex);
+
+    digest_hex(&ft_digest_murmur3, fox, strlen(fox), hex);
+    fail_unless(0 == strcmp(hex, "6c1b07bc7bbc4be347939ac4a93c437a"), "bad murmur3 of the fox: %s", hex);
+    digest_hex(&ft_digest_murmur3, "", 0, hex);
+    fail_unless(0 == strcmp(hex, "00000000000000000000000000000000"), "bad murmur3 of the empty string: %s", hex);
+
+    fail_unless(&ft_digest_murmur3 == ft_digest_find("murmur3"), "murmur3 not found");
+    fail_unless(NULL == ft_digest_find("md4"), "unknown digest found");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_digest_stream)
+{
+    static const ft_digest_t *const digests[] = { &ft_digest_jenkins, &ft_digest_murmur3, &ft_digest_sha256, NULL };
+    apr_uint32_t out[FT_DIGEST_WORDS], out2[FT_DIGEST_WORDS];
+    ft_digest_ctx_t ctx;
+    unsigned char *data;
+    apr_size_t len = 3 * FT_DIGEST_JENKINS_BLOCK + 123, pos, n;
+    int d, i;
+
+    data = apr_palloc(pool, len);
+    for (pos = 0; pos < len; pos++)
+	data[pos] = (unsigned char) (pos * 7 + (pos >> 8));
+
+    /* ftwin <= 0.8.8 hashed blocks of 4096 bytes, with a state starting at 1 */
+    for (i = 0; i < HASHSTATE; i++)
+	out2[i] = 1;
+    for (pos = 0; pos < len; pos += FT_DIGEST_JENKINS_BLOCK)
+	hash(data + pos, (len - pos < FT_DIGEST_JENKINS_BLOCK) ? len - pos : FT_DIGEST_JENKINS_BLOCK, out2);
+    ft_digest_init(&ctx, &ft_digest_jenkins);
+    ft_digest_update(&ctx, data, len);
+    ft_digest_final(&ctx, out);
+    fail_unless(0 == memcmp(out, out2, sizeof(out)), "jenkins is not compatible with previous versions");
+
+    /* the result does not depend on how the data is split */
+    for (d = 0; NULL != digests[d]; d++) {
+	ft_digest_init(&ctx, digests[d]);
+	ft_digest_update(&ctx, data, len);
+	ft_digest_final(&ctx, out);
+
+	ft_digest_init(&ctx, digests[d]);
+	for (pos = 0, n = 1; pos < len; pos += n, n = (n * 3 + 1) % 1000) {
+	    if (n > len - pos)
+		n = len - pos;
+	    ft_digest_update(&ctx, data + pos, n);
+	}
+	ft_digest_final(&ctx, out2);
+	fail_unless(0 == memcmp(out, out2, sizeof(out)), "%s depends on the split of the data", digests[d]->name);
+
+	data[len / 2] ^= 1;
+	ft_digest_init(&ctx, digests[d]);
+	ft_digest_update(&ctx, data, len);
+	ft_digest_final(&ctx, out2);
+	data[len / 2] ^= 1;
+	fail_unless(0 != memcmp(out, out2, sizeof(out)), "%s misses a flipped bit", digests[d]->name);
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_ft_digest_lanes)
+{
+    static const apr_size_t lens[] = { 0, 1, 31, 32, 33, FT_DIGEST_JENKINS_BLOCK, 2 * FT_DIGEST_JENKINS_BLOCK + 29 };
+    apr_uint32_t states[FT_DIGEST_LANES][FT_DIGEST_WORDS], out[FT_DIGEST_WORDS];
+    const unsigned char *data[FT_DIGEST_LANES];
+    unsigned char *buf;
+    ft_digest_ctx_t ctx;
+    apr_size_t len, pos;
+    int nb, l, n;
+
+    for (n = 0; n < (int) (sizeof(lens) / sizeof(lens[0])); n++) {
+	len = lens[n];
+	buf = apr_palloc(pool, FT_DIGEST_LANES * len + 1);
+	for (pos = 0; pos < FT_DIGEST_LANES * len; pos++)
+	    buf[pos] = (unsigned char) (pos * 13 + (pos >> 9));
+	for (l = 0; l < FT_DIGEST_LANES; l++)
+	    data[l] = buf + l * len;
+
+	for (nb = 1; nb <= FT_DIGEST_LANES; nb++) {
+	    ft_digest_jenkins_lanes_init(states, nb);
+	    ft_digest_jenkins_lanes(states, data, nb, len);
+	    for (l = 0; l < nb; l++) {
+		ft_digest_init(&ctx, &ft_digest_jenkins);
+		ft_digest_update(&ctx, data[l], len);
+		ft_digest_final(&ctx, out);
+		fail_unless(0 == memcmp(out, states[l], sizeof(out)), "lane %d of %d differs on %" APR_SIZE_T_FMT " bytes",
+			    l, nb, len);
+	    }
+	}
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/*
+ * Benchmark, not run by default: "check_ftwin 4". Throughput of each digest
+ * on data in memory, so that only the CPU cost is measured.
+ */
+START_TEST(bench_ft_digest_throughput)
+{
+    static const ft_digest_t *const digests[] = { &ft_digest_jenkins, &ft_digest_murmur3, &ft_digest_sha256, NULL };
+    apr_uint32_t out[FT_DIGEST_WORDS];
+    ft_digest_ctx_t ctx;
+    unsigned char *data;
+    apr_size_t len = 64 * 1024 * 1024, pos;
+    apr_time_t start, elapsed;
+    int d, round, nb_rounds;
+
+    data = apr_palloc(pool, len);
+    for (pos = 0; pos < len; pos++)
+	data[pos] = (unsigned char) (pos * 7 + (pos >> 8));
+
+    for (d = 0; NULL != digests[d]; d++) {
+	/* sha256 is an order of magnitude slower, don't wait for it */
+	nb_rounds = (&ft_digest_sha256 == digests[d]) ? 1 : 4;
+	start = apr_time_now();
+	for (round = 0; round < nb_rounds; round++) {
+	    ft_digest_init(&ctx, digests[d]);
+	    ft_digest_update(&ctx, data, len);
+	    ft_digest_final(&ctx, out);
+	}
+	elapsed = apr_time_now() - start;
+	printf("%-8s: %6.2f GB/s\n", digests[d]->name,
+	       (double) len * nb_rounds / (elapsed ? elapsed : 1) / 1000.0);
+    }
+
+    /* the same data on every lane, jenkins is done once per FT_DIGEST_LANES inputs, with each kernel */
+    {
+	apr_uint32_t states[FT_DIGEST_LANES][FT_DIGEST_WORDS];
+	const unsigned char *lanes_data[FT_DIGEST_LANES];
+	int k, l;
+
+	for (l = 0; l < FT_DIGEST_LANES; l++)
+	    lanes_data[l] = data;
+	for (k = 0; NULL != ft_kernels[k]; k++) {
+	    if (APR_SUCCESS != ft_kernel_select(ft_kernels[k]))
+		continue;
+	    start = apr_time_now();
+	    ft_digest_jenkins_lanes_init(states, FT_DIGEST_LANES);
+	    ft_digest_jenkins_lanes(states, lanes_data, FT_DIGEST_LANES, len);
+	    elapsed = apr_time_now() - start;
+	    printf("jenkins x%d (%s): %6.2f GB/s\n", FT_DIGEST_LANES, ft_kernels[k]->name,
+		   (double) len * FT_DIGEST_LANES / (elapsed ? elapsed : 1) / 1000.0);
+	}
+	ft_kernel_select(NULL);
+    }
+    fflush(stdout);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_digest_bench_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Digest_Bench");
+    tc_core = tcase_create("Benchmarks");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 0);
+    tcase_add_test(tc_core, bench_ft_digest_throughput);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+Suite *make_ft_digest_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Digest");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_digest_vectors);
+    tcase_add_test(tc_core, test_ft_digest_stream);
+    tcase_add_test(tc_core, test_ft_digest_lanes);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -15,10 +15,12 @@
  */
 
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <check.h>
 
-#include "checksum.h"
+#include <apr_time.h>
+
 #include "debug.h"
 #include "ft_file.h"
 
@@ -48,34 +50,147 @@ static const char *fname3 = CHECK_DIR "/tests/testrand";
 
 START_TEST(test_checksum_file)
 {
+    static const ft_digest_t *const digests[] = { &ft_digest_jenkins, &ft_digest_murmur3, &ft_digest_sha256, NULL };
     apr_status_t status;
-    apr_uint32_t val_array[HASHSTATE];
-    apr_uint32_t val_array2[HASHSTATE];
+    apr_uint32_t val_array[FT_DIGEST_WORDS];
+    apr_uint32_t val_array2[FT_DIGEST_WORDS];
+    int d, rv;
+
+    for (d = 0; NULL != digests[d]; d++) {
+	status = checksum_file(fname1, size1, 2 * size1, digests[d], val_array, pool);
+	fail_unless(APR_SUCCESS == status, "checksum small file failed");
+	status = checksum_file(fname2, size1, 2 * size1, digests[d], val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, sizeof(val_array));
+	fail_unless(0 == rv, "mismatching %s checksums", digests[d]->name);
+
+	status = checksum_file(fname3, size1, 2 * size1, digests[d], val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, sizeof(val_array));
+	fail_unless(0 != rv, "unexpected matching %s checksums", digests[d]->name);
+
+	/* read instead of mapped, same result */
+	status = checksum_file(fname1, size1, size1 / 2, digests[d], val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, sizeof(val_array));
+	fail_unless(0 == rv, "%s checksum depends on the file being mapped", digests[d]->name);
+
+	status = checksum_file(fname1, size1, size1 / 2, digests[d], val_array, pool);
+	fail_unless(APR_SUCCESS == status, "checksum small file failed");
+	status = checksum_file(fname2, size1, size1 / 2, digests[d], val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, sizeof(val_array));
+	fail_unless(0 == rv, "mismatching %s checksums", digests[d]->name);
+
+	status = checksum_file(fname3, size1, size1 / 2, digests[d], val_array2, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	rv = memcmp(val_array, val_array2, sizeof(val_array));
+	fail_unless(0 != rv, "unexpected matching %s checksums", digests[d]->name);
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_checksum_file_block)
+{
+    apr_status_t status;
+    apr_uint32_t val_array[FT_DIGEST_WORDS];
+    apr_uint32_t val_array2[FT_DIGEST_WORDS];
     int rv;
 
-    status = checksum_file(fname1, size1, 2 * size1, val_array, pool);
-    fail_unless(APR_SUCCESS == status, "checksum small file failed");
-    status = checksum_file(fname2, size1, 2 * size1, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
-    fail_unless(0 == rv, "mismatching checksums");
+    status = checksum_file_block(fname1, 0, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3, val_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum head block failed");
+    status = checksum_file_block(fname2, 0, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum head block failed");
+    rv = memcmp(val_array, val_array2, sizeof(val_array));
+    fail_unless(0 == rv, "mismatching head checksums");
 
-    status = checksum_file(fname3, size1, 2 * size1, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
-    fail_unless(0 != rv, "unexpected matching checksums");
+    status = checksum_file_block(fname3, 0, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum head block failed");
+    rv = memcmp(val_array, val_array2, sizeof(val_array));
+    fail_unless(0 != rv, "unexpected matching head checksums");
+
+    status = checksum_file_block(fname1, size1 - CHECKSUM_BLOCK_LEN, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3,
+				 val_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum tail block failed");
+    status = checksum_file_block(fname2, size1 - CHECKSUM_BLOCK_LEN, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3,
+				 val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum tail block failed");
+    rv = memcmp(val_array, val_array2, sizeof(val_array));
+    fail_unless(0 == rv, "mismatching tail checksums");
+
+    status = checksum_file_block(fname1, 0, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum head block failed");
+    rv = memcmp(val_array, val_array2, sizeof(val_array));
+    fail_unless(0 != rv, "head and tail should differ");
+
+    /* reading past the end is an error */
+    status = checksum_file_block(fname1, size1 - 16, CHECKSUM_BLOCK_LEN, &ft_digest_murmur3, val_array, pool);
+    fail_unless(APR_SUCCESS != status, "short block not detected");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
 
-    status = checksum_file(fname1, size1, size1 / 2, val_array, pool);
+START_TEST(test_checksum_file_segment)
+{
+    apr_uint32_t segments[4][FT_DIGEST_WORDS], segments2[4][FT_DIGEST_WORDS];
+    apr_uint32_t val_array[FT_DIGEST_WORDS], val_array2[FT_DIGEST_WORDS];
+    apr_status_t status;
+    int s;
+
+    /* the whole file in one segment */
+    status = checksum_file_segment(fname1, 0, size1, &ft_digest_jenkins, val_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum segment failed");
+    status = checksum_file(fname1, size1, 2 * size1, &ft_digest_jenkins, val_array2, pool);
     fail_unless(APR_SUCCESS == status, "checksum small file failed");
-    status = checksum_file(fname2, size1, size1 / 2, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
-    fail_unless(0 == rv, "mismatching checksums");
+    fail_unless(0 == memcmp(val_array, val_array2, sizeof(val_array)), "segment differs from checksum_file");
 
-    status = checksum_file(fname3, size1, size1 / 2, val_array2, pool);
-    fail_unless(APR_SUCCESS == status, "checksum big file failed");
-    rv = memcmp(val_array, val_array2, HASHSTATE);
-    fail_unless(0 != rv, "unexpected matching checksums");
+    /* same content, same tree digest */
+    for (s = 0; s < 4; s++) {
+	status = checksum_file_segment(fname1, s * size1 / 4, size1 / 4, &ft_digest_murmur3, segments[s], pool);
+	fail_unless(APR_SUCCESS == status, "checksum segment %d failed", s);
+	status = checksum_file_segment(fname2, s * size1 / 4, size1 / 4, &ft_digest_murmur3, segments2[s], pool);
+	fail_unless(APR_SUCCESS == status, "checksum segment %d failed", s);
+    }
+    ft_digest_tree(&ft_digest_murmur3, segments, 4, val_array);
+    ft_digest_tree(&ft_digest_murmur3, segments2, 4, val_array2);
+    fail_unless(0 == memcmp(val_array, val_array2, sizeof(val_array)), "mismatching tree checksums");
+
+    for (s = 0; s < 4; s++) {
+	status = checksum_file_segment(fname3, s * size1 / 4, size1 / 4, &ft_digest_murmur3, segments2[s], pool);
+	fail_unless(APR_SUCCESS == status, "checksum segment %d failed", s);
+    }
+    ft_digest_tree(&ft_digest_murmur3, segments2, 4, val_array2);
+    fail_unless(0 != memcmp(val_array, val_array2, sizeof(val_array)), "unexpected matching tree checksums");
+
+    /* reading past the end is an error */
+    status = checksum_file_segment(fname1, size1 - 16, 32, &ft_digest_murmur3, val_array, pool);
+    fail_unless(APR_SUCCESS != status, "short segment not detected");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_checksum_files)
+{
+    const char *fnames[] = { fname1, fname2, fname3, CHECK_DIR "/tests/nonexistent" };
+    apr_uint32_t states[FT_DIGEST_LANES][FT_DIGEST_WORDS];
+    apr_status_t statuses[FT_DIGEST_LANES];
+    apr_uint32_t val_array[FT_DIGEST_WORDS];
+    apr_status_t status;
+    int l;
+
+    status = checksum_files(fnames, 4, size1, states, statuses, pool);
+    fail_unless(APR_SUCCESS == status, "checksum_files failed");
+    for (l = 0; l < 3; l++) {
+	fail_unless(APR_SUCCESS == statuses[l], "checksum of lane %d failed", l);
+	status = checksum_file(fnames[l], size1, size1 / 2, &ft_digest_jenkins, val_array, pool);
+	fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	fail_unless(0 == memcmp(val_array, states[l], sizeof(val_array)), "lane %d differs from checksum_file", l);
+    }
+    fail_unless(APR_SUCCESS != statuses[3], "missing file not reported");
 }
 /* *INDENT-OFF* */
 END_TEST
@@ -98,6 +213,243 @@ START_TEST(test_filecmp)
 END_TEST
 /* *INDENT-ON* */
 
+START_TEST(test_read_size)
+{
+    static const apr_size_t lens[] = { 1, 4096, 3 * 4096, 0 };
+    static const unsigned int depths[] = { 0, 1, FT_READ_DEPTH };
+    const char *fnames[] = { fname1, fname2, fname3, CHECK_DIR "/tests/nonexistent" };
+    apr_uint32_t states[FT_DIGEST_LANES][FT_DIGEST_WORDS];
+    apr_status_t statuses[FT_DIGEST_LANES];
+    apr_uint32_t val_array[FT_DIGEST_WORDS];
+    apr_uint32_t val_array2[FT_DIGEST_WORDS];
+    apr_uint32_t jenkins_array[FT_DIGEST_WORDS];
+    apr_status_t status;
+    int n, d, rv;
+
+    status = checksum_file(fname1, size1, 2 * size1, &ft_digest_murmur3, val_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum small file failed");
+    status = checksum_file(fname1, size1, 2 * size1, &ft_digest_jenkins, jenkins_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum small file failed");
+    for (d = 0; d < 2 * (int) (sizeof(depths) / sizeof(depths[0])); d++) {
+	for (n = 0; n < (int) (sizeof(lens) / sizeof(lens[0])); n++) {
+	    /* through io_uring then by reader threads */
+	    ft_file_read_setup(lens[n], depths[d / 2], ((n % 2) ? FT_READ_DONTNEED : 0) | ((d % 2) ? FT_READ_THREADS : 0));
+	    status = checksum_file(fname2, size1, size1 / 2, &ft_digest_murmur3, val_array2, pool);
+	    fail_unless(APR_SUCCESS == status, "checksum big file failed");
+	    rv = memcmp(val_array, val_array2, sizeof(val_array));
+	    fail_unless(0 == rv, "checksum depends on reads of %" APR_SIZE_T_FMT " bytes, %u in flight", lens[n],
+			depths[d / 2]);
+
+	    status = filecmp(pool, fname1, fname2, size1, size1 / 2, &rv);
+	    fail_unless((APR_SUCCESS == status) && (0 == rv), "filecmp big file failed");
+	    status = filecmp(pool, fname1, fname3, size1, size1 / 2, &rv);
+	    fail_unless((APR_SUCCESS == status) && (0 != rv), "filecmp big file failed");
+	    status = filecmp(pool, fname1, fnames[3], size1, size1 / 2, &rv);
+	    fail_unless(APR_SUCCESS != status, "filecmp of a missing file succeeded");
+
+	    status = checksum_files(fnames, 4, size1, states, statuses, pool);
+	    fail_unless((APR_SUCCESS == status) && (APR_SUCCESS == statuses[1]), "checksum_files failed");
+	    fail_unless(0 == memcmp(jenkins_array, states[1], sizeof(jenkins_array)), "lane differs from checksum_file");
+	    fail_unless(APR_SUCCESS != statuses[3], "missing file not reported");
+	}
+    }
+    ft_file_read_setup(FT_READ_LEN, FT_READ_DEPTH, 0);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* write size bytes of a pattern to a new temporary file, flipping the byte at flip if not negative */
+static void write_temp_file(char *fname, apr_off_t size, apr_off_t flip)
+{
+    char buf[4096];
+    apr_off_t pos;
+    apr_size_t i, len;
+    int fd;
+
+    fd = mkstemp(fname);
+    fail_unless(0 <= fd, "mkstemp failed");
+    for (pos = 0; pos < size; pos += len) {
+	len = (apr_size_t) MIN(size - pos, (apr_off_t) sizeof(buf));
+	for (i = 0; i < len; i++)
+	    buf[i] = (char) ((pos + i) * 7 + ((pos + i) >> 8));
+	if ((flip >= pos) && (flip < pos + (apr_off_t) len))
+	    buf[flip - pos] ^= 1;
+	fail_unless(len == write(fd, buf, len), "write failed");
+    }
+    close(fd);
+}
+
+START_TEST(test_mmap_window)
+{
+    char fname1[] = "/tmp/check_ftwin.XXXXXX", fname2[] = "/tmp/check_ftwin.XXXXXX";
+    char fname3[] = "/tmp/check_ftwin.XXXXXX";
+    apr_off_t size = 2 * 8 * 1024 * 1024 + 12345;
+    apr_uint32_t val_array[FT_DIGEST_WORDS];
+    apr_uint32_t val_array2[FT_DIGEST_WORDS];
+    apr_status_t status;
+    int rv;
+
+    write_temp_file(fname1, size, -1);
+    write_temp_file(fname2, size, -1);
+    /* in the last window */
+    write_temp_file(fname3, size, size - 100);
+
+    /* mapped by windows or read, same result */
+    status = checksum_file(fname1, size, 2 * size, &ft_digest_murmur3, val_array, pool);
+    fail_unless(APR_SUCCESS == status, "checksum small file failed");
+    status = checksum_file(fname2, size, size / 2, &ft_digest_murmur3, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum big file failed");
+    fail_unless(0 == memcmp(val_array, val_array2, sizeof(val_array)), "checksum depends on the file being mapped");
+    status = checksum_file(fname3, size, 2 * size, &ft_digest_murmur3, val_array2, pool);
+    fail_unless(APR_SUCCESS == status, "checksum small file failed");
+    fail_unless(0 != memcmp(val_array, val_array2, sizeof(val_array)), "last window not hashed");
+
+    status = filecmp(pool, fname1, fname2, size, 2 * size, &rv);
+    fail_unless((APR_SUCCESS == status) && (0 == rv), "filecmp small file failed");
+    status = filecmp(pool, fname1, fname3, size, 2 * size, &rv);
+    fail_unless((APR_SUCCESS == status) && (0 != rv), "last window not compared");
+
+    unlink(fname1);
+    unlink(fname2);
+    unlink(fname3);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_filecmp_group)
+{
+    static const int contents[] = { 0, 0, 1, 0, 1, 2 };
+    static const int moduli[] = { 3, 40 };
+    char fnames[80][sizeof("/tmp/check_ftwin.XXXXXX")];
+    const char *paths[80];
+    apr_status_t statuses[80];
+    apr_off_t size = 300 * 1024;
+    int classes[80];
+    int k, m, nb;
+
+    /* the first window of the files is the same, they differ further */
+    for (k = 0; k < 6; k++) {
+	strcpy(fnames[k], "/tmp/check_ftwin.XXXXXX");
+	write_temp_file(fnames[k], size, contents[k] ? size - contents[k] : -1);
+	paths[k] = fnames[k];
+    }
+    paths[6] = CHECK_DIR "/tests/doesnotexist";
+    fail_unless(APR_SUCCESS == filecmp_group(pool, paths, 7, size, classes, statuses), "filecmp_group failed");
+    fail_unless((0 == classes[0]) && (0 == classes[1]) && (2 == classes[2]) && (0 == classes[3]) && (2 == classes[4])
+		&& (5 == classes[5]), "wrong classes");
+    fail_unless((-1 == classes[6]) && (APR_SUCCESS != statuses[6]), "missing file not reported");
+    for (k = 0; k < 6; k++)
+	unlink(fnames[k]);
+
+    /* beyond FT_CMP_GROUP_MAX files, by batches then, with too many contents, one by one */
+    for (m = 0; m < 2; m++) {
+	for (nb = 0; nb < 80; nb++) {
+	    strcpy(fnames[nb], "/tmp/check_ftwin.XXXXXX");
+	    write_temp_file(fnames[nb], size, (nb % moduli[m]) ? nb % moduli[m] : -1);
+	    paths[nb] = fnames[nb];
+	}
+	fail_unless(APR_SUCCESS == filecmp_group(pool, paths, nb, size, classes, statuses), "filecmp_group failed");
+	for (k = 0; k < nb; k++) {
+	    fail_unless(classes[k] == k % moduli[m], "wrong class %d for file %d", classes[k], k);
+	    unlink(fnames[k]);
+	}
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/*
+ * Benchmark, not run by default: "check_ftwin 4". A file of 256M, in the
+ * page cache, is hashed with reads of 4K (ftwin <= 0.8.8) to 4M, one at a
+ * time then kept in flight through io_uring or by a reader thread, so that
+ * only the cost of the system calls is measured.
+ */
+START_TEST(bench_read_size)
+{
+    static const struct
+    {
+	apr_size_t len;
+	unsigned int depth;
+	int flags;
+    } reads[] = { {4096, 0, 0}, {64 * 1024, 0, 0}, {FT_READ_LEN, 0, 0}, {4 * FT_READ_LEN, 0, 0},
+    {64 * 1024, FT_READ_DEPTH, 0}, {FT_READ_LEN, FT_READ_DEPTH, 0}, {FT_READ_LEN, 4 * FT_READ_DEPTH, 0},
+    {64 * 1024, FT_READ_DEPTH, FT_READ_THREADS}, {FT_READ_LEN, FT_READ_DEPTH, FT_READ_THREADS} };
+    char fname[] = "/tmp/check_ftwin.XXXXXX";
+    apr_uint32_t val_array[FT_DIGEST_WORDS];
+    apr_off_t size = 256 * 1024 * 1024, pos;
+    apr_time_t start, elapsed;
+    char *buf;
+    int fd, n, round;
+
+    fd = mkstemp(fname);
+    fail_unless(0 <= fd, "mkstemp failed");
+    buf = apr_palloc(pool, FT_READ_LEN);
+    for (pos = 0; pos < FT_READ_LEN; pos++)
+	buf[pos] = (char) (pos * 7 + (pos >> 8));
+    for (pos = 0; pos < size; pos += FT_READ_LEN)
+	fail_unless(FT_READ_LEN == write(fd, buf, FT_READ_LEN), "write failed");
+    close(fd);
+
+    for (n = 0; n < (int) (sizeof(reads) / sizeof(reads[0])); n++) {
+	ft_file_read_setup(reads[n].len, reads[n].depth, reads[n].flags);
+	checksum_file(fname, size, 0, &ft_digest_murmur3, val_array, pool);
+	start = apr_time_now();
+	for (round = 0; round < 4; round++)
+	    checksum_file(fname, size, 0, &ft_digest_murmur3, val_array, pool);
+	elapsed = apr_time_now() - start;
+	printf("reads of %8" APR_SIZE_T_FMT ", %2u in flight%s: %8" APR_OFF_T_FMT " reads per file, %6.2f GB/s\n",
+	       reads[n].len, reads[n].depth, (reads[n].flags & FT_READ_THREADS) ? " (threads)" : "",
+	       (size + reads[n].len - 1) / reads[n].len,
+	       (double) size * 4 / (elapsed ? elapsed : 1) / 1000.0);
+    }
+    fflush(stdout);
+    ft_file_read_setup(FT_READ_LEN, FT_READ_DEPTH, 0);
+    unlink(fname);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* where a file is, FIEMAP or not, is on the device apr_stat tells */
+START_TEST(test_file_locate)
+{
+    apr_uint64_t device, offset;
+    apr_finfo_t finfo;
+    apr_status_t status;
+    int physical;
+
+    status = apr_stat(&finfo, fname1, APR_FINFO_IDENT, pool);
+    fail_unless(APR_SUCCESS == status, "apr_stat failed");
+    status = ft_file_locate(fname1, &device, &offset, &physical);
+    fail_unless(APR_SUCCESS == status, "locating a file failed");
+    fail_unless((apr_uint64_t) finfo.device == device, "wrong device");
+    fail_unless(physical || ((apr_uint64_t) finfo.inode == offset), "wrong inode");
+
+    status = ft_file_locate(CHECK_DIR "/tests/doesnotexist", &device, &offset, &physical);
+    fail_unless(APR_SUCCESS != status, "locating a missing file succeeded");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_file_bench_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_File_Bench");
+    tc_core = tcase_create("Benchmarks");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 0);
+    tcase_add_test(tc_core, bench_read_size);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
 Suite *make_ft_file_suite(void)
 {
     Suite *s;
@@ -107,7 +459,14 @@ Suite *make_ft_file_suite(void)
 
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_checksum_file);
+    tcase_add_test(tc_core, test_checksum_file_block);
+    tcase_add_test(tc_core, test_checksum_file_segment);
+    tcase_add_test(tc_core, test_checksum_files);
     tcase_add_test(tc_core, test_filecmp);
+    tcase_add_test(tc_core, test_read_size);
+    tcase_add_test(tc_core, test_mmap_window);
+    tcase_add_test(tc_core, test_filecmp_group);
+    tcase_add_test(tc_core, test_file_locate);
     suite_add_tcase(s, tc_core);
 
     return s;
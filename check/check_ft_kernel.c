@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "debug.h"
+#include "ft_kernel.h"
+
+extern apr_pool_t *main_pool;
+apr_pool_t *pool;
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+    ft_kernel_select(ft_kernel_find("generic"));
+}
+
+static int sign(int i)
+{
+    return (i > 0) - (i < 0);
+}
+
+START_TEST(test_ft_kernel_select)
+{
+    const ft_kernel_t *generic;
+
+    generic = ft_kernel_find("generic");
+    fail_unless(NULL != generic, "generic kernel not found");
+    fail_unless(NULL == ft_kernel_find("mmx"), "unknown kernel found");
+    fail_unless(APR_SUCCESS == ft_kernel_select(generic), "generic kernel not supported");
+    fail_unless(generic == ft_kernel_current(), "generic kernel not selected");
+    fail_unless(APR_SUCCESS == ft_kernel_select(NULL), "no kernel supported");
+    fail_unless(ft_kernel_current()->supported(), "unsupported kernel selected");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/* every kernel the CPU supports gives the results of the generic one, on random inputs */
+START_TEST(test_ft_kernel_cross_check)
+{
+    apr_uint32_t ref[FT_DIGEST_LANES][FT_DIGEST_WORDS], states[FT_DIGEST_LANES][FT_DIGEST_WORDS];
+    const unsigned char *data[FT_DIGEST_LANES];
+    const ft_kernel_t *generic;
+    unsigned char *buf, *buf2;
+    apr_size_t pos, len = FT_DIGEST_JENKINS_BLOCK, len2;
+    int i, l, nb, round, rv, rv2;
+
+    generic = ft_kernel_find("generic");
+    buf = apr_palloc(pool, FT_DIGEST_LANES * len);
+    buf2 = apr_palloc(pool, len);
+    srandom(42);
+
+    for (i = 0; NULL != ft_kernels[i]; i++) {
+	if (!ft_kernels[i]->supported())
+	    continue;
+
+	for (round = 0; round < 100; round++) {
+	    for (pos = 0; pos < FT_DIGEST_LANES * len; pos++)
+		buf[pos] = (unsigned char) random();
+	    nb = 1 + random() % FT_DIGEST_LANES;
+	    len2 = random() % (len + 1);
+	    for (l = 0; l < nb; l++) {
+		data[l] = buf + l * len;
+		memset(ref[l], l, sizeof(ref[l]));
+	    }
+	    memcpy(states, ref, sizeof(ref));
+	    generic->jenkins_lanes(ref, data, nb, 0, len2);
+	    ft_kernels[i]->jenkins_lanes(states, data, nb, 0, len2);
+	    fail_unless(0 == memcmp(ref, states, nb * sizeof(ref[0])), "%s jenkins_lanes differs on %" APR_SIZE_T_FMT
+			" bytes", ft_kernels[i]->name, len2);
+
+	    /* equal, then differing at a random place */
+	    memcpy(buf2, buf, len2);
+	    rv = ft_kernels[i]->cmp(buf, buf2, len2);
+	    fail_unless(0 == rv, "%s cmp differs on equal buffers", ft_kernels[i]->name);
+	    if (0 != len2) {
+		pos = random() % len2;
+		buf2[pos] = (unsigned char) random();
+		rv = generic->cmp(buf, buf2, len2);
+		rv2 = ft_kernels[i]->cmp(buf, buf2, len2);
+		fail_unless(sign(rv) == sign(rv2), "%s cmp differs at %" APR_SIZE_T_FMT, ft_kernels[i]->name, pos);
+	    }
+	}
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_ft_kernel_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Ft_Kernel");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_ft_kernel_select);
+    tcase_add_test(tc_core, test_ft_kernel_cross_check);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
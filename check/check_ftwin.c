@@ -34,6 +34,16 @@ apr_pool_t *main_pool = NULL;
 Suite *make_napr_heap_suite(void);
 Suite *make_apr_hash_suite(void);
 Suite *make_ft_file_suite(void);
+Suite *make_ft_file_bench_suite(void);
+Suite *make_napr_heap_bench_suite(void);
+Suite *make_napr_queue_suite(void);
+Suite *make_napr_queue_bench_suite(void);
+Suite *make_napr_slab_suite(void);
+Suite *make_napr_slab_bench_suite(void);
+Suite *make_ft_digest_suite(void);
+Suite *make_ft_digest_bench_suite(void);
+Suite *make_ft_kernel_suite(void);
+Suite *make_ft_cache_suite(void);
 
 int main(int argc, char **argv)
 {
@@ -71,6 +81,30 @@ int main(int argc, char **argv)
     if (!num || num == 3)
 	srunner_add_suite(sr, make_ft_file_suite());
 
+    /* benchmarks are only run on demand */
+    if (num == 4) {
+	srunner_add_suite(sr, make_napr_heap_bench_suite());
+	srunner_add_suite(sr, make_napr_queue_bench_suite());
+	srunner_add_suite(sr, make_napr_slab_bench_suite());
+	srunner_add_suite(sr, make_ft_digest_bench_suite());
+	srunner_add_suite(sr, make_ft_file_bench_suite());
+    }
+
+    if (!num || num == 5)
+	srunner_add_suite(sr, make_napr_queue_suite());
+
+    if (!num || num == 6)
+	srunner_add_suite(sr, make_napr_slab_suite());
+
+    if (!num || num == 7)
+	srunner_add_suite(sr, make_ft_digest_suite());
+
+    if (!num || num == 8)
+	srunner_add_suite(sr, make_ft_kernel_suite());
+
+    if (!num || num == 9)
+	srunner_add_suite(sr, make_ft_cache_suite());
+
     srunner_set_fork_status(sr, CK_NOFORK);
     srunner_set_xml(sr, "check_log.xml");
 
@@ -19,9 +19,13 @@
 #include <check.h>
 
 #include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
 
 #include "debug.h"
+#include "napr_dheap.h"
 #include "napr_heap.h"
+#include "napr_mqueue.h"
 
 extern apr_pool_t *main_pool;
 apr_pool_t *pool;
@@ -111,6 +115,428 @@ START_TEST(test_napr_heap_unordered_bug)
 END_TEST
 /* *INDENT-ON* */
 
+START_TEST(test_napr_heap_from_array)
+{
+    apr_off_t array[] = { 6298, 43601, 193288, 30460, 193288, 12, 0, 43601, 7, 99999 };
+    apr_off_t sorted[] = { 193288, 193288, 99999, 43601, 43601, 30460, 6298, 12, 7, 0 };
+    check_heap_numbers_t *numbers[sizeof(array) / sizeof(apr_off_t)];
+    check_heap_numbers_t *number;
+    napr_heap_t *heap;
+    void **drained;
+    unsigned int i, nb;
+
+    for (i = 0; i < sizeof(array) / sizeof(apr_off_t); i++) {
+	numbers[i] = apr_palloc(pool, sizeof(struct check_heap_numbers_t));
+	numbers[i]->size = array[i];
+    }
+
+    heap = napr_heap_make_from_array(pool, check_heap_numbers_cmp, (void **) numbers, i);
+    fail_unless(NULL != heap, "napr_heap_make_from_array failed");
+    fail_unless(i == napr_heap_size(heap), "bad heap size");
+    for (i = 0; i < sizeof(array) / sizeof(apr_off_t); i++) {
+	number = napr_heap_extract(heap);
+	fail_unless(number->size == sorted[i], "bad ordered at %u", i);
+    }
+    fail_unless(NULL == napr_heap_extract(heap), "heap should be empty");
+    napr_heap_destroy(heap);
+
+    heap = napr_heap_make(pool, check_heap_numbers_cmp);
+    /* more than the initial size, to go through a reallocation */
+    for (i = 0; i < 1000; i++) {
+	number = apr_palloc(pool, sizeof(struct check_heap_numbers_t));
+	number->size = (i * 7919) % 1000;
+	napr_heap_insert(heap, number);
+    }
+    drained = napr_heap_drain_sorted(heap, &nb);
+    fail_unless(1000 == nb, "bad drained size");
+    fail_unless(0 == napr_heap_size(heap), "heap should be empty after drain");
+    for (i = 0; i < nb; i++) {
+	number = drained[i];
+	fail_unless(number->size == 999 - i, "bad drained order at %u", i);
+    }
+    napr_heap_destroy(heap);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_heap_stats)
+{
+    napr_heap_stats_t stats;
+    check_heap_numbers_t *number;
+    napr_heap_t *heap;
+    unsigned int i;
+
+    heap = napr_heap_make(pool, check_heap_numbers_cmp);
+    napr_heap_get_stats(heap, &stats);
+    fail_unless((0 == stats.count) && (0 == stats.peak) && (0 == stats.nb_reallocs), "wrong stats of an empty heap");
+    fail_unless(0 < stats.max, "no slot allocated");
+
+    /* 256 slots at first, 1000 elements need two reallocations */
+    for (i = 0; i < 1000; i++) {
+	number = apr_palloc(pool, sizeof(struct check_heap_numbers_t));
+	number->size = (i * 7919) % 1000;
+	fail_unless(0 == napr_heap_insert(heap, number), "error calling napr_heap_insert");
+    }
+    napr_heap_get_stats(heap, &stats);
+    fail_unless((1000 == stats.count) && (1000 == stats.peak), "wrong count or peak");
+    fail_unless((1024 == stats.max) && (2 == stats.nb_reallocs), "wrong slots or reallocations");
+    fail_unless(stats.max * sizeof(void *) == stats.bytes, "wrong bytes");
+
+    /* the peak stays, and the slots are not given back */
+    for (i = 0; i < 400; i++)
+	fail_unless(NULL != napr_heap_extract(heap), "error calling napr_heap_extract");
+    napr_heap_get_stats(heap, &stats);
+    fail_unless((600 == stats.count) && (1000 == stats.peak), "wrong count or peak after extract");
+    fail_unless((1024 == stats.max) && (2 == stats.nb_reallocs), "wrong slots or reallocations after extract");
+    fail_unless(600 == napr_heap_size(heap), "stats and napr_heap_size differ");
+    napr_heap_destroy(heap);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_dheap)
+{
+    apr_off_t array[] = { 6298, 43601, 193288, 30460, 193288, 12, 0, 43601, 7, 99999 };
+    apr_off_t sorted[] = { 193288, 193288, 99999, 43601, 43601, 30460, 6298, 12, 7, 0 };
+    unsigned int arities[] = { 2, 4, 8 };
+    napr_dheap_t *heap;
+    apr_off_t key, prev;
+    unsigned int i, j;
+    void *datum;
+
+    for (j = 0; j < sizeof(arities) / sizeof(unsigned int); j++) {
+	heap = napr_dheap_make(pool, arities[j]);
+	fail_unless(NULL != heap, "napr_dheap_make failed");
+	for (i = 0; i < sizeof(array) / sizeof(apr_off_t); i++)
+	    napr_dheap_insert(heap, array[i], &array[i]);
+
+	for (i = 0; i < sizeof(array) / sizeof(apr_off_t); i++) {
+	    datum = napr_dheap_extract(heap, &key);
+	    fail_unless(key == sorted[i], "%u-ary: bad ordered at %u", arities[j], i);
+	    fail_unless(*(apr_off_t *) datum == key, "%u-ary: datum doesn't match its key", arities[j]);
+	}
+	fail_unless(NULL == napr_dheap_extract(heap, NULL), "%u-ary: heap should be empty", arities[j]);
+
+	/* more than the initial size, to go through a reallocation */
+	for (i = 0; i < 5000; i++)
+	    napr_dheap_insert(heap, (i * 7919) % 1000, NULL);
+	fail_unless(5000 == napr_dheap_size(heap), "%u-ary: bad heap size", arities[j]);
+	prev = 1000;
+	for (i = 0; i < 5000; i++) {
+	    napr_dheap_extract(heap, &key);
+	    fail_unless(key <= prev, "%u-ary: bad ordered at %u", arities[j], i);
+	    prev = key;
+	}
+	napr_dheap_destroy(heap);
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_heap_extract_r_empty)
+{
+    check_heap_numbers_t number;
+    napr_heap_t *heap;
+
+    heap = napr_heap_make_r(pool, check_heap_numbers_cmp);
+    number.size = 42;
+
+    /* the mutex used to stay locked when the heap was empty */
+    fail_unless(NULL == napr_heap_extract_r(heap), "heap should be empty");
+    fail_unless(NULL == napr_heap_extract_r(heap), "heap should be empty");
+    fail_unless(0 == napr_heap_insert_r(heap, &number), "napr_heap_insert_r failed");
+    fail_unless(&number == napr_heap_extract_r(heap), "napr_heap_extract_r failed");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+#define CHECK_MQUEUE_THREADS 4
+#define CHECK_MQUEUE_NB 20000
+
+struct check_mqueue_arg_t
+{
+    napr_mqueue_t *queue;
+    apr_off_t *keys;
+    unsigned int *seen;
+    unsigned int first, nb;
+};
+
+static void *APR_THREAD_FUNC check_mqueue_producer(apr_thread_t *thd, void *data)
+{
+    struct check_mqueue_arg_t *arg = data;
+    unsigned int i;
+
+    for (i = arg->first; i < arg->first + arg->nb; i++)
+	napr_mqueue_insert(arg->queue, arg->keys[i], &arg->keys[i]);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC check_mqueue_consumer(apr_thread_t *thd, void *data)
+{
+    struct check_mqueue_arg_t *arg = data;
+    apr_off_t *datum, key;
+
+    while (NULL != (datum = napr_mqueue_extract(arg->queue, &key))) {
+	if (*datum == key)
+	    __atomic_add_fetch(&arg->seen[datum - arg->keys], 1, __ATOMIC_RELAXED);
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+START_TEST(test_napr_mqueue)
+{
+    struct check_mqueue_arg_t args[CHECK_MQUEUE_THREADS];
+    apr_thread_t *threads[CHECK_MQUEUE_THREADS];
+    napr_mqueue_t *queue;
+    apr_off_t *keys, key, prev;
+    unsigned int *seen;
+    apr_status_t status, rv;
+    unsigned int i;
+
+    /* a single thread queue is a strict priority queue */
+    queue = napr_mqueue_make(pool, 1);
+    for (i = 0; i < 1000; i++)
+	napr_mqueue_insert(queue, (i * 7919) % 1000, NULL);
+    for (prev = 1000, i = 0; i < 1000; i++) {
+	napr_mqueue_extract(queue, &key);
+	fail_unless(key <= prev, "bad ordered at %u", i);
+	prev = key;
+    }
+    fail_unless(0 == napr_mqueue_size(queue), "queue should be empty");
+
+    keys = apr_palloc(pool, CHECK_MQUEUE_NB * sizeof(apr_off_t));
+    seen = apr_pcalloc(pool, CHECK_MQUEUE_NB * sizeof(unsigned int));
+    for (i = 0; i < CHECK_MQUEUE_NB; i++)
+	keys[i] = (i * 7919) % CHECK_MQUEUE_NB;
+
+    queue = napr_mqueue_make(pool, CHECK_MQUEUE_THREADS);
+    for (i = 0; i < CHECK_MQUEUE_THREADS; i++) {
+	args[i].queue = queue;
+	args[i].keys = keys;
+	args[i].seen = seen;
+	args[i].nb = CHECK_MQUEUE_NB / CHECK_MQUEUE_THREADS;
+	args[i].first = i * args[i].nb;
+	status = apr_thread_create(&threads[i], NULL, check_mqueue_producer, &args[i], pool);
+	fail_unless(APR_SUCCESS == status, "apr_thread_create failed");
+    }
+    for (i = 0; i < CHECK_MQUEUE_THREADS; i++)
+	apr_thread_join(&rv, threads[i]);
+    fail_unless(CHECK_MQUEUE_NB == napr_mqueue_size(queue), "bad queue size");
+
+    for (i = 0; i < CHECK_MQUEUE_THREADS; i++) {
+	status = apr_thread_create(&threads[i], NULL, check_mqueue_consumer, &args[i], pool);
+	fail_unless(APR_SUCCESS == status, "apr_thread_create failed");
+    }
+    for (i = 0; i < CHECK_MQUEUE_THREADS; i++)
+	apr_thread_join(&rv, threads[i]);
+
+    for (i = 0; i < CHECK_MQUEUE_NB; i++)
+	fail_unless(1 == seen[i], "element %u extracted %u times", i, seen[i]);
+    napr_mqueue_destroy(queue);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/*
+ * Benchmarks, not run by default: "check_ftwin 4", the number of elements is
+ * taken from FTWIN_BENCH_NB (default 1M).
+ */
+unsigned int bench_nb_elements(void)
+{
+    const char *nb = getenv("FTWIN_BENCH_NB");
+
+    return (NULL != nb) ? strtoul(nb, NULL, 10) : 1000000;
+}
+
+static void bench_display(const char *name, unsigned int nb, apr_time_t start, apr_time_t middle, apr_time_t end)
+{
+    printf("%-24s %10u elements: build %6" APR_TIME_T_FMT " ms, extract %6" APR_TIME_T_FMT " ms\n", name, nb,
+	   apr_time_as_msec(middle - start), apr_time_as_msec(end - middle));
+    fflush(stdout);
+}
+
+START_TEST(bench_napr_heap_layouts)
+{
+    unsigned int arities[] = { 2, 4, 8 };
+    check_heap_numbers_t *numbers, *number;
+    check_heap_numbers_t **ptrs;
+    napr_heap_t *heap;
+    napr_dheap_t *dheap;
+    apr_time_t start, middle;
+    apr_off_t prev, key;
+    unsigned int i, j, nb;
+    char name[32];
+
+    nb = bench_nb_elements();
+    numbers = malloc(nb * sizeof(check_heap_numbers_t));
+    ptrs = malloc(nb * sizeof(check_heap_numbers_t *));
+    fail_unless((NULL != numbers) && (NULL != ptrs), "allocation failed");
+    srandom(1337);
+    for (i = 0; i < nb; i++) {
+	numbers[i].size = ((apr_off_t) random() << 16) ^ random();
+	ptrs[i] = &numbers[i];
+    }
+
+    start = apr_time_now();
+    heap = napr_heap_make(pool, check_heap_numbers_cmp);
+    for (i = 0; i < nb; i++)
+	napr_heap_insert(heap, ptrs[i]);
+    middle = apr_time_now();
+    for (prev = -1, i = 0; i < nb; i++) {
+	number = napr_heap_extract(heap);
+	fail_unless((0 > prev) || (number->size <= prev), "napr_heap: bad ordered at %u", i);
+	prev = number->size;
+    }
+    bench_display("napr_heap insert", nb, start, middle, apr_time_now());
+    napr_heap_destroy(heap);
+
+    start = apr_time_now();
+    heap = napr_heap_make_from_array(pool, check_heap_numbers_cmp, (void **) ptrs, nb);
+    middle = apr_time_now();
+    napr_heap_drain_sorted(heap, &i);
+    bench_display("napr_heap from_array", nb, start, middle, apr_time_now());
+    napr_heap_destroy(heap);
+
+    for (j = 0; j < sizeof(arities) / sizeof(unsigned int); j++) {
+	start = apr_time_now();
+	dheap = napr_dheap_make(pool, arities[j]);
+	for (i = 0; i < nb; i++)
+	    napr_dheap_insert(dheap, ptrs[i]->size, ptrs[i]);
+	middle = apr_time_now();
+	for (prev = -1, i = 0; i < nb; i++) {
+	    napr_dheap_extract(dheap, &key);
+	    fail_unless((0 > prev) || (key <= prev), "napr_dheap: bad ordered at %u", i);
+	    prev = key;
+	}
+	snprintf(name, sizeof(name), "napr_dheap %u-ary", arities[j]);
+	bench_display(name, nb, start, middle, apr_time_now());
+	napr_dheap_destroy(dheap);
+    }
+
+    free(ptrs);
+    free(numbers);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+struct bench_contention_arg_t
+{
+    napr_heap_t *heap;
+    napr_mqueue_t *queue;
+    check_heap_numbers_t *numbers;
+    unsigned int nb;
+};
+
+/* each thread inserts then extracts, keeping the queue around the same size */
+static void *APR_THREAD_FUNC bench_contention_heap_r(apr_thread_t *thd, void *data)
+{
+    struct bench_contention_arg_t *arg = data;
+    unsigned int i;
+
+    for (i = 0; i < arg->nb; i++) {
+	napr_heap_insert_r(arg->heap, &arg->numbers[i]);
+	napr_heap_extract_r(arg->heap);
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC bench_contention_mqueue(apr_thread_t *thd, void *data)
+{
+    struct bench_contention_arg_t *arg = data;
+    unsigned int i;
+
+    for (i = 0; i < arg->nb; i++) {
+	napr_mqueue_insert(arg->queue, arg->numbers[i].size, &arg->numbers[i]);
+	napr_mqueue_extract(arg->queue, NULL);
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+START_TEST(bench_napr_mqueue_contention)
+{
+    struct bench_contention_arg_t args[16];
+    apr_thread_t *threads[16];
+    check_heap_numbers_t *numbers;
+    apr_time_t start, middle;
+    apr_status_t rv;
+    unsigned int i, nb, nb_threads;
+
+    nb = bench_nb_elements();
+    numbers = malloc(nb * sizeof(check_heap_numbers_t));
+    fail_unless(NULL != numbers, "allocation failed");
+    srandom(1337);
+    for (i = 0; i < nb; i++)
+	numbers[i].size = ((apr_off_t) random() << 16) ^ random();
+
+    for (nb_threads = 1; nb_threads <= 16; nb_threads *= 2) {
+	napr_heap_t *heap = napr_heap_make_r(pool, check_heap_numbers_cmp);
+	napr_mqueue_t *queue = napr_mqueue_make(pool, nb_threads);
+
+	/* start with a populated queue */
+	for (i = 0; i < nb / 2; i++) {
+	    napr_heap_insert(heap, &numbers[i]);
+	    napr_mqueue_insert(queue, numbers[i].size, &numbers[i]);
+	}
+	for (i = 0; i < nb_threads; i++) {
+	    args[i].heap = heap;
+	    args[i].queue = queue;
+	    args[i].nb = (nb / 2) / nb_threads;
+	    args[i].numbers = numbers + nb / 2 + i * args[i].nb;
+	}
+
+	start = apr_time_now();
+	for (i = 0; i < nb_threads; i++)
+	    apr_thread_create(&threads[i], NULL, bench_contention_heap_r, &args[i], pool);
+	for (i = 0; i < nb_threads; i++)
+	    apr_thread_join(&rv, threads[i]);
+	middle = apr_time_now();
+	for (i = 0; i < nb_threads; i++)
+	    apr_thread_create(&threads[i], NULL, bench_contention_mqueue, &args[i], pool);
+	for (i = 0; i < nb_threads; i++)
+	    apr_thread_join(&rv, threads[i]);
+
+	printf("%2u threads %10u insert+extract: napr_heap_r %6" APR_TIME_T_FMT " ms, napr_mqueue %6" APR_TIME_T_FMT
+	       " ms\n", nb_threads, nb / 2, apr_time_as_msec(middle - start), apr_time_as_msec(apr_time_now() - middle));
+	fflush(stdout);
+	napr_heap_destroy(heap);
+    }
+
+    free(numbers);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_napr_heap_bench_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Heap_Bench");
+    tc_core = tcase_create("Benchmarks");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 0);
+    tcase_add_test(tc_core, bench_napr_heap_layouts);
+    tcase_add_test(tc_core, bench_napr_mqueue_contention);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
 Suite *make_napr_heap_suite(void)
 {
     Suite *s;
@@ -120,6 +546,11 @@ Suite *make_napr_heap_suite(void)
 
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_napr_heap_unordered_bug);
+    tcase_add_test(tc_core, test_napr_heap_from_array);
+    tcase_add_test(tc_core, test_napr_heap_stats);
+    tcase_add_test(tc_core, test_napr_dheap);
+    tcase_add_test(tc_core, test_napr_heap_extract_r_empty);
+    tcase_add_test(tc_core, test_napr_mqueue);
     suite_add_tcase(s, tc_core);
 
     return s;
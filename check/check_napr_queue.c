@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <check.h>
+
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+#include "debug.h"
+#include "napr_list.h"
+#include "napr_queue.h"
+
+extern apr_pool_t *main_pool;
+apr_pool_t *pool;
+
+unsigned int bench_nb_elements(void);
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+static int check_list_cmp(const void *key1, const void *key2)
+{
+    return (key1 == key2) ? 0 : 1;
+}
+
+START_TEST(test_napr_list)
+{
+    int values[4] = { 0, 1, 2, 3 };
+    napr_list_t *list;
+    napr_cell_t *cell;
+    int i;
+
+    list = napr_list_make(pool);
+    fail_unless(NULL == napr_list_first(list), "list should be empty");
+    fail_unless(0 == napr_list_enqueue(list, &values[1]), "enqueue failed");
+    fail_unless(0 == napr_list_enqueue(list, &values[2]), "enqueue failed");
+    fail_unless(0 == napr_list_cons(list, &values[0]), "cons failed");
+    fail_unless(1 == napr_list_insert(list, &values[3], check_list_cmp), "insert of a new element failed");
+    fail_unless(0 == napr_list_insert(list, &values[3], check_list_cmp), "insert of an existing element succeeded");
+    fail_unless(1 == napr_list_member(list, &values[2], check_list_cmp), "member failed");
+
+    for (i = 0, cell = napr_list_first(list); NULL != cell; cell = napr_list_next(cell), i++)
+	fail_unless(&values[i] == napr_list_get(cell), "bad element at %i", i);
+    fail_unless(4 == i, "bad number of elements %i", i);
+    fail_unless(&values[3] == napr_list_get(napr_list_last(list)), "bad last element");
+
+    napr_list_cdr(list);
+    fail_unless(&values[1] == napr_list_get(napr_list_first(list)), "bad first element after cdr");
+    napr_list_delete(list);
+    fail_unless(NULL == napr_list_first(list), "list should be empty");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_queue)
+{
+    void *data[32];
+    napr_queue_t *queue;
+    void *datum;
+    apr_size_t i;
+
+    queue = napr_queue_make(pool, 10);
+    fail_unless(APR_EAGAIN == napr_queue_pop(queue, &datum), "queue should be empty");
+
+    /* rounded up to 16 */
+    for (i = 0; i < 16; i++)
+	fail_unless(APR_SUCCESS == napr_queue_push(queue, (void *) (i + 1)), "push %" APR_SIZE_T_FMT " failed", i);
+    fail_unless(APR_EAGAIN == napr_queue_push(queue, (void *) 17), "queue should be full");
+    fail_unless(16 == napr_queue_size(queue), "bad size");
+
+    for (i = 0; i < 8; i++) {
+	fail_unless(APR_SUCCESS == napr_queue_pop(queue, &datum), "pop failed");
+	fail_unless((void *) (i + 1) == datum, "bad order");
+    }
+
+    /* the batch is cut to the room left, and wraps around */
+    for (i = 0; i < 32; i++)
+	data[i] = (void *) (i + 17);
+    fail_unless(8 == napr_queue_push_batch(queue, data, 32), "bad batch push");
+    fail_unless(0 == napr_queue_push_batch(queue, data + 8, 24), "batch push in a full queue");
+
+    fail_unless(5 == napr_queue_pop_batch(queue, data, 5), "bad batch pop");
+    for (i = 0; i < 5; i++)
+	fail_unless((void *) (i + 9) == data[i], "bad order in batch");
+    fail_unless(11 == napr_queue_pop_batch(queue, data, 32), "bad batch pop");
+    for (i = 0; i < 11; i++)
+	fail_unless((void *) (i + 14) == data[i], "bad order in batch");
+    fail_unless(0 == napr_queue_pop_batch(queue, data, 32), "queue should be empty");
+
+    fail_unless(APR_SUCCESS == napr_queue_push(queue, (void *) 42), "push failed");
+    napr_queue_close(queue);
+    fail_unless(APR_EOF == napr_queue_push(queue, (void *) 43), "push in a closed queue");
+    fail_unless(APR_SUCCESS == napr_queue_pop_wait(queue, &datum), "a closed queue must be drained");
+    fail_unless((void *) 42 == datum, "bad element");
+    fail_unless(APR_EOF == napr_queue_pop_wait(queue, &datum), "queue should be closed");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+#define CHECK_QUEUE_PRODUCERS 4
+#define CHECK_QUEUE_NB 20000
+#define CHECK_QUEUE_BATCH 16
+
+struct check_queue_arg_t
+{
+    napr_queue_t *queue;
+    apr_uint32_t *nb_running;
+    apr_size_t id;
+    unsigned int nb, batch;
+};
+
+/* elements are (id << 24) | rank, rank starting at 1 so that none is NULL */
+static void *APR_THREAD_FUNC check_queue_producer(apr_thread_t *thd, void *data)
+{
+    struct check_queue_arg_t *arg = data;
+    void *batch[CHECK_QUEUE_BATCH];
+    unsigned int i, j;
+
+    for (i = 0; i < arg->nb; i += arg->batch) {
+	for (j = 0; (j < arg->batch) && (i + j < arg->nb); j++)
+	    batch[j] = (void *) ((arg->id << 24) | (i + j + 1));
+	if (1 == j)
+	    napr_queue_push_wait(arg->queue, batch[0]);
+	else
+	    napr_queue_push_batch_wait(arg->queue, batch, j);
+    }
+
+    /* the last one closes the door */
+    if (0 == __atomic_sub_fetch(arg->nb_running, 1, __ATOMIC_ACQ_REL))
+	napr_queue_close(arg->queue);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+START_TEST(test_napr_queue_mpsc)
+{
+    struct check_queue_arg_t args[CHECK_QUEUE_PRODUCERS];
+    apr_thread_t *threads[CHECK_QUEUE_PRODUCERS];
+    unsigned int last[CHECK_QUEUE_PRODUCERS];
+    apr_uint32_t nb_running;
+    napr_queue_t *queue;
+    apr_status_t status, rv;
+    apr_size_t value, id;
+    unsigned int i, nb;
+    void *datum;
+
+    queue = napr_queue_make(pool, 64);
+    nb_running = CHECK_QUEUE_PRODUCERS;
+    for (i = 0; i < CHECK_QUEUE_PRODUCERS; i++) {
+	args[i].queue = queue;
+	args[i].nb_running = &nb_running;
+	args[i].id = i;
+	args[i].nb = CHECK_QUEUE_NB;
+	/* half of the producers push one by one, the others by batches */
+	args[i].batch = (i % 2) ? CHECK_QUEUE_BATCH : 1;
+	last[i] = 0;
+	status = apr_thread_create(&threads[i], NULL, check_queue_producer, &args[i], pool);
+	fail_unless(APR_SUCCESS == status, "apr_thread_create failed");
+    }
+
+    for (nb = 0; APR_SUCCESS == (status = napr_queue_pop_wait(queue, &datum)); nb++) {
+	value = (apr_size_t) datum;
+	id = value >> 24;
+	fail_unless(id < CHECK_QUEUE_PRODUCERS, "bad producer %" APR_SIZE_T_FMT, id);
+	/* FIFO for each producer */
+	fail_unless((value & 0xffffff) == last[id] + 1, "producer %" APR_SIZE_T_FMT " out of order", id);
+	last[id]++;
+    }
+    fail_unless(APR_EOF == status, "pop_wait should end with APR_EOF");
+
+    for (i = 0; i < CHECK_QUEUE_PRODUCERS; i++)
+	apr_thread_join(&rv, threads[i]);
+
+    fail_unless(CHECK_QUEUE_PRODUCERS * CHECK_QUEUE_NB == nb, "%u elements lost", CHECK_QUEUE_PRODUCERS * CHECK_QUEUE_NB - nb);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/*
+ * Benchmark, not run by default: "check_ftwin 4", the number of elements is
+ * taken from FTWIN_BENCH_NB (default 1M).
+ */
+struct bench_queue_arg_t
+{
+    napr_queue_t *queue;
+    napr_list_t *list;
+    apr_thread_mutex_t *mutex;
+    apr_uint32_t *nb_running;
+    unsigned int nb, batch;
+};
+
+static void *APR_THREAD_FUNC bench_queue_producer(apr_thread_t *thd, void *data)
+{
+    struct bench_queue_arg_t *arg = data;
+    void *batch[CHECK_QUEUE_BATCH];
+    unsigned int i, j;
+
+    for (i = 0; i < arg->nb; i += arg->batch) {
+	for (j = 0; (j < arg->batch) && (i + j < arg->nb); j++)
+	    batch[j] = arg;
+	if (1 == j)
+	    napr_queue_push_wait(arg->queue, arg);
+	else
+	    napr_queue_push_batch_wait(arg->queue, batch, j);
+    }
+    if (0 == __atomic_sub_fetch(arg->nb_running, 1, __ATOMIC_ACQ_REL))
+	napr_queue_close(arg->queue);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC bench_list_producer(apr_thread_t *thd, void *data)
+{
+    struct bench_queue_arg_t *arg = data;
+    unsigned int i;
+
+    for (i = 0; i < arg->nb; i++) {
+	apr_thread_mutex_lock(arg->mutex);
+	napr_list_enqueue(arg->list, arg);
+	apr_thread_mutex_unlock(arg->mutex);
+    }
+    apr_thread_mutex_lock(arg->mutex);
+    (*arg->nb_running)--;
+    apr_thread_mutex_unlock(arg->mutex);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+START_TEST(bench_napr_queue_throughput)
+{
+    struct bench_queue_arg_t args[8];
+    apr_thread_t *threads[8];
+    void *data[CHECK_QUEUE_BATCH];
+    apr_uint32_t nb_running;
+    apr_thread_mutex_t *mutex;
+    napr_list_t *list;
+    apr_pool_t *list_pool;
+    apr_time_t start;
+    apr_status_t rv;
+    unsigned int i, nb, nb_threads, batch, total, got;
+    void *datum;
+
+    nb = bench_nb_elements();
+    apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+
+    for (nb_threads = 1; nb_threads <= 8; nb_threads *= 2) {
+	/* mutex protected napr_list, the baseline */
+	apr_pool_create(&list_pool, pool);
+	list = napr_list_make(list_pool);
+	nb_running = nb_threads;
+	start = apr_time_now();
+	for (i = 0; i < nb_threads; i++) {
+	    args[i].list = list;
+	    args[i].mutex = mutex;
+	    args[i].nb_running = &nb_running;
+	    args[i].nb = nb / nb_threads;
+	    apr_thread_create(&threads[i], NULL, bench_list_producer, &args[i], pool);
+	}
+	for (total = 0; total < (nb / nb_threads) * nb_threads;) {
+	    apr_thread_mutex_lock(mutex);
+	    if (NULL != napr_list_first(list)) {
+		napr_list_cdr(list);
+		total++;
+	    }
+	    apr_thread_mutex_unlock(mutex);
+	}
+	for (i = 0; i < nb_threads; i++)
+	    apr_thread_join(&rv, threads[i]);
+	printf("%u producers %10u elements: locked napr_list %6" APR_TIME_T_FMT " ms\n", nb_threads, total,
+	       apr_time_as_msec(apr_time_now() - start));
+	apr_pool_destroy(list_pool);
+
+	for (batch = 1; batch <= CHECK_QUEUE_BATCH; batch *= CHECK_QUEUE_BATCH) {
+	    napr_queue_t *queue = napr_queue_make(pool, 1024);
+
+	    nb_running = nb_threads;
+	    start = apr_time_now();
+	    for (i = 0; i < nb_threads; i++) {
+		args[i].queue = queue;
+		args[i].nb_running = &nb_running;
+		args[i].nb = nb / nb_threads;
+		args[i].batch = batch;
+		apr_thread_create(&threads[i], NULL, bench_queue_producer, &args[i], pool);
+	    }
+	    total = 0;
+	    if (1 == batch) {
+		while (APR_SUCCESS == napr_queue_pop_wait(queue, &datum))
+		    total++;
+	    }
+	    else {
+		while (APR_EOF != napr_queue_pop_wait(queue, &datum)) {
+		    got = napr_queue_pop_batch(queue, data, CHECK_QUEUE_BATCH);
+		    total += got + 1;
+		}
+	    }
+	    for (i = 0; i < nb_threads; i++)
+		apr_thread_join(&rv, threads[i]);
+	    printf("%u producers %10u elements: napr_queue (batch %2u) %6" APR_TIME_T_FMT " ms\n", nb_threads, total, batch,
+		   apr_time_as_msec(apr_time_now() - start));
+	}
+	fflush(stdout);
+    }
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_napr_queue_bench_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Queue_Bench");
+    tc_core = tcase_create("Benchmarks");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 0);
+    tcase_add_test(tc_core, bench_napr_queue_throughput);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+Suite *make_napr_queue_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Queue");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_napr_list);
+    tcase_add_test(tc_core, test_napr_queue);
+    tcase_add_test(tc_core, test_napr_queue_mpsc);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+
+#include <apr_strings.h>
+#include <apr_time.h>
+
+#include "debug.h"
+#include "napr_slab.h"
+
+extern apr_pool_t *main_pool;
+apr_pool_t *pool;
+
+unsigned int bench_nb_elements(void);
+
+/* bigger than the chunks of a slab without NAPR_SLAB_HUGEPAGE */
+#define CHUNK_TEST_SIZE (64 * 1024)
+
+static void setup(void)
+{
+    apr_status_t rs;
+
+    rs = apr_pool_create(&pool, main_pool);
+    if (rs != APR_SUCCESS) {
+	DEBUG_ERR("Error creating pool");
+	exit(1);
+    }
+}
+
+static void teardown(void)
+{
+    apr_pool_destroy(pool);
+}
+
+/* looks like a ft_file_t */
+typedef struct check_slab_record_t
+{
+    apr_off_t size;
+    char *path;
+    int flags;
+} check_slab_record_t;
+
+START_TEST(test_napr_slab)
+{
+    check_slab_record_t **records;
+    napr_slab_stats_t stats;
+    napr_slab_t *slab, *strings;
+    char buf[64], *big;
+    unsigned int i, nb = 100000;
+
+    slab = napr_slab_make(pool, sizeof(check_slab_record_t), 0);
+    strings = napr_slab_make(pool, 0, NAPR_SLAB_HUGEPAGE);
+    fail_unless((NULL != slab) && (NULL != strings), "napr_slab_make failed");
+    records = apr_palloc(pool, nb * sizeof(check_slab_record_t *));
+
+    for (i = 0; i < nb; i++) {
+	records[i] = napr_slab_alloc(slab);
+	fail_unless(NULL != records[i], "napr_slab_alloc failed");
+	fail_unless(0 == ((apr_size_t) records[i] % sizeof(void *)), "record %u is not aligned", i);
+	records[i]->size = i;
+	records[i]->flags = i % 2;
+	apr_snprintf(buf, sizeof(buf), "/srv/backup/host%u/file%u", i % 7, i);
+	records[i]->path = napr_slab_strdup(strings, buf);
+	fail_unless(NULL != records[i]->path, "napr_slab_strdup failed");
+    }
+    /* a string longer than a chunk */
+    big = apr_palloc(pool, 3 * 1024 * 1024);
+    memset(big, 'a', 3 * 1024 * 1024 - 1);
+    big[3 * 1024 * 1024 - 1] = '\0';
+    fail_unless(0 == strcmp(big, napr_slab_strdup(strings, big)), "long string corrupted");
+
+    /* nothing overlaps */
+    for (i = 0; i < nb; i++) {
+	apr_snprintf(buf, sizeof(buf), "/srv/backup/host%u/file%u", i % 7, i);
+	fail_unless((i == records[i]->size) && ((int) (i % 2) == records[i]->flags), "record %u corrupted", i);
+	fail_unless(0 == strcmp(buf, records[i]->path), "path %u corrupted", i);
+    }
+
+    napr_slab_get_stats(slab, &stats);
+    fail_unless(nb == stats.nb_objects, "bad number of objects");
+    fail_unless(nb * sizeof(check_slab_record_t) == stats.used, "bad number of used bytes");
+    fail_unless(stats.bytes >= stats.used, "bad number of bytes");
+    /* records are packed, only the chunk headers and tails are lost */
+    fail_unless(stats.used * 10 > stats.bytes * 9, "too much overhead");
+
+    napr_slab_get_stats(strings, &stats);
+    fail_unless(nb + 1 == stats.nb_objects, "bad number of strings");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+START_TEST(test_napr_slab_free)
+{
+    check_slab_record_t **records;
+    napr_slab_stats_t stats;
+    napr_slab_t *slab, *strings;
+    char buf[64], *big;
+    apr_size_t peak;
+    unsigned int i, nb = 100000;
+
+    slab = napr_slab_make(pool, sizeof(check_slab_record_t), 0);
+    strings = napr_slab_make(pool, 0, 0);
+    fail_unless((NULL != slab) && (NULL != strings), "napr_slab_make failed");
+    records = apr_palloc(pool, nb * sizeof(check_slab_record_t *));
+
+    for (i = 0; i < nb; i++) {
+	records[i] = napr_slab_alloc(slab);
+	fail_unless(NULL != records[i], "napr_slab_alloc failed");
+	records[i]->size = i;
+	apr_snprintf(buf, sizeof(buf), "/srv/backup/host%u/file%u", i % 7, i);
+	records[i]->path = napr_slab_strdup(strings, buf);
+	fail_unless(NULL != records[i]->path, "napr_slab_strdup failed");
+    }
+    big = napr_slab_alloc_size(strings, 3 * CHUNK_TEST_SIZE);
+    fail_unless(NULL != big, "napr_slab_alloc_size failed");
+    napr_slab_get_stats(slab, &stats);
+    peak = stats.peak;
+    fail_unless(stats.bytes == peak, "bad peak");
+
+    /* free the even records: every chunk still holds a live one */
+    for (i = 0; i < nb; i += 2) {
+	napr_slab_free_size(strings, records[i]->path, strlen(records[i]->path) + 1);
+	napr_slab_free(slab, records[i]);
+    }
+    napr_slab_get_stats(slab, &stats);
+    fail_unless(nb / 2 == stats.nb_objects, "bad number of objects");
+    fail_unless((nb / 2) * sizeof(check_slab_record_t) == stats.used, "bad number of used bytes");
+    fail_unless(peak == stats.bytes, "a chunk with live records has been released");
+
+    /* the odd ones are still there */
+    for (i = 1; i < nb; i += 2) {
+	apr_snprintf(buf, sizeof(buf), "/srv/backup/host%u/file%u", i % 7, i);
+	fail_unless(i == records[i]->size, "record %u corrupted", i);
+	fail_unless(0 == strcmp(buf, records[i]->path), "path %u corrupted", i);
+    }
+
+    /* free everything: only the current chunk is kept */
+    for (i = 1; i < nb; i += 2) {
+	napr_slab_free_size(strings, records[i]->path, strlen(records[i]->path) + 1);
+	napr_slab_free(slab, records[i]);
+    }
+    napr_slab_free_size(strings, big, 3 * CHUNK_TEST_SIZE);
+    napr_slab_get_stats(slab, &stats);
+    fail_unless((0 == stats.nb_objects) && (0 == stats.used), "records left");
+    fail_unless(1 == stats.nb_chunks, "empty chunks not released");
+    fail_unless(peak == stats.peak, "peak lost");
+    napr_slab_get_stats(strings, &stats);
+    fail_unless((0 == stats.nb_objects) && (1 == stats.nb_chunks), "empty string chunks not released");
+
+    /* the current chunk is filled again */
+    records[0] = napr_slab_alloc(slab);
+    fail_unless(NULL != records[0], "napr_slab_alloc failed");
+    napr_slab_get_stats(slab, &stats);
+    fail_unless(1 == stats.nb_chunks, "current chunk not reused");
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+/*
+ * Benchmark, not run by default: "check_ftwin 4", the number of elements is
+ * taken from FTWIN_BENCH_NB (default 1M), 10M looks like a big file server.
+ * Compare the memory used by file records and paths allocated from a pool
+ * and from slabs.
+ */
+static void bench_slab_path(char *buf, apr_size_t len, unsigned int i)
+{
+    apr_snprintf(buf, len, "/srv/backup/host%02u/2024/%02u/%02u/data/file-%08u.dat", i % 16, (i / 16) % 12,
+		 (i / 192) % 28, i);
+}
+
+START_TEST(bench_napr_slab_memory)
+{
+    check_slab_record_t *record;
+    napr_slab_t *slab, *strings;
+    apr_pool_t *pool_subpool, *slab_subpool;
+    unsigned long int before = 0, after = 0;
+    apr_time_t start;
+    char buf[128];
+    unsigned int i, nb;
+
+    nb = bench_nb_elements();
+
+    /* both pools are kept until the end, so that no memory is reused */
+    apr_pool_create(&pool_subpool, pool);
+    GET_MEMUSAGE(before);
+    start = apr_time_now();
+    for (i = 0; i < nb; i++) {
+	bench_slab_path(buf, sizeof(buf), i);
+	record = apr_palloc(pool_subpool, sizeof(check_slab_record_t));
+	record->size = i;
+	record->path = apr_pstrdup(pool_subpool, buf);
+    }
+    GET_MEMUSAGE(after);
+    printf("%10u files: pool %6" APR_TIME_T_FMT " ms, %6.1f bytes per file\n", nb,
+	   apr_time_as_msec(apr_time_now() - start), (double) (after - before) * getpagesize() / nb);
+
+    apr_pool_create(&slab_subpool, pool);
+    GET_MEMUSAGE(before);
+    start = apr_time_now();
+    slab = napr_slab_make(slab_subpool, sizeof(check_slab_record_t), NAPR_SLAB_HUGEPAGE);
+    strings = napr_slab_make(slab_subpool, 0, NAPR_SLAB_HUGEPAGE);
+    for (i = 0; i < nb; i++) {
+	bench_slab_path(buf, sizeof(buf), i);
+	record = napr_slab_alloc(slab);
+	record->size = i;
+	record->path = napr_slab_strdup(strings, buf);
+    }
+    GET_MEMUSAGE(after);
+    printf("%10u files: slab %6" APR_TIME_T_FMT " ms, %6.1f bytes per file\n", nb,
+	   apr_time_as_msec(apr_time_now() - start), (double) (after - before) * getpagesize() / nb);
+    fflush(stdout);
+
+    apr_pool_destroy(slab_subpool);
+    apr_pool_destroy(pool_subpool);
+}
+/* *INDENT-OFF* */
+END_TEST
+/* *INDENT-ON* */
+
+Suite *make_napr_slab_bench_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Slab_Bench");
+    tc_core = tcase_create("Benchmarks");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 0);
+    tcase_add_test(tc_core, bench_napr_slab_memory);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+Suite *make_napr_slab_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+    s = suite_create("Napr_Slab");
+    tc_core = tcase_create("Core Tests");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_napr_slab);
+    tcase_add_test(tc_core, test_napr_slab_free);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <apr_file_io.h>
+#include <apr_mmap.h>
+#include <apr_portable.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "config.h"
+
+#if HAVE_XATTR
+#include <sys/xattr.h>
+#endif
+
+#include "debug.h"
+#include "ft_cache.h"
+
+#define FT_CACHE_MAGIC "ftwinc01"
+
+#define FT_CACHE_XATTR_PREFIX "user.ftwin."
+/* size, mtime, flags, then the head, tail and full digests, little endian so that it can be read on any machine */
+#define FT_CACHE_XATTR_LEN (8 + 8 + 4 + 3 * FT_DIGEST_WORDS * 4)
+
+typedef struct ft_cache_header_t
+{
+    char magic[8];
+    char digest[16];		/* name of the digest of the entries */
+    apr_uint32_t entry_len;	/* sizeof(ft_cache_entry_t) of the build that wrote it */
+    apr_uint32_t generation;	/* of the run that wrote it */
+    apr_uint64_t nb_entries;
+} ft_cache_header_t;
+
+struct ft_cache_t
+{
+    const char *filename;
+    const ft_digest_t *digest;
+    const char *xattr_name;	/* of the extended attributes of the files */
+    apr_mmap_t *mm;		/* the cache file, NULL if there is none yet */
+    const ft_cache_entry_t *old;	/* its entries, sorted by device and inode */
+    apr_size_t nb_old;
+    apr_uint32_t generation;	/* of this run */
+    apr_array_header_t *entries;	/* of this run, ft_cache_entry_t pointers */
+    ft_cache_stats_t stats;
+    apr_pool_t *pool;
+};
+
+static int ft_cache_key_cmp(const ft_cache_entry_t *entry1, const ft_cache_entry_t *entry2)
+{
+    if (entry1->device != entry2->device)
+	return (entry1->device < entry2->device) ? -1 : 1;
+    if (entry1->inode != entry2->inode)
+	return (entry1->inode < entry2->inode) ? -1 : 1;
+
+    return 0;
+}
+
+static int ft_cache_entry_cmp(const void *param1, const void *param2)
+{
+    return ft_cache_key_cmp(*(ft_cache_entry_t * const *) param1, *(ft_cache_entry_t * const *) param2);
+}
+
+apr_status_t ft_cache_open(ft_cache_t **cache, const char *filename, const ft_digest_t *digest, apr_pool_t *pool)
+{
+    char errbuf[128];
+    const ft_cache_header_t *header;
+    apr_finfo_t finfo;
+    apr_file_t *fd;
+    ft_cache_t *c;
+    apr_status_t status;
+
+    c = apr_pcalloc(pool, sizeof(struct ft_cache_t));
+    c->filename = (NULL != filename) ? apr_pstrdup(pool, filename) : NULL;
+    c->digest = digest;
+    c->xattr_name = apr_pstrcat(pool, FT_CACHE_XATTR_PREFIX, digest->name, NULL);
+    c->generation = 1;
+    c->entries = apr_array_make(pool, 1024, sizeof(ft_cache_entry_t *));
+    c->pool = pool;
+    *cache = c;
+    if (NULL == filename)
+	return APR_SUCCESS;
+
+    status = apr_file_open(&fd, filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+    if (APR_STATUS_IS_ENOENT(status))
+	return APR_SUCCESS;
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_open(%s): %s", filename, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd))) {
+	DEBUG_ERR("error calling apr_file_info_get(%s): %s", filename, apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
+	return status;
+    }
+    /* an empty file is taken for a new cache, anything else has to be one */
+    if (0 == finfo.size) {
+	apr_file_close(fd);
+	return APR_SUCCESS;
+    }
+    if ((apr_off_t) sizeof(ft_cache_header_t) > finfo.size) {
+	DEBUG_ERR("%s is not a cache file", filename);
+	apr_file_close(fd);
+	return APR_EGENERAL;
+    }
+    status = apr_mmap_create(&c->mm, fd, 0, (apr_size_t) finfo.size, APR_MMAP_READ, pool);
+    /* the mapping outlives the descriptor */
+    apr_file_close(fd);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_mmap_create(%s): %s", filename, apr_strerror(status, errbuf, 128));
+	c->mm = NULL;
+	return status;
+    }
+
+    header = c->mm->mm;
+    if (memcmp(header->magic, FT_CACHE_MAGIC, sizeof(header->magic))
+	|| (sizeof(ft_cache_entry_t) != header->entry_len)
+	|| ((apr_off_t) (sizeof(ft_cache_header_t) + header->nb_entries * sizeof(ft_cache_entry_t)) != finfo.size)) {
+	DEBUG_ERR("%s is not a cache file, or not of this version of ftwin", filename);
+	apr_mmap_delete(c->mm);
+	c->mm = NULL;
+	return APR_EGENERAL;
+    }
+    c->generation = header->generation + 1;
+    /* the digests of another digest are of no use, they are all dropped */
+    if (strncmp(header->digest, digest->name, sizeof(header->digest))) {
+	c->stats.nb_dropped = header->nb_entries;
+	return APR_SUCCESS;
+    }
+    c->old = (const ft_cache_entry_t *) (header + 1);
+    c->nb_old = header->nb_entries;
+
+    return APR_SUCCESS;
+}
+
+ft_cache_entry_t *ft_cache_lookup(ft_cache_t *cache, const apr_finfo_t *finfo)
+{
+    ft_cache_entry_t *entry;
+    apr_size_t lo, hi, mid;
+    int rc;
+
+    entry = apr_pcalloc(cache->pool, sizeof(ft_cache_entry_t));
+    entry->device = (apr_uint64_t) finfo->device;
+    entry->inode = (apr_uint64_t) finfo->inode;
+    entry->size = finfo->size;
+    entry->mtime = finfo->mtime;
+    entry->ctime = finfo->ctime;
+    entry->seen = cache->generation;
+    APR_ARRAY_PUSH(cache->entries, ft_cache_entry_t *) = entry;
+
+    for (lo = 0, hi = cache->nb_old; lo < hi;) {
+	mid = lo + (hi - lo) / 2;
+	if (0 == (rc = ft_cache_key_cmp(entry, &cache->old[mid]))) {
+	    if ((entry->size != cache->old[mid].size) || (entry->mtime != cache->old[mid].mtime)
+		|| (entry->ctime != cache->old[mid].ctime)) {
+		cache->stats.nb_stale++;
+		break;
+	    }
+	    entry->flags = cache->old[mid].flags;
+	    memcpy(entry->head, cache->old[mid].head, sizeof(entry->head));
+	    memcpy(entry->tail, cache->old[mid].tail, sizeof(entry->tail));
+	    memcpy(entry->full, cache->old[mid].full, sizeof(entry->full));
+	    cache->stats.nb_hits++;
+	    return entry;
+	}
+	if (0 > rc)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+    cache->stats.nb_misses++;
+
+    return entry;
+}
+
+/* a digest of other is taken if entry has none, or one only found in an extended attribute */
+static int ft_cache_entry_wants(const ft_cache_entry_t *entry, const ft_cache_entry_t *other, apr_uint32_t flag)
+{
+    if (!(other->flags & flag))
+	return 0;
+    if (!(entry->flags & flag))
+	return 1;
+
+    return (entry->flags & FT_CACHE_XATTR(flag)) && !(other->flags & FT_CACHE_XATTR(flag));
+}
+
+/* hard links share an entry: the digests found for any of them are merged into the first one */
+static void ft_cache_entry_merge(ft_cache_entry_t *entry, const ft_cache_entry_t *other)
+{
+    if (ft_cache_entry_wants(entry, other, FT_CACHE_HEAD)) {
+	memcpy(entry->head, other->head, sizeof(entry->head));
+	entry->flags &= ~FT_CACHE_XATTR(FT_CACHE_HEAD);
+	entry->flags |= other->flags & (FT_CACHE_HEAD | FT_CACHE_XATTR(FT_CACHE_HEAD));
+    }
+    if (ft_cache_entry_wants(entry, other, FT_CACHE_TAIL)) {
+	memcpy(entry->tail, other->tail, sizeof(entry->tail));
+	entry->flags &= ~FT_CACHE_XATTR(FT_CACHE_TAIL);
+	entry->flags |= other->flags & (FT_CACHE_TAIL | FT_CACHE_XATTR(FT_CACHE_TAIL));
+    }
+    if (ft_cache_entry_wants(entry, other, FT_CACHE_FULL)) {
+	memcpy(entry->full, other->full, sizeof(entry->full));
+	entry->flags &= ~(FT_CACHE_TREE | FT_CACHE_XATTR(FT_CACHE_FULL));
+	entry->flags |= other->flags & (FT_CACHE_FULL | FT_CACHE_TREE | FT_CACHE_XATTR(FT_CACHE_FULL));
+    }
+}
+
+/* leave out of an entry the digests only found in an extended attribute, only the computed ones are saved */
+static apr_uint32_t ft_cache_entry_strip(ft_cache_entry_t *entry)
+{
+    if (entry->flags & FT_CACHE_XATTR(FT_CACHE_HEAD)) {
+	memset(entry->head, 0, sizeof(entry->head));
+	entry->flags &= ~FT_CACHE_HEAD;
+    }
+    if (entry->flags & FT_CACHE_XATTR(FT_CACHE_TAIL)) {
+	memset(entry->tail, 0, sizeof(entry->tail));
+	entry->flags &= ~FT_CACHE_TAIL;
+    }
+    if (entry->flags & FT_CACHE_XATTR(FT_CACHE_FULL)) {
+	memset(entry->full, 0, sizeof(entry->full));
+	entry->flags &= ~(FT_CACHE_FULL | FT_CACHE_TREE);
+    }
+
+    return entry->flags &= FT_CACHE_DIGESTS;
+}
+
+apr_status_t ft_cache_save(ft_cache_t *cache)
+{
+    char errbuf[128];
+    ft_cache_header_t header;
+    ft_cache_entry_t **entries, *entry;
+    apr_os_file_t osfd;
+    apr_file_t *fd;
+    apr_off_t offset = 0;
+    apr_size_t i, j, n, nb_saved = 0, nb_dropped = 0;
+    apr_status_t status;
+    char *tmpname;
+    int rc;
+
+    entries = (ft_cache_entry_t **) cache->entries->elts;
+    n = cache->entries->nelts;
+    qsort(entries, n, sizeof(ft_cache_entry_t *), ft_cache_entry_cmp);
+
+    tmpname = apr_pstrcat(cache->pool, cache->filename, ".XXXXXX", NULL);
+    status = apr_file_mktemp(&fd, tmpname, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY | APR_BUFFERED,
+			     cache->pool);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling apr_file_mktemp(%s): %s", tmpname, apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FT_CACHE_MAGIC, sizeof(header.magic));
+    strncpy(header.digest, cache->digest->name, sizeof(header.digest) - 1);
+    header.entry_len = sizeof(ft_cache_entry_t);
+    header.generation = cache->generation;
+    status = apr_file_write_full(fd, &header, sizeof(header), NULL);
+
+    /* merge the entries of the run with the old ones, both sorted, the run ones first */
+    for (i = 0, j = 0; (APR_SUCCESS == status) && ((i < n) || (j < cache->nb_old));) {
+	rc = (i == n) ? 1 : (j == cache->nb_old) ? -1 : ft_cache_key_cmp(entries[i], &cache->old[j]);
+	if (0 < rc) {
+	    /* not seen by this run, the older ones are compacted away */
+	    if (cache->generation - cache->old[j].seen < FT_CACHE_KEEP) {
+		status = apr_file_write_full(fd, &cache->old[j], sizeof(ft_cache_entry_t), NULL);
+		nb_saved++;
+	    }
+	    else {
+		nb_dropped++;
+	    }
+	    j++;
+	    continue;
+	}
+	if (0 == rc) {
+	    /* the old entry is replaced, it was stale if the file has changed */
+	    if ((entries[i]->size != cache->old[j].size) || (entries[i]->mtime != cache->old[j].mtime)
+		|| (entries[i]->ctime != cache->old[j].ctime))
+		nb_dropped++;
+	    j++;
+	}
+	for (entry = entries[i++]; (i < n) && (0 == ft_cache_key_cmp(entry, entries[i])); i++)
+	    ft_cache_entry_merge(entry, entries[i]);
+	/* nothing to remember of a file that had not to be read */
+	if (0 != ft_cache_entry_strip(entry)) {
+	    status = apr_file_write_full(fd, entry, sizeof(ft_cache_entry_t), NULL);
+	    nb_saved++;
+	}
+    }
+
+    if (APR_SUCCESS == status) {
+	header.nb_entries = nb_saved;
+	if (APR_SUCCESS == (status = apr_file_seek(fd, APR_SET, &offset)))
+	    status = apr_file_write_full(fd, &header, sizeof(header), NULL);
+    }
+    if (APR_SUCCESS == status)
+	status = apr_file_flush(fd);
+    /* the new file is complete on disk before it replaces the old one */
+    if ((APR_SUCCESS == status) && (APR_SUCCESS == (status = apr_os_file_get(&osfd, fd))) && (0 != fsync(osfd)))
+	status = APR_FROM_OS_ERROR(errno);
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error writing %s: %s", tmpname, apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
+	apr_file_remove(tmpname, cache->pool);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	apr_file_remove(tmpname, cache->pool);
+	return status;
+    }
+    if (APR_SUCCESS != (status = apr_file_rename(tmpname, cache->filename, cache->pool))) {
+	DEBUG_ERR("error calling apr_file_rename(%s, %s): %s", tmpname, cache->filename,
+		  apr_strerror(status, errbuf, 128));
+	apr_file_remove(tmpname, cache->pool);
+	return status;
+    }
+    cache->stats.nb_saved = nb_saved;
+    cache->stats.nb_dropped += nb_dropped;
+
+    return APR_SUCCESS;
+}
+
+#if HAVE_XATTR
+
+static void ft_cache_put32(unsigned char *p, apr_uint32_t val)
+{
+    p[0] = (unsigned char) val;
+    p[1] = (unsigned char) (val >> 8);
+    p[2] = (unsigned char) (val >> 16);
+    p[3] = (unsigned char) (val >> 24);
+}
+
+static apr_uint32_t ft_cache_get32(const unsigned char *p)
+{
+    return (apr_uint32_t) p[0] | ((apr_uint32_t) p[1] << 8) | ((apr_uint32_t) p[2] << 16) | ((apr_uint32_t) p[3] << 24);
+}
+
+static void ft_cache_put64(unsigned char *p, apr_uint64_t val)
+{
+    ft_cache_put32(p, (apr_uint32_t) val);
+    ft_cache_put32(p + 4, (apr_uint32_t) (val >> 32));
+}
+
+static apr_uint64_t ft_cache_get64(const unsigned char *p)
+{
+    return (apr_uint64_t) ft_cache_get32(p) | ((apr_uint64_t) ft_cache_get32(p + 4) << 32);
+}
+
+apr_uint32_t ft_cache_xattr_get(ft_cache_t *cache, ft_cache_entry_t *entry, const char *filename)
+{
+    unsigned char value[FT_CACHE_XATTR_LEN];
+    const unsigned char *p = value + 20;
+    ft_cache_entry_t other;
+    apr_uint32_t flags;
+    int i;
+
+    if ((FT_CACHE_XATTR_LEN != getxattr(filename, cache->xattr_name, value, sizeof(value)))
+	|| (entry->size != (apr_int64_t) ft_cache_get64(value))
+	|| (entry->mtime != (apr_int64_t) ft_cache_get64(value + 8)))
+	return 0;
+
+    other.flags = ft_cache_get32(value + 16) & FT_CACHE_DIGESTS;
+    for (i = 0; i < FT_DIGEST_WORDS; i++, p += 4)
+	other.head[i] = ft_cache_get32(p);
+    for (i = 0; i < FT_DIGEST_WORDS; i++, p += 4)
+	other.tail[i] = ft_cache_get32(p);
+    for (i = 0; i < FT_DIGEST_WORDS; i++, p += 4)
+	other.full[i] = ft_cache_get32(p);
+    flags = other.flags;
+    other.flags |= FT_CACHE_XATTR(flags & (FT_CACHE_HEAD | FT_CACHE_TAIL | FT_CACHE_FULL));
+    ft_cache_entry_merge(entry, &other);
+    cache->stats.nb_xattr_read++;
+
+    return flags;
+}
+
+apr_status_t ft_cache_xattr_set(ft_cache_t *cache, ft_cache_entry_t *entry, const char *filename, apr_pool_t *pool)
+{
+    unsigned char value[FT_CACHE_XATTR_LEN];
+    unsigned char *p = value + 20;
+    apr_finfo_t finfo;
+    int i;
+
+    ft_cache_put64(value, (apr_uint64_t) entry->size);
+    ft_cache_put64(value + 8, (apr_uint64_t) entry->mtime);
+    ft_cache_put32(value + 16, entry->flags & FT_CACHE_DIGESTS);
+    for (i = 0; i < FT_DIGEST_WORDS; i++, p += 4)
+	ft_cache_put32(p, entry->head[i]);
+    for (i = 0; i < FT_DIGEST_WORDS; i++, p += 4)
+	ft_cache_put32(p, entry->tail[i]);
+    for (i = 0; i < FT_DIGEST_WORDS; i++, p += 4)
+	ft_cache_put32(p, entry->full[i]);
+    if (0 != setxattr(filename, cache->xattr_name, value, sizeof(value), 0))
+	return APR_FROM_OS_ERROR(errno);
+    cache->stats.nb_xattr_written++;
+
+    /* so that the entry is not taken for a stale one by the next run */
+    if (APR_SUCCESS == apr_stat(&finfo, filename, APR_FINFO_CTIME, pool))
+	entry->ctime = finfo.ctime;
+
+    return APR_SUCCESS;
+}
+
+#else /* !HAVE_XATTR */
+
+apr_uint32_t ft_cache_xattr_get(ft_cache_t *cache, ft_cache_entry_t *entry, const char *filename)
+{
+    return 0;
+}
+
+apr_status_t ft_cache_xattr_set(ft_cache_t *cache, ft_cache_entry_t *entry, const char *filename, apr_pool_t *pool)
+{
+    return APR_ENOTIMPL;
+}
+
+#endif /* HAVE_XATTR */
+
+void ft_cache_get_stats(const ft_cache_t *cache, ft_cache_stats_t *stats)
+{
+    *stats = cache->stats;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ft_cache.h
+ * @brief A cache file of the digests of the files, from one run to the next.
+ *
+ * A file is known by its device and inode, its digests are taken as long as
+ * its size, modification and change times are the same. The cache file is
+ * mapped and looked up for the twin candidates, as their size groups are
+ * formed and before any of them is read: a file alone of its size gets no
+ * entry. The entries of the run are merged with it into a new file, renamed
+ * over the old one, so that an interrupted run leaves it as it was.
+ *
+ * Entries are in the byte order of the host, the cache is not to be shared
+ * between machines. The digests of a file can also be kept in an extended
+ * attribute of its own, user.ftwin.<digest>, that follows it when it is
+ * renamed or copied elsewhere with its attributes.
+ */
+#ifndef FT_CACHE_H
+#define FT_CACHE_H
+
+#include <apr_file_info.h>
+#include <apr_pools.h>
+
+#include "ft_digest.h"
+
+/** Digest of the first CHECKSUM_BLOCK_LEN bytes, see ft_conf_sieve. */
+#define FT_CACHE_HEAD 0x01
+/** Digest of the last CHECKSUM_BLOCK_LEN bytes. */
+#define FT_CACHE_TAIL 0x02
+/** Digest of the whole content. */
+#define FT_CACHE_FULL 0x04
+/** The full digest combines the digests of segments, see ft_digest_tree. */
+#define FT_CACHE_TREE 0x08
+/** The digests, and how the full one was computed. */
+#define FT_CACHE_DIGESTS (FT_CACHE_HEAD | FT_CACHE_TAIL | FT_CACHE_FULL | FT_CACHE_TREE)
+/**
+ * The flag of a digest only found in the extended attribute of the file: as
+ * anyone who can write the file can forge it, such a digest is no proof of
+ * twins for --trust-hash, and ft_cache_save leaves it out.
+ */
+#define FT_CACHE_XATTR(flag) ((flag) << 8)
+
+/** Runs an entry is kept without its file being seen, before it is dropped. */
+#define FT_CACHE_KEEP 16
+
+typedef struct ft_cache_t ft_cache_t;
+
+/**
+ * What is known of a file, as it is stored in the cache file.
+ */
+typedef struct ft_cache_entry_t
+{
+    apr_uint64_t device;
+    apr_uint64_t inode;
+    apr_int64_t size;
+    apr_int64_t mtime;		/* in microseconds, as given by apr_stat */
+    apr_int64_t ctime;
+    apr_uint32_t seen;		/* generation of the last run that saw the file */
+    apr_uint32_t flags;		/* FT_CACHE_* digests known, and FT_CACHE_XATTR of the ones not computed */
+    apr_uint32_t head[FT_DIGEST_WORDS];
+    apr_uint32_t tail[FT_DIGEST_WORDS];
+    apr_uint32_t full[FT_DIGEST_WORDS];
+} ft_cache_entry_t;
+
+/**
+ * Figures of a cache, for --verbose.
+ */
+typedef struct ft_cache_stats_t
+{
+    apr_size_t nb_hits;		/* files found, unchanged */
+    apr_size_t nb_misses;	/* files not found, or changed */
+    apr_size_t nb_stale;	/* of the misses, files found but changed */
+    apr_size_t nb_saved;	/* entries written by ft_cache_save */
+    apr_size_t nb_dropped;	/* entries left out by ft_cache_save: stale or not seen for FT_CACHE_KEEP runs */
+    apr_size_t nb_xattr_read;	/* extended attributes found, for the same size and modification time */
+    apr_size_t nb_xattr_written;	/* extended attributes set by ft_cache_xattr_set */
+} ft_cache_stats_t;
+
+/**
+ * Open a cache file, it is created by ft_cache_save if it does not exist.
+ * @param cache The cache opened.
+ * @param filename The cache file, or NULL for entries only filled by the
+ * extended attributes, ft_cache_save is not to be called then.
+ * @param digest The digest of the run, the entries of another one are
+ * dropped.
+ * @param pool The pool, the cache file is unmapped with it.
+ * @return APR_SUCCESS, or an error if filename can't be read or is not a
+ * cache file (it is not overwritten then).
+ */
+apr_status_t ft_cache_open(ft_cache_t **cache, const char *filename, const ft_digest_t *digest, apr_pool_t *pool);
+
+/**
+ * Get the entry of a file, filled with its digests if it is unchanged, to be
+ * completed with the ones computed during the run. Not thread safe, but the
+ * entries of distinct files can be filled by distinct threads.
+ * @param cache The cache.
+ * @param finfo The file, stated with APR_FINFO_IDENT, APR_FINFO_SIZE,
+ * APR_FINFO_MTIME and APR_FINFO_CTIME at least.
+ * @return The entry, kept until the cache pool is destroyed.
+ */
+ft_cache_entry_t *ft_cache_lookup(ft_cache_t *cache, const apr_finfo_t *finfo);
+
+/**
+ * Write the entries of the run, without the digests only found in extended
+ * attributes, and the ones of the files not seen by the run for less than
+ * FT_CACHE_KEEP runs, into a new cache file, renamed over the old one.
+ * @param cache The cache.
+ * @return APR_SUCCESS, or the error met, the old cache file is left then.
+ */
+apr_status_t ft_cache_save(ft_cache_t *cache);
+
+/**
+ * Complete an entry with the digests kept in the extended attribute of its
+ * file, if they are for the same size and modification time. The ones it
+ * did not have are flagged FT_CACHE_XATTR.
+ * @param cache The cache, for the digest.
+ * @param entry The entry, from ft_cache_lookup.
+ * @param filename The file.
+ * @return The FT_CACHE_* digests of the attribute, 0 if there is none.
+ */
+apr_uint32_t ft_cache_xattr_get(ft_cache_t *cache, ft_cache_entry_t *entry, const char *filename);
+
+/**
+ * Keep the digests of an entry in the extended attribute of its file. As
+ * setting it changes the change time of the file, the one of the entry is
+ * updated.
+ * @param cache The cache, for the digest.
+ * @param entry The entry, from ft_cache_lookup.
+ * @param filename The file.
+ * @param pool Pool for temporary allocations.
+ * @return APR_SUCCESS, or why the attribute could not be set: APR_ENOTIMPL
+ * without support for extended attributes.
+ */
+apr_status_t ft_cache_xattr_set(ft_cache_t *cache, ft_cache_entry_t *entry, const char *filename, apr_pool_t *pool);
+
+/**
+ * Fill a ft_cache_stats_t with the figures of a cache.
+ * @param cache The cache.
+ * @param stats The structure to fill.
+ */
+void ft_cache_get_stats(const ft_cache_t *cache, ft_cache_stats_t *stats);
+
+#endif /* FT_CACHE_H */
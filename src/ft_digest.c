@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "ft_digest.h"
+#include "ft_kernel.h"
+
+#define MIN_LEN(a, b) (((a) < (b)) ? (a) : (b))
+#define ROTR32(x, r) (((x) >> (r)) | ((x) << (32 - (r))))
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/*
+ * Bob Jenkins' hash(), the digest of ftwin <= 0.8.8: the state starts at 1
+ * and each block of 4096 bytes (the last one may be shorter) is hashed on
+ * its own, so partial blocks are buffered.
+ */
+static void jenkins_init(ft_digest_ctx_t *ctx)
+{
+    int i;
+
+    for (i = 0; i < HASHSTATE; i++)
+	ctx->u.jenkins.state[i] = 1;
+    ctx->u.jenkins.len = 0;
+}
+
+static void jenkins_update(ft_digest_ctx_t *ctx, const unsigned char *data, apr_size_t len)
+{
+    apr_size_t n;
+
+    if (0 != ctx->u.jenkins.len) {
+	n = MIN_LEN(FT_DIGEST_JENKINS_BLOCK - ctx->u.jenkins.len, len);
+	memcpy(ctx->u.jenkins.buf + ctx->u.jenkins.len, data, n);
+	ctx->u.jenkins.len += n;
+	data += n;
+	len -= n;
+	if (FT_DIGEST_JENKINS_BLOCK != ctx->u.jenkins.len)
+	    return;
+	hash(ctx->u.jenkins.buf, FT_DIGEST_JENKINS_BLOCK, ctx->u.jenkins.state);
+	ctx->u.jenkins.len = 0;
+    }
+    for (; len >= FT_DIGEST_JENKINS_BLOCK; data += FT_DIGEST_JENKINS_BLOCK, len -= FT_DIGEST_JENKINS_BLOCK)
+	hash((ub1 *) data, FT_DIGEST_JENKINS_BLOCK, ctx->u.jenkins.state);
+    memcpy(ctx->u.jenkins.buf, data, len);
+    ctx->u.jenkins.len = len;
+}
+
+static void jenkins_final(ft_digest_ctx_t *ctx, apr_uint32_t *out)
+{
+    if (0 != ctx->u.jenkins.len)
+	hash(ctx->u.jenkins.buf, ctx->u.jenkins.len, ctx->u.jenkins.state);
+    memcpy(out, ctx->u.jenkins.state, sizeof(ctx->u.jenkins.state));
+}
+
+void ft_digest_tree(const ft_digest_t *digest, apr_uint32_t (*segments)[FT_DIGEST_WORDS], apr_size_t nb,
+		    apr_uint32_t *out)
+{
+    ft_digest_ctx_t ctx;
+    apr_size_t i;
+
+    ft_digest_init(&ctx, digest);
+    for (i = 0; i < nb; i++) {
+#if APR_IS_BIGENDIAN
+	/* the words of the segments little endian, so that the digest is the same on any machine */
+	apr_uint32_t le[FT_DIGEST_WORDS];
+	int w;
+
+	for (w = 0; w < FT_DIGEST_WORDS; w++)
+	    le[w] = __builtin_bswap32(segments[i][w]);
+	ft_digest_update(&ctx, le, digest->width);
+#else
+	ft_digest_update(&ctx, segments[i], digest->width);
+#endif
+    }
+    ft_digest_final(&ctx, out);
+}
+
+void ft_digest_jenkins_lanes_init(apr_uint32_t (*states)[FT_DIGEST_WORDS], int nb)
+{
+    int l, i;
+
+    for (l = 0; l < nb; l++)
+	for (i = 0; i < FT_DIGEST_WORDS; i++)
+	    states[l][i] = 1;
+}
+
+void ft_digest_jenkins_lanes(apr_uint32_t (*states)[FT_DIGEST_WORDS], const unsigned char *const *data, int nb,
+			     apr_size_t len)
+{
+    apr_size_t off;
+
+    for (off = 0; off < len; off += FT_DIGEST_JENKINS_BLOCK)
+	ft_kernel_current()->jenkins_lanes(states, data, nb, off, MIN_LEN(FT_DIGEST_JENKINS_BLOCK, len - off));
+}
+
+/*
+ * MurmurHash3_x64_128, by Austin Appleby, public domain, seed 0, made
+ * incremental: 16 bytes blocks, the tail is buffered.
+ */
+#define MURMUR3_C1 0x87c37b91114253d5ULL
+#define MURMUR3_C2 0x4cf5ad432745937fULL
+
+static APR_INLINE apr_uint64_t load_le64(const unsigned char *p)
+{
+    apr_uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if APR_IS_BIGENDIAN
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static APR_INLINE apr_uint64_t fmix64(apr_uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+static void murmur3_init(ft_digest_ctx_t *ctx)
+{
+    ctx->u.murmur3.h1 = 0;
+    ctx->u.murmur3.h2 = 0;
+    ctx->u.murmur3.total = 0;
+    ctx->u.murmur3.len = 0;
+}
+
+static void murmur3_blocks(ft_digest_ctx_t *ctx, const unsigned char *data, apr_size_t nb)
+{
+    apr_uint64_t h1 = ctx->u.murmur3.h1, h2 = ctx->u.murmur3.h2, k1, k2;
+
+    for (; nb > 0; nb--, data += 16) {
+	k1 = load_le64(data);
+	k2 = load_le64(data + 8);
+
+	k1 *= MURMUR3_C1;
+	k1 = ROTL64(k1, 31);
+	k1 *= MURMUR3_C2;
+	h1 ^= k1;
+	h1 = ROTL64(h1, 27);
+	h1 += h2;
+	h1 = h1 * 5 + 0x52dce729;
+
+	k2 *= MURMUR3_C2;
+	k2 = ROTL64(k2, 33);
+	k2 *= MURMUR3_C1;
+	h2 ^= k2;
+	h2 = ROTL64(h2, 31);
+	h2 += h1;
+	h2 = h2 * 5 + 0x38495ab5;
+    }
+    ctx->u.murmur3.h1 = h1;
+    ctx->u.murmur3.h2 = h2;
+}
+
+static void murmur3_update(ft_digest_ctx_t *ctx, const unsigned char *data, apr_size_t len)
+{
+    apr_size_t n;
+
+    ctx->u.murmur3.total += len;
+    if (0 != ctx->u.murmur3.len) {
+	n = MIN_LEN(16 - ctx->u.murmur3.len, len);
+	memcpy(ctx->u.murmur3.buf + ctx->u.murmur3.len, data, n);
+	ctx->u.murmur3.len += n;
+	data += n;
+	len -= n;
+	if (16 != ctx->u.murmur3.len)
+	    return;
+	murmur3_blocks(ctx, ctx->u.murmur3.buf, 1);
+	ctx->u.murmur3.len = 0;
+    }
+    murmur3_blocks(ctx, data, len / 16);
+    memcpy(ctx->u.murmur3.buf, data + (len & ~(apr_size_t) 15), len & 15);
+    ctx->u.murmur3.len = len & 15;
+}
+
+static void murmur3_final(ft_digest_ctx_t *ctx, apr_uint32_t *out)
+{
+    const unsigned char *tail = ctx->u.murmur3.buf;
+    apr_uint64_t h1 = ctx->u.murmur3.h1, h2 = ctx->u.murmur3.h2, k1 = 0, k2 = 0;
+
+    switch (ctx->u.murmur3.len) {
+    case 15:
+	k2 ^= ((apr_uint64_t) tail[14]) << 48;
+	/* fallthrough */
+    case 14:
+	k2 ^= ((apr_uint64_t) tail[13]) << 40;
+	/* fallthrough */
+    case 13:
+	k2 ^= ((apr_uint64_t) tail[12]) << 32;
+	/* fallthrough */
+    case 12:
+	k2 ^= ((apr_uint64_t) tail[11]) << 24;
+	/* fallthrough */
+    case 11:
+	k2 ^= ((apr_uint64_t) tail[10]) << 16;
+	/* fallthrough */
+    case 10:
+	k2 ^= ((apr_uint64_t) tail[9]) << 8;
+	/* fallthrough */
+    case 9:
+	k2 ^= ((apr_uint64_t) tail[8]);
+	k2 *= MURMUR3_C2;
+	k2 = ROTL64(k2, 33);
+	k2 *= MURMUR3_C1;
+	h2 ^= k2;
+	/* fallthrough */
+    case 8:
+	k1 ^= ((apr_uint64_t) tail[7]) << 56;
+	/* fallthrough */
+    case 7:
+	k1 ^= ((apr_uint64_t) tail[6]) << 48;
+	/* fallthrough */
+    case 6:
+	k1 ^= ((apr_uint64_t) tail[5]) << 40;
+	/* fallthrough */
+    case 5:
+	k1 ^= ((apr_uint64_t) tail[4]) << 32;
+	/* fallthrough */
+    case 4:
+	k1 ^= ((apr_uint64_t) tail[3]) << 24;
+	/* fallthrough */
+    case 3:
+	k1 ^= ((apr_uint64_t) tail[2]) << 16;
+	/* fallthrough */
+    case 2:
+	k1 ^= ((apr_uint64_t) tail[1]) << 8;
+	/* fallthrough */
+    case 1:
+	k1 ^= ((apr_uint64_t) tail[0]);
+	k1 *= MURMUR3_C1;
+	k1 = ROTL64(k1, 31);
+	k1 *= MURMUR3_C2;
+	h1 ^= k1;
+    }
+
+    h1 ^= ctx->u.murmur3.total;
+    h2 ^= ctx->u.murmur3.total;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    memset(out, 0, FT_DIGEST_WORDS * sizeof(apr_uint32_t));
+    out[0] = (apr_uint32_t) h1;
+    out[1] = (apr_uint32_t) (h1 >> 32);
+    out[2] = (apr_uint32_t) h2;
+    out[3] = (apr_uint32_t) (h2 >> 32);
+}
+
+/* SHA-256, FIPS 180-4 */
+static const apr_uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_init(ft_digest_ctx_t *ctx)
+{
+    static const apr_uint32_t h0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->u.sha256.h, h0, sizeof(h0));
+    ctx->u.sha256.total = 0;
+    ctx->u.sha256.len = 0;
+}
+
+static void sha256_blocks(ft_digest_ctx_t *ctx, const unsigned char *data, apr_size_t nb)
+{
+    apr_uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (; nb > 0; nb--, data += 64) {
+	for (i = 0; i < 16; i++)
+	    w[i] = ((apr_uint32_t) data[4 * i] << 24) | ((apr_uint32_t) data[4 * i + 1] << 16)
+		| ((apr_uint32_t) data[4 * i + 2] << 8) | (apr_uint32_t) data[4 * i + 3];
+	for (i = 16; i < 64; i++)
+	    w[i] = (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7]
+		+ (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+	a = ctx->u.sha256.h[0];
+	b = ctx->u.sha256.h[1];
+	c = ctx->u.sha256.h[2];
+	d = ctx->u.sha256.h[3];
+	e = ctx->u.sha256.h[4];
+	f = ctx->u.sha256.h[5];
+	g = ctx->u.sha256.h[6];
+	h = ctx->u.sha256.h[7];
+	for (i = 0; i < 64; i++) {
+	    t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+	    t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+	    h = g;
+	    g = f;
+	    f = e;
+	    e = d + t1;
+	    d = c;
+	    c = b;
+	    b = a;
+	    a = t1 + t2;
+	}
+	ctx->u.sha256.h[0] += a;
+	ctx->u.sha256.h[1] += b;
+	ctx->u.sha256.h[2] += c;
+	ctx->u.sha256.h[3] += d;
+	ctx->u.sha256.h[4] += e;
+	ctx->u.sha256.h[5] += f;
+	ctx->u.sha256.h[6] += g;
+	ctx->u.sha256.h[7] += h;
+    }
+}
+
+static void sha256_update(ft_digest_ctx_t *ctx, const unsigned char *data, apr_size_t len)
+{
+    apr_size_t n;
+
+    ctx->u.sha256.total += len;
+    if (0 != ctx->u.sha256.len) {
+	n = MIN_LEN(64 - ctx->u.sha256.len, len);
+	memcpy(ctx->u.sha256.buf + ctx->u.sha256.len, data, n);
+	ctx->u.sha256.len += n;
+	data += n;
+	len -= n;
+	if (64 != ctx->u.sha256.len)
+	    return;
+	sha256_blocks(ctx, ctx->u.sha256.buf, 1);
+	ctx->u.sha256.len = 0;
+    }
+    sha256_blocks(ctx, data, len / 64);
+    memcpy(ctx->u.sha256.buf, data + (len & ~(apr_size_t) 63), len & 63);
+    ctx->u.sha256.len = len & 63;
+}
+
+static void sha256_final(ft_digest_ctx_t *ctx, apr_uint32_t *out)
+{
+    unsigned char pad[72];
+    apr_uint64_t bits = ctx->u.sha256.total * 8;
+    apr_size_t n;
+    int i;
+
+    /* 0x80, zeros up to 56 modulo 64, then the length in bits, big endian */
+    n = (ctx->u.sha256.len < 56) ? 56 - ctx->u.sha256.len : 120 - ctx->u.sha256.len;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++)
+	pad[n + i] = (unsigned char) (bits >> (56 - 8 * i));
+    sha256_update(ctx, pad, n + 8);
+
+    /* words that are the bytes in the usual order read little endian, the same on any machine */
+    for (i = 0; i < 8; i++) {
+	apr_uint32_t h = ctx->u.sha256.h[i];
+
+	out[i] = (h >> 24) | ((h >> 8) & 0xff00) | ((h << 8) & 0xff0000) | (h << 24);
+    }
+}
+
+const ft_digest_t ft_digest_jenkins = { "jenkins", HASHSTATE * sizeof(apr_uint32_t), 0, jenkins_init, jenkins_update,
+    jenkins_final
+};
+
+const ft_digest_t ft_digest_murmur3 = { "murmur3", 16, 0, murmur3_init, murmur3_update, murmur3_final };
+
+const ft_digest_t ft_digest_sha256 = { "sha256", 32, 1, sha256_init, sha256_update, sha256_final };
+
+const ft_digest_t *ft_digest_find(const char *name)
+{
+    static const ft_digest_t *const digests[] = { &ft_digest_jenkins, &ft_digest_murmur3, &ft_digest_sha256, NULL };
+    int i;
+
+    for (i = 0; NULL != digests[i]; i++)
+	if (!strcmp(name, digests[i]->name))
+	    return digests[i];
+
+    return NULL;
+}
+
+void ft_digest_init(ft_digest_ctx_t *ctx, const ft_digest_t *digest)
+{
+    ctx->digest = digest;
+    digest->init(ctx);
+}
+
+void ft_digest_update(ft_digest_ctx_t *ctx, const void *data, apr_size_t len)
+{
+    ctx->digest->update(ctx, data, len);
+}
+
+void ft_digest_final(ft_digest_ctx_t *ctx, apr_uint32_t *out)
+{
+    ctx->digest->final(ctx, out);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ft_digest.h
+ * @brief Digests of file contents, behind a common init/update/final
+ * interface.
+ *
+ * - jenkins: Bob Jenkins' 256 bits hash() of checksum.c, fed by blocks of
+ *   4096 bytes as ftwin always did, kept for compatibility.
+ * - murmur3: Austin Appleby's MurmurHash3 x64 128 bits, much faster.
+ * - sha256: when collisions on purpose are a concern, the only strong one,
+ *   see --trust-hash.
+ *
+ * A digest is written in an array of FT_DIGEST_WORDS words, zero padded, so
+ * that digests of any width are compared the same way. The values of these
+ * words don't depend on the byte order of the machine: its bytes are the
+ * words read little endian.
+ */
+#ifndef FT_DIGEST_H
+#define FT_DIGEST_H
+
+#include <apr.h>
+
+#include "checksum.h"
+
+/** Number of words of a digest, room for the widest one (256 bits). */
+#define FT_DIGEST_WORDS HASHSTATE
+
+/* jenkins hashes by blocks of this size, see checksum_file */
+#define FT_DIGEST_JENKINS_BLOCK 4096
+
+typedef struct ft_digest_ctx_t ft_digest_ctx_t;
+
+typedef struct ft_digest_t
+{
+    const char *name;
+    apr_size_t width;		/* significant bytes of the digest */
+    int strong;			/* collision resistant, equal digests can stand for equal contents */
+    void (*init) (ft_digest_ctx_t *ctx);
+    void (*update) (ft_digest_ctx_t *ctx, const unsigned char *data, apr_size_t len);
+    void (*final) (ft_digest_ctx_t *ctx, apr_uint32_t *out);
+} ft_digest_t;
+
+struct ft_digest_ctx_t
+{
+    const ft_digest_t *digest;
+    union
+    {
+	struct
+	{
+	    apr_uint32_t state[HASHSTATE];
+	    apr_size_t len;
+	    unsigned char buf[FT_DIGEST_JENKINS_BLOCK];
+	} jenkins;
+	struct
+	{
+	    apr_uint64_t h1, h2;
+	    apr_uint64_t total;
+	    apr_size_t len;
+	    unsigned char buf[16];
+	} murmur3;
+	struct
+	{
+	    apr_uint32_t h[8];
+	    apr_uint64_t total;
+	    apr_size_t len;
+	    unsigned char buf[64];
+	} sha256;
+    } u;
+};
+
+extern const ft_digest_t ft_digest_jenkins;
+extern const ft_digest_t ft_digest_murmur3;
+extern const ft_digest_t ft_digest_sha256;
+
+/** Number of inputs ft_digest_jenkins_lanes hashes at once. */
+#define FT_DIGEST_LANES 8
+
+/**
+ * Find a digest by its name.
+ * @param name "jenkins", "murmur3" or "sha256".
+ * @return The digest, NULL if there is no digest of that name.
+ */
+const ft_digest_t *ft_digest_find(const char *name);
+
+/**
+ * Start a digest.
+ * @param ctx The context to initialize.
+ * @param digest The digest to compute.
+ */
+void ft_digest_init(ft_digest_ctx_t *ctx, const ft_digest_t *digest);
+
+/**
+ * Feed a digest, the result does not depend on how the data is split.
+ * @param ctx The context.
+ * @param data The data.
+ * @param len The length of data.
+ */
+void ft_digest_update(ft_digest_ctx_t *ctx, const void *data, apr_size_t len);
+
+/**
+ * Finish a digest.
+ * @param ctx The context.
+ * @param out An array of FT_DIGEST_WORDS words, filled with the digest.
+ */
+void ft_digest_final(ft_digest_ctx_t *ctx, apr_uint32_t *out);
+
+/**
+ * Combine the digests of the consecutive segments of a file into one, for
+ * files hashed by segments on several threads.
+ * @param digest The digest of the segments.
+ * @param segments The digests of the segments, in order.
+ * @param nb The number of segments.
+ * @param out An array of FT_DIGEST_WORDS words, filled with the digest.
+ */
+void ft_digest_tree(const ft_digest_t *digest, apr_uint32_t (*segments)[FT_DIGEST_WORDS], apr_size_t nb,
+		    apr_uint32_t *out);
+
+/**
+ * Start FT_DIGEST_LANES or less ft_digest_jenkins digests, to be fed in
+ * lockstep by ft_digest_jenkins_lanes.
+ * @param states The digests, arrays of FT_DIGEST_WORDS words.
+ * @param nb The number of digests, at most FT_DIGEST_LANES.
+ */
+void ft_digest_jenkins_lanes_init(apr_uint32_t (*states)[FT_DIGEST_WORDS], int nb);
+
+/**
+ * Feed several ft_digest_jenkins digests with inputs of the same length, one
+ * per SIMD lane, as fast as one input alone. The digests are the same as the
+ * ones of ft_digest_init/update/final, once the last data is given.
+ * @param states The digests, started by ft_digest_jenkins_lanes_init.
+ * @param data The inputs, one per digest.
+ * @param nb The number of digests, at most FT_DIGEST_LANES.
+ * @param len The length of each input, a multiple of FT_DIGEST_JENKINS_BLOCK
+ * but for the last call.
+ */
+void ft_digest_jenkins_lanes(apr_uint32_t (*states)[FT_DIGEST_WORDS], const unsigned char *const *data, int nb,
+			     apr_size_t len);
+
+#endif /* FT_DIGEST_H */
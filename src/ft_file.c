@@ -15,54 +15,649 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
 #include <apr_file_io.h>
 #include <apr_mmap.h>
+#include <apr_portable.h>
+#include <apr_thread_proc.h>
 
-#include "checksum.h"
 #include "debug.h"
 #include "ft_file.h"
+#include "ft_kernel.h"
+#include "ft_uring.h"
+#include "napr_queue.h"
 
-static apr_status_t checksum_big_file(const char *filename, apr_off_t size, apr_uint32_t *state, apr_pool_t *gc_pool);
+static apr_status_t checksum_big_file(const char *filename, apr_off_t size, const ft_digest_t *digest,
+				      apr_uint32_t *state, apr_pool_t *gc_pool);
 static apr_status_t big_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i);
 
-/*#define HUGE_LEN 8192*/
-#define HUGE_LEN 4096
+static apr_size_t read_len = FT_READ_LEN;
+static unsigned int read_depth = FT_READ_DEPTH;
+static int read_flags = 0;
+
+extern void ft_file_read_setup(apr_size_t len, unsigned int depth, int flags)
+{
+    apr_size_t page = (apr_size_t) getpagesize();
+
+    read_len = (0 == len) ? FT_READ_LEN : (len + page - 1) & ~(page - 1);
+    read_depth = depth;
+    read_flags = flags;
+}
+
+/* a read buffer of read_len bytes, released by free() */
+static unsigned char *read_buffer(void)
+{
+    void *buf;
+
+    if (0 != posix_memalign(&buf, (apr_size_t) getpagesize(), read_len)) {
+	DEBUG_ERR("allocation failed");
+	return NULL;
+    }
+
+    return buf;
+}
+
+/*
+ * Open filename to be read without updating its access time when allowed
+ * (only to the owner of the file and root), with a posix_fadvise() advice on
+ * how it is read, or none if advice is 0.
+ */
+static apr_status_t open_noatime(apr_file_t **fd, const char *filename, int advice, apr_pool_t *pool)
+{
+    apr_os_file_t osfd;
+
+#ifdef O_NOATIME
+    osfd = open(filename, O_RDONLY | O_NOATIME);
+    if ((0 > osfd) && (EPERM == errno))
+#endif
+	osfd = open(filename, O_RDONLY);
+    if (0 > osfd)
+	return APR_FROM_OS_ERROR(errno);
+#ifdef POSIX_FADV_NORMAL
+    if (0 != advice)
+	posix_fadvise(osfd, 0, 0, advice);
+#endif
+
+    return apr_os_file_put(fd, &osfd, APR_READ | APR_BINARY, pool);
+}
+
+/* Open filename to be read from its start to its end: tell the kernel so, so that it reads ahead further */
+static apr_status_t open_sequential(apr_file_t **fd, const char *filename, apr_pool_t *pool)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    return open_noatime(fd, filename, POSIX_FADV_SEQUENTIAL, pool);
+#else
+    return open_noatime(fd, filename, 0, pool);
+#endif
+}
+
+apr_status_t ft_file_locate(const char *filename, apr_uint64_t *device, apr_uint64_t *offset, int *physical)
+{
+    struct stat st;
+    int fd;
+#ifdef FS_IOC_FIEMAP
+    union
+    {
+	struct fiemap map;
+	char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } fiemap;
+#endif
+
+    if (0 > (fd = open(filename, O_RDONLY)))
+	return APR_FROM_OS_ERROR(errno);
+    if (0 != fstat(fd, &st)) {
+	close(fd);
+	return APR_FROM_OS_ERROR(errno);
+    }
+    *device = (apr_uint64_t) st.st_dev;
+    *offset = (apr_uint64_t) st.st_ino;
+    *physical = 0;
+
+#ifdef FS_IOC_FIEMAP
+    /* the first extent is enough, without FIEMAP_FLAG_SYNC: the ones not allocated yet are flagged unknown */
+    memset(&fiemap, 0, sizeof(fiemap));
+    fiemap.map.fm_length = FIEMAP_MAX_OFFSET;
+    fiemap.map.fm_extent_count = 1;
+    if ((0 == ioctl(fd, FS_IOC_FIEMAP, &fiemap.map)) && (1 == fiemap.map.fm_mapped_extents)
+	&& !(fiemap.map.fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN)) {
+	*offset = fiemap.map.fm_extents[0].fe_physical;
+	*physical = 1;
+    }
+#endif
+    close(fd);
+
+    return APR_SUCCESS;
+}
+
+/* with FT_READ_DONTNEED, drop len bytes read from offset out of the page cache */
+static void read_done(apr_file_t *fd, apr_off_t offset, apr_off_t len)
+{
+#ifdef POSIX_FADV_DONTNEED
+    apr_os_file_t osfd;
+
+    if ((read_flags & FT_READ_DONTNEED) && (APR_SUCCESS == apr_os_file_get(&osfd, fd)))
+	posix_fadvise(osfd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/* called on each chunk of the files read by read_lockstep, one buffer per file, returns non zero to stop reading */
+typedef int (*read_chunk_callback_fn_t) (void *ctx, const unsigned char *const *bufs, apr_size_t len);
+
+typedef struct lockstep_t
+{
+    ft_uring_t *ring;
+    apr_os_file_t osfds[FT_DIGEST_LANES];
+    int live[FT_DIGEST_LANES];	/* the file is still read */
+    apr_off_t *offsets;		/* of the chunk read into each buffer */
+    apr_size_t *wanted, *filled;
+    apr_size_t chunk_len;
+    apr_off_t size;
+    unsigned int ahead;		/* chunks read ahead per file */
+    unsigned int nb_inflight;
+} lockstep_t;
+
+static void lockstep_queue(lockstep_t *ls, int k, apr_off_t c)
+{
+    unsigned int b = k * ls->ahead + c % ls->ahead;
+
+    ls->offsets[b] = c * ls->chunk_len;
+    ls->wanted[b] = (apr_size_t) MIN(ls->size - ls->offsets[b], (apr_off_t) ls->chunk_len);
+    ls->filled[b] = 0;
+    ft_uring_read(ls->ring, ls->osfds[k], b, 0, ls->wanted[b], ls->offsets[b]);
+    ls->nb_inflight++;
+}
+
+/* wait for a read to complete, what is left of a short read is queued again */
+static apr_status_t lockstep_complete(lockstep_t *ls, const char *const *filenames, apr_status_t *statuses)
+{
+    char errbuf[128];
+    apr_status_t status;
+    apr_int32_t res;
+    unsigned int b;
+    int k;
+
+    if (APR_SUCCESS != (status = ft_uring_wait(ls->ring, &b, &res)))
+	return status;
+    ls->nb_inflight--;
+    k = b / ls->ahead;
+    if (!ls->live[k])
+	return APR_SUCCESS;
+
+    if ((-EINTR == res) || (-EAGAIN == res))
+	res = 0;
+    else if (0 > res) {
+	statuses[k] = APR_FROM_OS_ERROR(-res);
+    }
+    else if (0 == res) {
+	/* a file shrinking meanwhile is reported, a short read would hash garbage */
+	statuses[k] = APR_EOF;
+    }
+    if (APR_SUCCESS != statuses[k]) {
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filenames[k], apr_strerror(statuses[k], errbuf, 128));
+	ls->live[k] = 0;
+	return APR_SUCCESS;
+    }
+
+    ls->filled[b] += res;
+    if (ls->filled[b] < ls->wanted[b]) {
+	ft_uring_read(ls->ring, ls->osfds[k], b, ls->filled[b], ls->wanted[b] - ls->filled[b],
+		      ls->offsets[b] + ls->filled[b]);
+	ls->nb_inflight++;
+    }
+
+    return APR_SUCCESS;
+}
+
+/* chunks of the files read in lockstep, and how many of them are read ahead of the current one per file */
+static void lockstep_geometry(apr_off_t size, int nb, apr_size_t *chunk_len, apr_off_t *nb_chunks, unsigned int *ahead)
+{
+    apr_size_t page = (apr_size_t) getpagesize();
+
+    /* small files get small buffers */
+    *chunk_len = (apr_size_t) MIN((apr_off_t) read_len, (size + page - 1) & ~((apr_off_t) page - 1));
+    *nb_chunks = (size + *chunk_len - 1) / *chunk_len;
+    *ahead = (read_depth / nb > 2) ? read_depth / nb : 2;
+    if (*ahead > *nb_chunks)
+	*ahead = (unsigned int) *nb_chunks;
+}
+
+/* see read_lockstep, APR_ENOTIMPL when io_uring is not available */
+static apr_status_t read_lockstep_uring(const char *const *filenames, int nb, apr_off_t size, apr_status_t *statuses,
+					read_chunk_callback_fn_t fn, void *ctx, apr_pool_t *pool)
+{
+    const unsigned char *bufs[FT_DIGEST_LANES];
+    apr_file_t *fds[FT_DIGEST_LANES];
+    char errbuf[128];
+    lockstep_t ls;
+    unsigned char *zeros = NULL;
+    apr_off_t nb_chunks, c;
+    apr_size_t len;
+    apr_status_t status = APR_SUCCESS, rv;
+    unsigned int b;
+    int k, stop;
+
+    ls.size = size;
+    lockstep_geometry(size, nb, &ls.chunk_len, &nb_chunks, &ls.ahead);
+    if (APR_SUCCESS != ft_uring_make(&ls.ring, nb * ls.ahead, ls.chunk_len, pool))
+	return APR_ENOTIMPL;
+    ls.offsets = apr_palloc(pool, nb * ls.ahead * sizeof(apr_off_t));
+    ls.wanted = apr_palloc(pool, nb * ls.ahead * sizeof(apr_size_t));
+    ls.filled = apr_palloc(pool, nb * ls.ahead * sizeof(apr_size_t));
+    ls.nb_inflight = 0;
+
+    for (k = 0; k < nb; k++) {
+	statuses[k] = open_sequential(&fds[k], filenames[k], pool);
+	if ((APR_SUCCESS == statuses[k]) && (APR_SUCCESS != (statuses[k] = apr_os_file_get(&ls.osfds[k], fds[k])))) {
+	    apr_file_close(fds[k]);
+	}
+	if (APR_SUCCESS != statuses[k])
+	    fds[k] = NULL;
+	ls.live[k] = (NULL != fds[k]);
+    }
+    for (c = 0; c < ls.ahead; c++)
+	for (k = 0; k < nb; k++)
+	    if (ls.live[k])
+		lockstep_queue(&ls, k, c);
+
+    for (c = 0, stop = 0; (c < nb_chunks) && !stop; c++) {
+	len = (apr_size_t) MIN(size - c * ls.chunk_len, (apr_off_t) ls.chunk_len);
+	for (k = 0, stop = 1; (k < nb) && (APR_SUCCESS == status); k++) {
+	    b = k * ls.ahead + c % ls.ahead;
+	    while ((APR_SUCCESS == status) && ls.live[k] && (ls.filled[b] < ls.wanted[b]))
+		status = lockstep_complete(&ls, filenames, statuses);
+	    if (APR_SUCCESS != status)
+		break;
+	    if (ls.live[k]) {
+		bufs[k] = ft_uring_buffer(ls.ring, b);
+		stop = 0;
+	    }
+	    else {
+		/* the buffer of a failed file may still be written by a read in flight */
+		if ((NULL == zeros) && (NULL == (zeros = calloc(1, ls.chunk_len)))) {
+		    DEBUG_ERR("allocation failed");
+		    status = APR_ENOMEM;
+		    break;
+		}
+		bufs[k] = zeros;
+	    }
+	}
+	if (APR_SUCCESS != status) {
+	    /* the files still read are not read to their end */
+	    for (k = 0; k < nb; k++)
+		if (ls.live[k]) {
+		    statuses[k] = status;
+		    ls.live[k] = 0;
+		}
+	    break;
+	}
+	if (stop || (0 != fn(ctx, bufs, len)))
+	    break;
+
+	for (k = 0; k < nb; k++) {
+	    if (!ls.live[k])
+		continue;
+	    read_done(fds[k], c * ls.chunk_len, len);
+	    if (c + ls.ahead < nb_chunks)
+		lockstep_queue(&ls, k, c + ls.ahead);
+	}
+    }
+
+    /* the buffers and the files are released once no read is in flight, whatever failed before */
+    for (k = 0; k < nb; k++)
+	ls.live[k] = 0;
+    while (0 < ls.nb_inflight) {
+	if (APR_SUCCESS != (rv = lockstep_complete(&ls, filenames, statuses))) {
+	    DEBUG_ERR("error waiting for the reads in flight: %s", apr_strerror(rv, errbuf, 128));
+	    if (APR_SUCCESS == status)
+		status = rv;
+	    break;
+	}
+    }
+    for (k = 0; k < nb; k++) {
+	if (NULL == fds[k])
+	    continue;
+	if ((APR_SUCCESS != (rv = apr_file_close(fds[k]))) && (APR_SUCCESS == statuses[k])) {
+	    DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(rv, errbuf, 128));
+	    statuses[k] = rv;
+	}
+    }
+    ft_uring_destroy(ls.ring);
+    free(zeros);
+
+    return status;
+}
+
+typedef struct pipe_chunk_t
+{
+    unsigned char *buf;
+    apr_size_t len;
+    apr_status_t status;
+} pipe_chunk_t;
+
+/* a reader thread fills the free chunks of a file, in order, and hands them over to the consumer */
+typedef struct pipe_stream_t
+{
+    apr_file_t *fd;
+    apr_thread_t *thread;
+    napr_queue_t *free, *full;
+    apr_off_t size;
+    apr_size_t chunk_len;
+    apr_uint32_t stop;		/* the consumer does not want more chunks */
+} pipe_stream_t;
+
+static void *APR_THREAD_FUNC pipe_reader(apr_thread_t *thread, void *data)
+{
+    pipe_stream_t *stream = data;
+    pipe_chunk_t *chunk;
+    apr_off_t offset;
+    apr_size_t rbytes;
+
+    for (offset = 0; offset < stream->size; offset += chunk->len) {
+	if ((APR_SUCCESS != napr_queue_pop_wait(stream->free, (void **) &chunk))
+	    || __atomic_load_n(&stream->stop, __ATOMIC_ACQUIRE))
+	    break;
+	chunk->len = (apr_size_t) MIN(stream->size - offset, (apr_off_t) stream->chunk_len);
+	/* a file shrinking meanwhile is reported, a short read would hash garbage */
+	chunk->status = apr_file_read_full(stream->fd, chunk->buf, chunk->len, &rbytes);
+	napr_queue_push_wait(stream->full, chunk);
+	if (APR_SUCCESS != chunk->status)
+	    break;
+    }
+    napr_queue_close(stream->full);
+    apr_thread_exit(thread, APR_SUCCESS);
+
+    return NULL;
+}
 
-static apr_status_t checksum_small_file(const char *filename, apr_off_t size, apr_uint32_t *state, apr_pool_t *gc_pool)
+/* see read_lockstep, with a reader thread per file, APR_ENOTIMPL when there is nothing to read ahead */
+static apr_status_t read_lockstep_threads(const char *const *filenames, int nb, apr_off_t size, apr_status_t *statuses,
+					  read_chunk_callback_fn_t fn, void *ctx, apr_pool_t *pool)
 {
+    const unsigned char *bufs[FT_DIGEST_LANES];
+    pipe_chunk_t *chunks[FT_DIGEST_LANES];
+    pipe_stream_t streams[FT_DIGEST_LANES];
     char errbuf[128];
+    unsigned char *mem, *zeros = NULL;
+    pipe_chunk_t *chunk;
+    apr_off_t nb_chunks, c;
+    apr_size_t chunk_len, len;
+    apr_status_t status, rv = APR_SUCCESS;
+    unsigned int ahead, j;
+    int k, stop;
+
+    lockstep_geometry(size, nb, &chunk_len, &nb_chunks, &ahead);
+    if (2 > nb_chunks)
+	return APR_ENOTIMPL;
+    if (0 != posix_memalign((void **) &mem, (apr_size_t) getpagesize(), nb * ahead * chunk_len))
+	return APR_ENOTIMPL;
+
+    for (k = 0; k < nb; k++) {
+	streams[k].thread = NULL;
+	streams[k].size = size;
+	streams[k].chunk_len = chunk_len;
+	streams[k].stop = 0;
+	statuses[k] = open_sequential(&streams[k].fd, filenames[k], pool);
+	if (APR_SUCCESS != statuses[k]) {
+	    streams[k].fd = NULL;
+	    continue;
+	}
+	streams[k].free = napr_queue_make(pool, ahead);
+	streams[k].full = napr_queue_make(pool, ahead);
+	if ((NULL == streams[k].free) || (NULL == streams[k].full)) {
+	    statuses[k] = APR_ENOMEM;
+	    continue;
+	}
+	for (j = 0; j < ahead; j++) {
+	    chunk = apr_palloc(pool, sizeof(pipe_chunk_t));
+	    chunk->buf = mem + (k * ahead + j) * chunk_len;
+	    napr_queue_push(streams[k].free, chunk);
+	}
+	if (APR_SUCCESS != (statuses[k] = apr_thread_create(&streams[k].thread, NULL, pipe_reader, &streams[k], pool))) {
+	    DEBUG_ERR("error calling apr_thread_create: %s", apr_strerror(statuses[k], errbuf, 128));
+	    streams[k].thread = NULL;
+	}
+    }
+
+    for (c = 0, stop = 0; (c < nb_chunks) && !stop; c++) {
+	len = (apr_size_t) MIN(size - c * chunk_len, (apr_off_t) chunk_len);
+	for (k = 0, stop = 1; k < nb; k++) {
+	    chunks[k] = NULL;
+	    if ((NULL != streams[k].thread) && (APR_SUCCESS == statuses[k])) {
+		if (APR_SUCCESS != napr_queue_pop_wait(streams[k].full, (void **) &chunks[k]))
+		    statuses[k] = APR_EGENERAL;
+		else if (APR_SUCCESS != (statuses[k] = chunks[k]->status))
+		    DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filenames[k],
+			      apr_strerror(statuses[k], errbuf, 128));
+		if (APR_SUCCESS != statuses[k])
+		    chunks[k] = NULL;
+	    }
+	    if (NULL != chunks[k]) {
+		bufs[k] = chunks[k]->buf;
+		stop = 0;
+	    }
+	    else {
+		if ((NULL == zeros) && (NULL == (zeros = calloc(1, chunk_len)))) {
+		    DEBUG_ERR("allocation failed");
+		    rv = APR_ENOMEM;
+		    break;
+		}
+		bufs[k] = zeros;
+	    }
+	}
+	if (APR_SUCCESS != rv) {
+	    /* the files still read are not read to their end */
+	    for (k = 0; k < nb; k++)
+		if ((NULL != streams[k].thread) && (APR_SUCCESS == statuses[k]))
+		    statuses[k] = rv;
+	    break;
+	}
+	if (stop || (0 != fn(ctx, bufs, len)))
+	    break;
+
+	for (k = 0; k < nb; k++) {
+	    if (NULL == chunks[k])
+		continue;
+	    read_done(streams[k].fd, c * chunk_len, len);
+	    napr_queue_push(streams[k].free, chunks[k]);
+	}
+    }
+
+    /* the buffers and the files are released once the readers are done */
+    for (k = 0; k < nb; k++) {
+	if (NULL == streams[k].thread)
+	    continue;
+	__atomic_store_n(&streams[k].stop, 1, __ATOMIC_RELEASE);
+	napr_queue_close(streams[k].free);
+	apr_thread_join(&status, streams[k].thread);
+    }
+    for (k = 0; k < nb; k++) {
+	if (NULL == streams[k].fd)
+	    continue;
+	if ((APR_SUCCESS != (status = apr_file_close(streams[k].fd))) && (APR_SUCCESS == statuses[k])) {
+	    DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	    statuses[k] = status;
+	}
+    }
+    free(mem);
+    free(zeros);
+
+    return rv;
+}
+
+/*
+ * Read nb files (at most FT_DIGEST_LANES) of size bytes in lockstep: the next
+ * chunks of every file are read ahead, up to read_depth reads in flight,
+ * while fn is given the current ones, in order, so that reading and hashing
+ * or comparing overlap. Through io_uring where available, else by a reader
+ * thread per file (or with FT_READ_THREADS). statuses[k] tells if the file k
+ * has been read, once it failed fn is given zeros for it. Returns APR_ENOTIMPL
+ * with a read_depth of 0, the files are then to be read one read at a time,
+ * and an error when the reading itself failed, which every file not read to
+ * its end gets in its statuses[k] too.
+ */
+static apr_status_t read_lockstep(const char *const *filenames, int nb, apr_off_t size, apr_status_t *statuses,
+				  read_chunk_callback_fn_t fn, void *ctx, apr_pool_t *pool)
+{
+    apr_status_t status;
+
+    if ((0 == read_depth) || (0 == size))
+	return APR_ENOTIMPL;
+    if (!(read_flags & FT_READ_THREADS)
+	&& (APR_ENOTIMPL != (status = read_lockstep_uring(filenames, nb, size, statuses, fn, ctx, pool))))
+	return status;
+
+    return read_lockstep_threads(filenames, nb, size, statuses, fn, ctx, pool);
+}
+
+static int hash_chunk(void *ctx, const unsigned char *const *bufs, apr_size_t len)
+{
+    ft_digest_update(ctx, bufs[0], len);
+
+    return 0;
+}
+
+typedef struct lanes_ctx_t
+{
+    apr_uint32_t (*states)[FT_DIGEST_WORDS];
+    int nb;
+} lanes_ctx_t;
+
+static int hash_lanes_chunk(void *ctx, const unsigned char *const *bufs, apr_size_t len)
+{
+    lanes_ctx_t *lanes = ctx;
+
+    /* the lanes of a file that could not be read hash zeros, their digests are not used */
+    ft_digest_jenkins_lanes(lanes->states, bufs, lanes->nb, len);
+
+    return 0;
+}
+
+typedef struct cmp_ctx_t
+{
+    apr_status_t *statuses;
+    int *i;
+} cmp_ctx_t;
+
+static int cmp_chunk(void *ctx, const unsigned char *const *bufs, apr_size_t len)
+{
+    cmp_ctx_t *cmp = ctx;
+
+    if ((APR_SUCCESS != cmp->statuses[0]) || (APR_SUCCESS != cmp->statuses[1]))
+	return 1;
+    *cmp->i = ft_kernel_current()->cmp(bufs[0], bufs[1], len);
+
+    return 0 != *cmp->i;
+}
+
+/* files smaller than that are read, mapping them and faulting their pages costs more than copying them */
+#define MMAP_MIN_LEN (64 * 1024)
+/* bigger files are mapped by windows of that size, whatever excess_size, unmapped once used */
+#define MMAP_WINDOW_LEN (8 * 1024 * 1024)
+
+/* map len bytes of fd from offset, which is a multiple of MMAP_WINDOW_LEN, to be read once from start to end */
+static apr_status_t map_window(apr_mmap_t **mm, apr_file_t *fd, apr_off_t offset, apr_size_t len, apr_pool_t *pool)
+{
+    apr_status_t status;
+
+    if (APR_SUCCESS != (status = apr_mmap_create(mm, fd, offset, len, APR_MMAP_READ, pool)))
+	return status;
+#ifdef MADV_SEQUENTIAL
+    madvise((*mm)->mm, len, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+    madvise((*mm)->mm, len, MADV_WILLNEED);
+#endif
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t checksum_tiny_file(const char *filename, apr_off_t size, const ft_digest_t *digest,
+				       apr_uint32_t *state, apr_pool_t *gc_pool)
+{
+    unsigned char data_chunk[MMAP_MIN_LEN];
+    char errbuf[128];
+    ft_digest_ctx_t ctx;
+    apr_size_t rbytes;
     apr_file_t *fd = NULL;
-    apr_mmap_t *mm;
     apr_status_t status;
-    apr_uint32_t i;
-    apr_off_t rbytes;
 
-    status = apr_file_open(&fd, filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, gc_pool);
+    status = open_sequential(&fd, filename, gc_pool);
     if (APR_SUCCESS != status) {
 	return status;
     }
 
-    status = apr_mmap_create(&mm, fd, 0, (apr_size_t) size, APR_MMAP_READ, gc_pool);
-    if (APR_SUCCESS != status) {
+    /* a file shrinking meanwhile is reported, a short read would hash garbage, reading 0 bytes is APR_EOF */
+    rbytes = 0;
+    if ((0 < size) && (APR_SUCCESS != (status = apr_file_read_full(fd, data_chunk, (apr_size_t) size, &rbytes)))) {
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
 	apr_file_close(fd);
-	return checksum_big_file(filename, size, state, gc_pool);
+	return status;
     }
+    ft_digest_init(&ctx, digest);
+    ft_digest_update(&ctx, data_chunk, rbytes);
+    ft_digest_final(&ctx, state);
+    read_done(fd, 0, size);
 
-    for (i = 0; i < HASHSTATE; ++i)
-	state[i] = 1;
+    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
 
-    rbytes = 0;
-    do {
-	hash(mm->mm + rbytes, MIN(HUGE_LEN, size), state);
-	rbytes += MIN(HUGE_LEN, size);
-	size -= HUGE_LEN;
-    } while (size > 0);
+    return APR_SUCCESS;
+}
 
-    if (APR_SUCCESS != (status = apr_mmap_delete(mm))) {
-	DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
-	apr_file_close(fd);
+static apr_status_t checksum_small_file(const char *filename, apr_off_t size, const ft_digest_t *digest,
+					apr_uint32_t *state, apr_pool_t *gc_pool)
+{
+    char errbuf[128];
+    ft_digest_ctx_t ctx;
+    apr_file_t *fd = NULL;
+    apr_mmap_t *mm;
+    apr_off_t offset;
+    apr_size_t len;
+    apr_status_t status;
+
+    if (size < MMAP_MIN_LEN)
+	return checksum_tiny_file(filename, size, digest, state, gc_pool);
+
+    status = open_sequential(&fd, filename, gc_pool);
+    if (APR_SUCCESS != status) {
 	return status;
     }
+
+    ft_digest_init(&ctx, digest);
+    for (offset = 0; offset < size; offset += len) {
+	len = (apr_size_t) MIN(size - offset, MMAP_WINDOW_LEN);
+	status = map_window(&mm, fd, offset, len, gc_pool);
+	if (APR_SUCCESS != status) {
+	    apr_file_close(fd);
+	    return checksum_big_file(filename, size, digest, state, gc_pool);
+	}
+
+	ft_digest_update(&ctx, mm->mm, len);
+
+	if (APR_SUCCESS != (status = apr_mmap_delete(mm))) {
+	    DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
+	    apr_file_close(fd);
+	    return status;
+	}
+	read_done(fd, offset, len);
+    }
+    ft_digest_final(&ctx, state);
+
     if (APR_SUCCESS != (status = apr_file_close(fd))) {
 	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
 	return status;
@@ -71,35 +666,49 @@ static apr_status_t checksum_small_file(const char *filename, apr_off_t size, ap
     return APR_SUCCESS;
 }
 
-static apr_status_t checksum_big_file(const char *filename, apr_off_t size, apr_uint32_t *state, apr_pool_t *gc_pool)
+static apr_status_t checksum_big_file(const char *filename, apr_off_t size, const ft_digest_t *digest,
+				      apr_uint32_t *state, apr_pool_t *gc_pool)
 {
-    unsigned char data_chunk[HUGE_LEN];
+    unsigned char *data_chunk;
     char errbuf[128];
+    ft_digest_ctx_t ctx;
+    apr_off_t offset = 0;
     apr_size_t rbytes;
     apr_file_t *fd = NULL;
-    apr_status_t status;
-    apr_uint32_t i;
+    apr_status_t status, read_status;
 
-    status = apr_file_open(&fd, filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, gc_pool);
+    ft_digest_init(&ctx, digest);
+    if (APR_ENOTIMPL != read_lockstep(&filename, 1, size, &read_status, hash_chunk, &ctx, gc_pool)) {
+	if (APR_SUCCESS != read_status)
+	    return read_status;
+	ft_digest_final(&ctx, state);
+	return APR_SUCCESS;
+    }
+
+    status = open_sequential(&fd, filename, gc_pool);
     if (APR_SUCCESS != status) {
 	return status;
     }
-
-    for (i = 0; i < HASHSTATE; ++i)
-	state[i] = 1;
+    if (NULL == (data_chunk = read_buffer())) {
+	apr_file_close(fd);
+	return APR_ENOMEM;
+    }
 
     do {
-	rbytes = HUGE_LEN;
-	status = apr_file_read(fd, data_chunk, &rbytes);
-	if (APR_SUCCESS == status) {
-	    hash(data_chunk, rbytes, state);
+	status = apr_file_read_full(fd, data_chunk, read_len, &rbytes);
+	if (0 < rbytes) {
+	    ft_digest_update(&ctx, data_chunk, rbytes);
+	    read_done(fd, offset, rbytes);
+	    offset += rbytes;
 	}
     } while (APR_SUCCESS == status);
+    free(data_chunk);
     if (APR_EOF != status) {
 	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
 	apr_file_close(fd);
 	return status;
     }
+    ft_digest_final(&ctx, state);
 
     if (APR_SUCCESS != (status = apr_file_close(fd))) {
 	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
@@ -109,71 +718,284 @@ static apr_status_t checksum_big_file(const char *filename, apr_off_t size, apr_
     return APR_SUCCESS;
 }
 
-extern apr_status_t checksum_file(const char *filename, apr_off_t size, apr_off_t excess_size, apr_uint32_t *state,
-				  apr_pool_t *gc_pool)
+extern apr_status_t checksum_file(const char *filename, apr_off_t size, apr_off_t excess_size,
+				  const ft_digest_t *digest, apr_uint32_t *state, apr_pool_t *gc_pool)
 {
     if (size < excess_size)
-	return checksum_small_file(filename, size, state, gc_pool);
+	return checksum_small_file(filename, size, digest, state, gc_pool);
 
-    return checksum_big_file(filename, size, state, gc_pool);
+    return checksum_big_file(filename, size, digest, state, gc_pool);
 }
 
-static apr_status_t small_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i)
+extern apr_status_t checksum_file_block(const char *filename, apr_off_t offset, apr_size_t len,
+					const ft_digest_t *digest, apr_uint32_t *state, apr_pool_t *gc_pool)
 {
+    unsigned char data_chunk[CHECKSUM_BLOCK_LEN];
     char errbuf[128];
-    apr_file_t *fd1 = NULL, *fd2 = NULL;
-    apr_mmap_t *mm1, *mm2;
+    ft_digest_ctx_t ctx;
+    apr_size_t rbytes;
+    apr_file_t *fd = NULL;
     apr_status_t status;
 
-    if (0 == size) {
-	*i = 0;
-	return APR_SUCCESS;
+    /* a single block is read, reading ahead further than the usual window is of no use */
+    status = open_noatime(&fd, filename, 0, gc_pool);
+    if (APR_SUCCESS != status) {
+	return status;
     }
 
-    status = apr_file_open(&fd1, fname1, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+    if (0 != offset) {
+	if (APR_SUCCESS != (status = apr_file_seek(fd, APR_SET, &offset))) {
+	    DEBUG_ERR("error calling apr_file_seek: %s", apr_strerror(status, errbuf, 128));
+	    apr_file_close(fd);
+	    return status;
+	}
+    }
+
+    /* a file shrinking meanwhile is reported, a short read would hash garbage */
+    status = apr_file_read_full(fd, data_chunk, MIN(len, CHECKSUM_BLOCK_LEN), &rbytes);
     if (APR_SUCCESS != status) {
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
 	return status;
     }
+    ft_digest_init(&ctx, digest);
+    ft_digest_update(&ctx, data_chunk, rbytes);
+    ft_digest_final(&ctx, state);
+    read_done(fd, offset, rbytes);
+
+    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t checksum_file_segment(const char *filename, apr_off_t offset, apr_off_t len,
+					  const ft_digest_t *digest, apr_uint32_t *state, apr_pool_t *gc_pool)
+{
+    char errbuf[128];
+    ft_digest_ctx_t ctx;
+    unsigned char *buf;
+    apr_file_t *fd = NULL;
+    apr_os_file_t osfd;
+    apr_status_t status;
+    ssize_t rbytes;
 
-    status = apr_mmap_create(&mm1, fd1, 0, (apr_size_t) size, APR_MMAP_READ, pool);
+    status = open_sequential(&fd, filename, gc_pool);
     if (APR_SUCCESS != status) {
-	apr_file_close(fd1);
-	return big_filecmp(pool, fname1, fname2, size, i);
+	return status;
+    }
+    if ((APR_SUCCESS != (status = apr_os_file_get(&osfd, fd))) || (NULL == (buf = read_buffer()))) {
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping", filename);
+	apr_file_close(fd);
+	return (APR_SUCCESS != status) ? status : APR_ENOMEM;
     }
 
-    status = apr_file_open(&fd2, fname2, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+    ft_digest_init(&ctx, digest);
+    while (0 < len) {
+	/* the offset of fd is not used, another thread may read the same file */
+	rbytes = pread(osfd, buf, (apr_size_t) MIN(len, (apr_off_t) read_len), offset);
+	if (0 > rbytes) {
+	    if (EINTR == errno)
+		continue;
+	    status = APR_FROM_OS_ERROR(errno);
+	    break;
+	}
+	if (0 == rbytes) {
+	    /* a file shrinking meanwhile is reported */
+	    status = APR_EOF;
+	    break;
+	}
+	ft_digest_update(&ctx, buf, rbytes);
+	read_done(fd, offset, rbytes);
+	offset += rbytes;
+	len -= rbytes;
+    }
+    free(buf);
     if (APR_SUCCESS != status) {
-	apr_mmap_delete(mm1);
-	apr_file_close(fd1);
+	DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filename, apr_strerror(status, errbuf, 128));
+	apr_file_close(fd);
 	return status;
     }
+    ft_digest_final(&ctx, state);
+
+    if (APR_SUCCESS != (status = apr_file_close(fd))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
+
+/* each file is read by this length, so that a lane goes through a few blocks of the digest per read */
+#define LANES_READ_LEN (16 * FT_DIGEST_JENKINS_BLOCK)
+
+extern apr_status_t checksum_files(const char *const *filenames, int nb, apr_off_t size,
+				   apr_uint32_t (*states)[FT_DIGEST_WORDS], apr_status_t *statuses, apr_pool_t *gc_pool)
+{
+    const unsigned char *data[FT_DIGEST_LANES];
+    apr_file_t *fds[FT_DIGEST_LANES];
+    unsigned char *bufs;
+    char errbuf[128];
+    apr_off_t left;
+    apr_size_t len, rbytes;
+    lanes_ctx_t lanes;
+    apr_status_t status;
+    int l;
+
+    ft_digest_jenkins_lanes_init(states, nb);
+    lanes.states = states;
+    lanes.nb = nb;
+    if (APR_ENOTIMPL != read_lockstep(filenames, nb, size, statuses, hash_lanes_chunk, &lanes, gc_pool))
+	return APR_SUCCESS;
+
+    if (NULL == (bufs = malloc(nb * LANES_READ_LEN))) {
+	DEBUG_ERR("allocation failed");
+	return APR_ENOMEM;
+    }
+    for (l = 0; l < nb; l++) {
+	data[l] = bufs + l * LANES_READ_LEN;
+	statuses[l] = open_sequential(&fds[l], filenames[l], gc_pool);
+	if (APR_SUCCESS != statuses[l]) {
+	    /* the lane keeps hashing zeros, its digest is not used */
+	    fds[l] = NULL;
+	    memset(bufs + l * LANES_READ_LEN, 0, LANES_READ_LEN);
+	}
+    }
+
+    for (left = size; left > 0; left -= len) {
+	len = (apr_size_t) MIN(left, (apr_off_t) LANES_READ_LEN);
+	for (l = 0; l < nb; l++) {
+	    if (NULL == fds[l])
+		continue;
+	    /* a file shrinking meanwhile is reported, a short read would hash garbage */
+	    status = apr_file_read_full(fds[l], bufs + l * LANES_READ_LEN, len, &rbytes);
+	    if (APR_SUCCESS != status) {
+		DEBUG_ERR("unable to read(%s, O_RDONLY), skipping: %s", filenames[l], apr_strerror(status, errbuf, 128));
+		statuses[l] = status;
+		apr_file_close(fds[l]);
+		fds[l] = NULL;
+		memset(bufs + l * LANES_READ_LEN, 0, LANES_READ_LEN);
+		continue;
+	    }
+	    read_done(fds[l], size - left, len);
+	}
+	ft_digest_jenkins_lanes(states, data, nb, len);
+    }
+
+    for (l = 0; l < nb; l++) {
+	if ((NULL != fds[l]) && (APR_SUCCESS != (status = apr_file_close(fds[l])))) {
+	    DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	    statuses[l] = status;
+	}
+    }
+    free(bufs);
+
+    return APR_SUCCESS;
+}
 
-    status = apr_mmap_create(&mm2, fd2, 0, size, APR_MMAP_READ, pool);
+static apr_status_t tiny_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i)
+{
+    unsigned char data_chunk1[MMAP_MIN_LEN], data_chunk2[MMAP_MIN_LEN];
+    char errbuf[128];
+    apr_size_t rbytes1, rbytes2;
+    apr_file_t *fd1 = NULL, *fd2 = NULL;
+    apr_status_t status;
+
+    status = open_sequential(&fd1, fname1, pool);
     if (APR_SUCCESS != status) {
-	apr_file_close(fd2);
-	apr_mmap_delete(mm1);
-	apr_file_close(fd1);
-	return big_filecmp(pool, fname1, fname2, size, i);
+	return status;
     }
 
-    *i = memcmp(mm1->mm, mm2->mm, size);
+    status = open_sequential(&fd2, fname2, pool);
+    if (APR_SUCCESS != status) {
+	apr_file_close(fd1);
+	return status;
+    }
 
-    if (APR_SUCCESS != (status = apr_mmap_delete(mm2))) {
-	DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
+    if ((APR_SUCCESS != (status = apr_file_read_full(fd1, data_chunk1, (apr_size_t) size, &rbytes1)))
+	|| (APR_SUCCESS != (status = apr_file_read_full(fd2, data_chunk2, (apr_size_t) size, &rbytes2)))) {
+	DEBUG_ERR("unable to read %s or %s: %s", fname1, fname2, apr_strerror(status, errbuf, 128));
 	apr_file_close(fd2);
-	apr_mmap_delete(mm1);
 	apr_file_close(fd1);
 	return status;
     }
+    *i = ft_kernel_current()->cmp(data_chunk1, data_chunk2, (apr_size_t) size);
+    read_done(fd1, 0, size);
+    read_done(fd2, 0, size);
+
     if (APR_SUCCESS != (status = apr_file_close(fd2))) {
 	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
-	apr_mmap_delete(mm1);
 	apr_file_close(fd1);
 	return status;
     }
+    if (APR_SUCCESS != (status = apr_file_close(fd1))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    return APR_SUCCESS;
+}
 
-    if (APR_SUCCESS != (status = apr_mmap_delete(mm1))) {
-	DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
+static apr_status_t small_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i)
+{
+    char errbuf[128];
+    apr_file_t *fd1 = NULL, *fd2 = NULL;
+    apr_mmap_t *mm1, *mm2;
+    apr_off_t offset;
+    apr_size_t len;
+    apr_status_t status;
+
+    if (0 == size) {
+	*i = 0;
+	return APR_SUCCESS;
+    }
+    if (size < MMAP_MIN_LEN)
+	return tiny_filecmp(pool, fname1, fname2, size, i);
+
+    status = open_sequential(&fd1, fname1, pool);
+    if (APR_SUCCESS != status) {
+	return status;
+    }
+
+    status = open_sequential(&fd2, fname2, pool);
+    if (APR_SUCCESS != status) {
+	apr_file_close(fd1);
+	return status;
+    }
+
+    *i = 0;
+    for (offset = 0; (offset < size) && (0 == *i); offset += len) {
+	len = (apr_size_t) MIN(size - offset, MMAP_WINDOW_LEN);
+	status = map_window(&mm1, fd1, offset, len, pool);
+	if (APR_SUCCESS != status) {
+	    apr_file_close(fd2);
+	    apr_file_close(fd1);
+	    return big_filecmp(pool, fname1, fname2, size, i);
+	}
+	status = map_window(&mm2, fd2, offset, len, pool);
+	if (APR_SUCCESS != status) {
+	    apr_mmap_delete(mm1);
+	    apr_file_close(fd2);
+	    apr_file_close(fd1);
+	    return big_filecmp(pool, fname1, fname2, size, i);
+	}
+
+	*i = ft_kernel_current()->cmp(mm1->mm, mm2->mm, len);
+
+	if ((APR_SUCCESS != (status = apr_mmap_delete(mm2))) || (APR_SUCCESS != (status = apr_mmap_delete(mm1)))) {
+	    DEBUG_ERR("error calling apr_mmap_delete: %s", apr_strerror(status, errbuf, 128));
+	    apr_file_close(fd2);
+	    apr_file_close(fd1);
+	    return status;
+	}
+	read_done(fd1, offset, len);
+	read_done(fd2, offset, len);
+    }
+
+    if (APR_SUCCESS != (status = apr_file_close(fd2))) {
+	DEBUG_ERR("error calling apr_file_close: %s", apr_strerror(status, errbuf, 128));
 	apr_file_close(fd1);
 	return status;
     }
@@ -187,42 +1009,73 @@ static apr_status_t small_filecmp(apr_pool_t *pool, const char *fname1, const ch
 
 static apr_status_t big_filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, int *i)
 {
-    unsigned char data_chunk1[HUGE_LEN], data_chunk2[HUGE_LEN];
+    unsigned char *data_chunk1, *data_chunk2;
     char errbuf[128];
+    apr_off_t offset = 0;
     apr_size_t rbytes1, rbytes2;
     apr_file_t *fd1 = NULL, *fd2 = NULL;
-    apr_status_t status1, status2;
+    apr_status_t status1, status2, statuses[2];
+    const char *fnames[2];
+    cmp_ctx_t cmp;
 
     if (0 == size) {
 	*i = 0;
 	return APR_SUCCESS;
     }
 
-    status1 = apr_file_open(&fd1, fname1, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+    fnames[0] = fname1;
+    fnames[1] = fname2;
+    cmp.statuses = statuses;
+    cmp.i = i;
+    *i = 0;
+    if (APR_ENOTIMPL != read_lockstep(fnames, 2, size, statuses, cmp_chunk, &cmp, pool))
+	return (APR_SUCCESS != statuses[0]) ? statuses[0] : statuses[1];
+
+    status1 = open_sequential(&fd1, fname1, pool);
     if (APR_SUCCESS != status1) {
 	return status1;
     }
 
-    status1 = apr_file_open(&fd2, fname2, APR_READ | APR_BINARY, APR_OS_DEFAULT, pool);
+    status1 = open_sequential(&fd2, fname2, pool);
     if (APR_SUCCESS != status1) {
 	apr_file_close(fd1);
 	return status1;
     }
 
+    data_chunk1 = read_buffer();
+    data_chunk2 = read_buffer();
+    if ((NULL == data_chunk1) || (NULL == data_chunk2)) {
+	free(data_chunk1);
+	free(data_chunk2);
+	apr_file_close(fd2);
+	apr_file_close(fd1);
+	return APR_ENOMEM;
+    }
+
+    *i = 0;
     do {
-	rbytes1 = HUGE_LEN;
-	status1 = apr_file_read(fd1, data_chunk1, &rbytes1);
-	rbytes2 = rbytes1;
-	status2 = apr_file_read(fd2, data_chunk2, &rbytes2);
-	if ((APR_SUCCESS == status1) && (APR_SUCCESS == status2) && (rbytes2 == rbytes1)) {
-	    *i = memcmp(data_chunk1, data_chunk2, rbytes1);
+	status1 = apr_file_read_full(fd1, data_chunk1, read_len, &rbytes1);
+	status2 = apr_file_read_full(fd2, data_chunk2, read_len, &rbytes2);
+	if (rbytes2 == rbytes1) {
+	    *i = ft_kernel_current()->cmp(data_chunk1, data_chunk2, rbytes1);
+	    read_done(fd1, offset, rbytes1);
+	    read_done(fd2, offset, rbytes2);
+	    offset += rbytes1;
+	}
+	else {
+	    /* a file has changed meanwhile */
+	    *i = (rbytes1 < rbytes2) ? -1 : 1;
 	}
     } while ((APR_SUCCESS == status1) && (APR_SUCCESS == status2) && (0 == *i) && (rbytes2 == rbytes1));
+    free(data_chunk1);
+    free(data_chunk2);
 
-    if ((APR_EOF != status1) && (APR_EOF != status2) && (0 == *i)) {
+    if (((APR_SUCCESS != status1) && (APR_EOF != status1)) || ((APR_SUCCESS != status2) && (APR_EOF != status2))) {
 	DEBUG_ERR("1:unable to read %s (%" APR_SIZE_T_FMT "): %s", fname1, rbytes1, apr_strerror(status1, errbuf, 128));
 	DEBUG_ERR("2:unable to read %s (%" APR_SIZE_T_FMT "): %s", fname2, rbytes2, apr_strerror(status2, errbuf, 128));
-	return status1;
+	apr_file_close(fd2);
+	apr_file_close(fd1);
+	return ((APR_SUCCESS != status1) && (APR_EOF != status1)) ? status1 : status2;
     }
 
     if (APR_SUCCESS != (status1 = apr_file_close(fd2))) {
@@ -247,3 +1100,168 @@ extern apr_status_t filecmp(apr_pool_t *pool, const char *fname1, const char *fn
 
     return big_filecmp(pool, fname1, fname2, size, i);
 }
+
+/* the read buffers of a group are bound to that, its chunks are made smaller than read_len for big groups */
+#define CMP_GROUP_MEM (8 * 1024 * 1024)
+
+/*
+ * Compare the files fnames[idx[0]] to fnames[idx[nb - 1]] (at most
+ * FT_CMP_GROUP_MAX) in lockstep. The files are labelled by the first one of
+ * their class, a class is split as soon as the contents of its files diverge,
+ * and a file alone in its class is closed and not read any further.
+ */
+static apr_status_t cmp_batch(apr_pool_t *pool, const char *const *fnames, const int *idx, int nb, apr_off_t size,
+			      int *classes, apr_status_t *statuses)
+{
+    char errbuf[128];
+    apr_file_t **fds;
+    unsigned char *bufs;
+    int *label, *old, *count;
+    apr_size_t page = (apr_size_t) getpagesize(), chunk_len, len, rbytes;
+    apr_off_t offset;
+    apr_status_t status;
+    int j, p, nb_read;
+
+    chunk_len = MIN(read_len, CMP_GROUP_MEM / nb);
+    chunk_len = (chunk_len < page) ? page : chunk_len & ~(page - 1);
+    if (0 != posix_memalign((void **) &bufs, page, nb * chunk_len)) {
+	DEBUG_ERR("allocation failed");
+	return APR_ENOMEM;
+    }
+    fds = apr_pcalloc(pool, nb * sizeof(apr_file_t *));
+    label = apr_palloc(pool, 3 * nb * sizeof(int));
+    old = label + nb;
+    count = old + nb;
+
+    for (j = 0, p = -1; j < nb; j++) {
+	label[j] = -1;
+	if (APR_SUCCESS != (statuses[idx[j]] = open_sequential(&fds[j], fnames[idx[j]], pool))) {
+	    fds[j] = NULL;
+	    continue;
+	}
+	if (0 > p)
+	    p = j;
+	label[j] = p;
+    }
+
+    for (offset = 0; offset < size; offset += len) {
+	len = (apr_size_t) MIN(size - offset, (apr_off_t) chunk_len);
+	memset(count, 0, nb * sizeof(int));
+	for (j = 0; j < nb; j++)
+	    if (0 <= label[j])
+		count[label[j]]++;
+
+	for (j = 0, nb_read = 0; j < nb; j++) {
+	    old[j] = -1;
+	    if (NULL == fds[j])
+		continue;
+	    if (2 > count[label[j]]) {
+		apr_file_close(fds[j]);
+		fds[j] = NULL;
+		continue;
+	    }
+	    status = apr_file_read_full(fds[j], bufs + j * chunk_len, len, &rbytes);
+	    if ((APR_SUCCESS != status) && (APR_EOF != status)) {
+		DEBUG_ERR("unable to read %s: %s", fnames[idx[j]], apr_strerror(status, errbuf, 128));
+		statuses[idx[j]] = status;
+		label[j] = -1;
+	    }
+	    else if (rbytes != len) {
+		/* the file has shrunk meanwhile, it has no twin */
+		label[j] = j;
+	    }
+	    else {
+		old[j] = label[j];
+		read_done(fds[j], offset, len);
+		nb_read++;
+		continue;
+	    }
+	    apr_file_close(fds[j]);
+	    fds[j] = NULL;
+	}
+	if (0 == nb_read)
+	    break;
+
+	/* a file stays with the first one of its former class it matches, else it starts a class */
+	for (j = 0; j < nb; j++) {
+	    if (0 > old[j])
+		continue;
+	    for (p = 0; p < j; p++)
+		if ((old[p] == old[j]) && (label[p] == p)
+		    && (0 == ft_kernel_current()->cmp(bufs + p * chunk_len, bufs + j * chunk_len, len)))
+		    break;
+	    label[j] = p;
+	}
+    }
+
+    for (j = 0; j < nb; j++) {
+	if (NULL != fds[j])
+	    apr_file_close(fds[j]);
+	classes[idx[j]] = (0 > label[j]) ? -1 : idx[label[j]];
+    }
+    free(bufs);
+
+    return APR_SUCCESS;
+}
+
+extern apr_status_t filecmp_group(apr_pool_t *pool, const char *const *fnames, int nb, apr_off_t size, int *classes,
+				  apr_status_t *statuses)
+{
+    apr_pool_t *subpool;
+    apr_status_t status;
+    int *idx, *reps;
+    int k, n, r, rv, nb_reps, next;
+
+    for (k = 0; k < nb; k++) {
+	classes[k] = 0;
+	statuses[k] = APR_SUCCESS;
+    }
+    if (0 == size)
+	return APR_SUCCESS;
+
+    idx = apr_palloc(pool, FT_CMP_GROUP_MAX * sizeof(int));
+    reps = apr_palloc(pool, nb * sizeof(int));
+    for (next = 0, nb_reps = 0; (next < nb) && (FT_CMP_GROUP_MAX / 2 >= nb_reps);) {
+	/* the classes found by the previous batches are given the next files by their first one, read again */
+	for (n = 0; n < nb_reps; n++)
+	    idx[n] = reps[n];
+	for (; (n < FT_CMP_GROUP_MAX) && (next < nb); n++)
+	    idx[n] = next++;
+
+	if (APR_SUCCESS != (status = apr_pool_create(&subpool, pool)))
+	    return status;
+	status = cmp_batch(subpool, fnames, idx, n, size, classes, statuses);
+	apr_pool_destroy(subpool);
+	if (APR_SUCCESS != status)
+	    return status;
+
+	/* the files of the previous batches keep their classes */
+	for (r = 0; r < nb_reps; r++) {
+	    classes[reps[r]] = reps[r];
+	    statuses[reps[r]] = APR_SUCCESS;
+	}
+	for (; r < n; r++)
+	    if (classes[idx[r]] == idx[r])
+		reps[nb_reps++] = idx[r];
+    }
+
+    /* too many distinct contents to carry them along, the files left are compared one by one */
+    for (; next < nb; next++) {
+	classes[next] = next;
+	for (r = 0; r < nb_reps; r++) {
+	    if (APR_SUCCESS != (status = filecmp(pool, fnames[reps[r]], fnames[next], size, 0, &rv))) {
+		statuses[next] = status;
+		classes[next] = -1;
+		break;
+	    }
+	    if (0 == rv) {
+		classes[next] = reps[r];
+		break;
+	    }
+	}
+	if (classes[next] == next)
+	    reps[nb_reps++] = next;
+    }
+
+    return APR_SUCCESS;
+}
@@ -20,13 +20,61 @@
 
 #include <apr_pools.h>
 
+#include "ft_digest.h"
+
 #define MIN(a,b) ((a)<(b)) ? (a) : (b)
 
-/* hash result is not the same for a same file whether it is considered as big or small, so use carefully */
-apr_status_t checksum_file(const char *filename, apr_off_t size, apr_off_t excess_size, apr_uint32_t *state,
-			   apr_pool_t *gc_pool);
+/* files too big to be mapped are read by FT_READ_LEN bytes, into page aligned buffers */
+#define FT_READ_LEN (1024 * 1024)
+/* reads kept in flight through io_uring where available, else by reader threads, 0 to read one chunk at a time */
+#define FT_READ_DEPTH 8
+/* pages read are dropped from the page cache, not to evict what was there */
+#define FT_READ_DONTNEED 0x01
+/* read ahead by a reader thread per file even where io_uring is available */
+#define FT_READ_THREADS 0x02
+
+/* set how files are read, len is rounded up to a page; to call before reading any file */
+void ft_file_read_setup(apr_size_t len, unsigned int depth, int flags);
+
+/* state is an array of FT_DIGEST_WORDS words, the result does not depend on the file being mapped or read */
+apr_status_t checksum_file(const char *filename, apr_off_t size, apr_off_t excess_size, const ft_digest_t *digest,
+			   apr_uint32_t *state, apr_pool_t *gc_pool);
+
+/*
+ * where a file starts on its device, to read files in the order of the disk: offset is the physical offset of its first
+ * extent if physical is set (FIEMAP, on Linux), its inode otherwise
+ */
+apr_status_t ft_file_locate(const char *filename, apr_uint64_t *device, apr_uint64_t *offset, int *physical);
+
+/* hash len bytes (at most CHECKSUM_BLOCK_LEN) from offset, to tell files of a same size apart cheaply */
+#define CHECKSUM_BLOCK_LEN 4096
+apr_status_t checksum_file_block(const char *filename, apr_off_t offset, apr_size_t len, const ft_digest_t *digest,
+				 apr_uint32_t *state, apr_pool_t *gc_pool);
+
+/* hash len bytes from offset with positional reads, so that the segments of a file are hashed by several threads */
+apr_status_t checksum_file_segment(const char *filename, apr_off_t offset, apr_off_t len, const ft_digest_t *digest,
+				   apr_uint32_t *state, apr_pool_t *gc_pool);
+
+/*
+ * checksum nb (at most FT_DIGEST_LANES) files of the same size at once with ft_digest_jenkins, reading them in lockstep,
+ * statuses[i] tells if states[i] is the digest of filenames[i]
+ */
+apr_status_t checksum_files(const char *const *filenames, int nb, apr_off_t size, apr_uint32_t (*states)[FT_DIGEST_WORDS],
+			    apr_status_t *statuses, apr_pool_t *gc_pool);
 
 apr_status_t filecmp(apr_pool_t *pool, const char *fname1, const char *fname2, apr_off_t size, apr_off_t excess_size,
 		     int *i);
 
+/* files of a group compared at once by filecmp_group, each of them holds a descriptor and a read buffer */
+#define FT_CMP_GROUP_MAX 64
+
+/*
+ * compare nb files of size bytes, reading each of them once, in lockstep, and splitting them into classes as soon as
+ * their contents diverge: classes[k] is the index of the first file with the content of the file k (k itself if none
+ * comes before), or -1 if it could not be read, statuses[k] telling why. Beyond FT_CMP_GROUP_MAX files, one file of
+ * each class found is read again with the next ones.
+ */
+apr_status_t filecmp_group(apr_pool_t *pool, const char *const *fnames, int nb, apr_off_t size, int *classes,
+			   apr_status_t *statuses);
+
 #endif /* FT_FILE_H */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "ft_kernel.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define FT_KERNEL_X86 1
+#include <immintrin.h>
+#else
+#define FT_KERNEL_X86 0
+#endif
+
+/*
+ * The same hash() on FT_DIGEST_LANES inputs at once: the 8 words of the
+ * state of an input are spread over 8 vectors, one lane each, and mix() is
+ * run on the vectors. The same code is built for each kernel, GCC emits
+ * SSE2 or AVX2 instructions for the vector extension depending on the
+ * target of the function it is inlined in.
+ */
+typedef apr_uint32_t ft_lanes_t __attribute__ ((vector_size(FT_DIGEST_LANES * sizeof(apr_uint32_t))));
+
+#define mix_lanes(a,b,c,d,e,f,g,h) \
+{ \
+   a^=b<<11; d+=a; b+=c; \
+   b^=c>>2;  e+=b; c+=d; \
+   c^=d<<8;  f+=c; d+=e; \
+   d^=e>>16; g+=d; e+=f; \
+   e^=f<<10; h+=e; f+=g; \
+   f^=g>>4;  a+=f; g+=h; \
+   g^=h<<8;  b+=g; h+=a; \
+   h^=a>>9;  c+=h; a+=b; \
+}
+
+static APR_INLINE void load_le32x8(apr_uint32_t *w, const unsigned char *p)
+{
+#if APR_IS_BIGENDIAN
+    int i;
+
+    for (i = 0; i < 8; i++)
+	w[i] = p[4 * i] | (p[4 * i + 1] << 8) | (p[4 * i + 2] << 16) | ((apr_uint32_t) p[4 * i + 3] << 24);
+#else
+    memcpy(w, p, 8 * sizeof(apr_uint32_t));
+#endif
+}
+
+static APR_INLINE __attribute__ ((always_inline))
+void hash_lanes(apr_uint32_t (*states)[FT_DIGEST_WORDS], const unsigned char *const *k, int nb, apr_size_t off,
+		apr_uint32_t len)
+{
+    ft_lanes_t a, b, c, d, e, f, g, h, length;
+    apr_uint32_t w[8];
+    unsigned char tail[32];
+    int l;
+
+    a = b = c = d = e = f = g = h = (ft_lanes_t) { 0 };
+    for (l = 0; l < nb; l++) {
+	a[l] = states[l][0];
+	b[l] = states[l][1];
+	c[l] = states[l][2];
+	d[l] = states[l][3];
+	e[l] = states[l][4];
+	f[l] = states[l][5];
+	g[l] = states[l][6];
+	h[l] = states[l][7];
+    }
+    length = (ft_lanes_t) { 0 } + len;
+
+    for (; len >= 32; len -= 32, off += 32) {
+	for (l = 0; l < nb; l++) {
+	    load_le32x8(w, k[l] + off);
+	    a[l] += w[0];
+	    b[l] += w[1];
+	    c[l] += w[2];
+	    d[l] += w[3];
+	    e[l] += w[4];
+	    f[l] += w[5];
+	    g[l] += w[6];
+	    h[l] += w[7];
+	}
+	mix_lanes(a, b, c, d, e, f, g, h);
+	mix_lanes(a, b, c, d, e, f, g, h);
+	mix_lanes(a, b, c, d, e, f, g, h);
+	mix_lanes(a, b, c, d, e, f, g, h);
+    }
+
+    /* the last 31 bytes, as words padded with zeros, the low byte of h holds the length */
+    h += length;
+    for (l = 0; l < nb; l++) {
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, k[l] + off, len);
+	load_le32x8(w, tail);
+	a[l] += w[0];
+	b[l] += w[1];
+	c[l] += w[2];
+	d[l] += w[3];
+	e[l] += w[4];
+	f[l] += w[5];
+	g[l] += w[6];
+	h[l] += w[7] << 8;
+    }
+    mix_lanes(a, b, c, d, e, f, g, h);
+    mix_lanes(a, b, c, d, e, f, g, h);
+    mix_lanes(a, b, c, d, e, f, g, h);
+    mix_lanes(a, b, c, d, e, f, g, h);
+
+    for (l = 0; l < nb; l++) {
+	states[l][0] = a[l];
+	states[l][1] = b[l];
+	states[l][2] = c[l];
+	states[l][3] = d[l];
+	states[l][4] = e[l];
+	states[l][5] = f[l];
+	states[l][6] = g[l];
+	states[l][7] = h[l];
+    }
+}
+
+static int generic_supported(void)
+{
+    return 1;
+}
+
+static void generic_jenkins_lanes(apr_uint32_t (*states)[FT_DIGEST_WORDS], const unsigned char *const *data, int nb,
+				  apr_size_t off, apr_uint32_t len)
+{
+    hash_lanes(states, data, nb, off, len);
+}
+
+static int generic_cmp(const void *s1, const void *s2, apr_size_t len)
+{
+    return memcmp(s1, s2, len);
+}
+
+static const ft_kernel_t ft_kernel_generic = { "generic", generic_supported, generic_jenkins_lanes, generic_cmp };
+
+#if FT_KERNEL_X86
+static int avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__ ((target("avx2")))
+static void avx2_jenkins_lanes(apr_uint32_t (*states)[FT_DIGEST_WORDS], const unsigned char *const *data, int nb,
+			       apr_size_t off, apr_uint32_t len)
+{
+    hash_lanes(states, data, nb, off, len);
+}
+
+/* 64 bytes compared per loop, memcmp only tells the order of the first differing block */
+__attribute__ ((target("avx2")))
+static int avx2_cmp(const void *s1, const void *s2, apr_size_t len)
+{
+    const unsigned char *p1 = s1, *p2 = s2;
+    __m256i a0, a1, b0, b1, eq;
+    apr_size_t off;
+
+    for (off = 0; off + 64 <= len; off += 64) {
+	a0 = _mm256_loadu_si256((const __m256i *) (p1 + off));
+	a1 = _mm256_loadu_si256((const __m256i *) (p1 + off + 32));
+	b0 = _mm256_loadu_si256((const __m256i *) (p2 + off));
+	b1 = _mm256_loadu_si256((const __m256i *) (p2 + off + 32));
+	eq = _mm256_and_si256(_mm256_cmpeq_epi8(a0, b0), _mm256_cmpeq_epi8(a1, b1));
+	if (-1 != _mm256_movemask_epi8(eq))
+	    return memcmp(p1 + off, p2 + off, 64);
+    }
+
+    return memcmp(p1 + off, p2 + off, len - off);
+}
+
+static const ft_kernel_t ft_kernel_avx2 = { "avx2", avx2_supported, avx2_jenkins_lanes, avx2_cmp };
+#endif
+
+const ft_kernel_t *const ft_kernels[] = {
+    &ft_kernel_generic,
+#if FT_KERNEL_X86
+    &ft_kernel_avx2,
+#endif
+    NULL
+};
+
+static const ft_kernel_t *current = &ft_kernel_generic;
+
+const ft_kernel_t *ft_kernel_find(const char *name)
+{
+    int i;
+
+    for (i = 0; NULL != ft_kernels[i]; i++)
+	if (0 == strcmp(name, ft_kernels[i]->name))
+	    return ft_kernels[i];
+
+    return NULL;
+}
+
+apr_status_t ft_kernel_select(const ft_kernel_t *kernel)
+{
+    int i;
+
+    if (NULL == kernel) {
+	for (i = 0; NULL != ft_kernels[i]; i++)
+	    if (ft_kernels[i]->supported())
+		kernel = ft_kernels[i];
+    }
+    else if (!kernel->supported()) {
+	return APR_ENOTIMPL;
+    }
+    current = kernel;
+
+    return APR_SUCCESS;
+}
+
+const ft_kernel_t *ft_kernel_current(void)
+{
+    return current;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ft_kernel.h
+ * @brief Implementations of the CPU intensive loops, chosen at startup from
+ * what the CPU supports, so that a binary built for any x86_64 still uses
+ * AVX2 where it is present.
+ *
+ * - generic: compiled for the build target, available everywhere.
+ * - avx2: for x86 CPUs having AVX2.
+ */
+#ifndef FT_KERNEL_H
+#define FT_KERNEL_H
+
+#include <apr.h>
+
+#include "ft_digest.h"
+
+typedef struct ft_kernel_t
+{
+    const char *name;
+    int (*supported) (void);
+    /* hash() of checksum.c on len bytes from off of nb inputs, see ft_digest_jenkins_lanes */
+    void (*jenkins_lanes) (apr_uint32_t (*states)[FT_DIGEST_WORDS], const unsigned char *const *data, int nb,
+			   apr_size_t off, apr_uint32_t len);
+    /* memcmp() */
+    int (*cmp) (const void *s1, const void *s2, apr_size_t len);
+} ft_kernel_t;
+
+/** The kernels, from the slowest to the fastest, NULL terminated. */
+extern const ft_kernel_t *const ft_kernels[];
+
+/**
+ * Find a kernel by its name.
+ * @param name "generic", "avx2"...
+ * @return The kernel, NULL if there is no kernel of that name.
+ */
+const ft_kernel_t *ft_kernel_find(const char *name);
+
+/**
+ * Choose the kernel used from now on, before any thread is started.
+ * @param kernel The kernel, NULL for the fastest one the CPU supports.
+ * @return APR_SUCCESS, or APR_ENOTIMPL if the CPU does not support kernel.
+ */
+apr_status_t ft_kernel_select(const ft_kernel_t *kernel);
+
+/**
+ * The kernel in use, "generic" until ft_kernel_select is called.
+ */
+const ft_kernel_t *ft_kernel_current(void);
+
+#endif /* FT_KERNEL_H */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "debug.h"
+#include "ft_uring.h"
+
+#if HAVE_IO_URING && defined(__NR_io_uring_setup)
+
+struct ft_uring_t
+{
+    int fd;
+    /* the rings shared with the kernel */
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    apr_size_t sq_ring_len, cq_ring_len, sqes_len;
+    unsigned int nb_queued;	/* reads queued but not submitted yet */
+    unsigned char *buffers;
+    apr_size_t buffer_len;
+    int registered;		/* the buffers are registered, reads use IORING_OP_READ_FIXED */
+    apr_pool_t *pool;
+};
+
+static apr_status_t ft_uring_cleanup(void *data)
+{
+    ft_uring_t *ring = data;
+
+    if (NULL != ring->sqes)
+	munmap(ring->sqes, ring->sqes_len);
+    if ((NULL != ring->cq_ring) && (ring->cq_ring != ring->sq_ring))
+	munmap(ring->cq_ring, ring->cq_ring_len);
+    if (NULL != ring->sq_ring)
+	munmap(ring->sq_ring, ring->sq_ring_len);
+    /* closing the ring unregisters the buffers */
+    if (0 <= ring->fd)
+	close(ring->fd);
+    free(ring->buffers);
+
+    return APR_SUCCESS;
+}
+
+static void *ft_uring_mmap(int fd, apr_size_t len, off_t offset)
+{
+    void *ptr;
+
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    return (MAP_FAILED == ptr) ? NULL : ptr;
+}
+
+apr_status_t ft_uring_make(ft_uring_t **ring, unsigned int nb_buffers, apr_size_t buffer_len, apr_pool_t *pool)
+{
+    struct io_uring_params params;
+    struct iovec *iovs;
+    ft_uring_t *r;
+    unsigned int b;
+    char *sq, *cq;
+
+    r = apr_pcalloc(pool, sizeof(struct ft_uring_t));
+    r->fd = -1;
+    r->pool = pool;
+    r->buffer_len = buffer_len;
+    apr_pool_cleanup_register(pool, r, ft_uring_cleanup, apr_pool_cleanup_null);
+
+    memset(&params, 0, sizeof(params));
+    if (0 > (r->fd = syscall(__NR_io_uring_setup, nb_buffers, &params)))
+	goto notimpl;
+
+    r->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    r->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	if (r->cq_ring_len > r->sq_ring_len)
+	    r->sq_ring_len = r->cq_ring_len;
+	r->cq_ring_len = r->sq_ring_len;
+    }
+    if (NULL == (r->sq_ring = ft_uring_mmap(r->fd, r->sq_ring_len, IORING_OFF_SQ_RING)))
+	goto notimpl;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+	r->cq_ring = r->sq_ring;
+    else if (NULL == (r->cq_ring = ft_uring_mmap(r->fd, r->cq_ring_len, IORING_OFF_CQ_RING)))
+	goto notimpl;
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (NULL == (r->sqes = ft_uring_mmap(r->fd, r->sqes_len, IORING_OFF_SQES)))
+	goto notimpl;
+
+    sq = r->sq_ring;
+    r->sq_head = (unsigned int *) (sq + params.sq_off.head);
+    r->sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+    r->sq_mask = (unsigned int *) (sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned int *) (sq + params.sq_off.array);
+    cq = r->cq_ring;
+    r->cq_head = (unsigned int *) (cq + params.cq_off.head);
+    r->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+    r->cq_mask = (unsigned int *) (cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    if (0 != posix_memalign((void **) &r->buffers, (apr_size_t) getpagesize(), nb_buffers * buffer_len)) {
+	DEBUG_ERR("allocation failed");
+	r->buffers = NULL;
+	apr_pool_cleanup_run(pool, r, ft_uring_cleanup);
+	return APR_ENOMEM;
+    }
+
+    /* registered buffers are pinned once for all the reads, it fails beyond RLIMIT_MEMLOCK */
+    iovs = apr_palloc(pool, nb_buffers * sizeof(struct iovec));
+    for (b = 0; b < nb_buffers; b++) {
+	iovs[b].iov_base = r->buffers + b * buffer_len;
+	iovs[b].iov_len = buffer_len;
+    }
+    r->registered = (0 == syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iovs, nb_buffers));
+    /* IORING_OP_READ came with 5.6, as IORING_FEAT_RW_CUR_POS */
+    if (!r->registered && !(params.features & IORING_FEAT_RW_CUR_POS))
+	goto notimpl;
+
+    *ring = r;
+
+    return APR_SUCCESS;
+
+  notimpl:
+    apr_pool_cleanup_run(pool, r, ft_uring_cleanup);
+
+    return APR_ENOTIMPL;
+}
+
+void ft_uring_destroy(ft_uring_t *ring)
+{
+    apr_pool_cleanup_run(ring->pool, ring, ft_uring_cleanup);
+}
+
+unsigned char *ft_uring_buffer(ft_uring_t *ring, unsigned int b)
+{
+    return ring->buffers + b * ring->buffer_len;
+}
+
+void ft_uring_read(ft_uring_t *ring, int fd, unsigned int b, apr_size_t pos, apr_size_t len, apr_off_t offset)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail, index;
+
+    /* only this thread moves the tail, and one read per buffer fits in the ring */
+    tail = *ring->sq_tail;
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = ring->registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) (ring->buffers + b * ring->buffer_len + pos);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = ring->registered ? b : 0;
+    sqe->user_data = b;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->nb_queued++;
+}
+
+apr_status_t ft_uring_wait(ft_uring_t *ring, unsigned int *b, apr_int32_t *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head, wait;
+    int rc;
+
+    for (;;) {
+	head = *ring->cq_head;
+	wait = (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE));
+	if (!wait && (0 == ring->nb_queued)) {
+	    cqe = &ring->cqes[head & *ring->cq_mask];
+	    *b = (unsigned int) cqe->user_data;
+	    *res = cqe->res;
+	    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	    return APR_SUCCESS;
+	}
+
+	rc = syscall(__NR_io_uring_enter, ring->fd, ring->nb_queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (0 > rc) {
+	    if ((EINTR == errno) || (EAGAIN == errno) || (EBUSY == errno))
+		continue;
+	    return APR_FROM_OS_ERROR(errno);
+	}
+	ring->nb_queued -= rc;
+    }
+}
+
+#else /* !HAVE_IO_URING */
+
+apr_status_t ft_uring_make(ft_uring_t **ring, unsigned int nb_buffers, apr_size_t buffer_len, apr_pool_t *pool)
+{
+    return APR_ENOTIMPL;
+}
+
+void ft_uring_destroy(ft_uring_t *ring)
+{
+}
+
+unsigned char *ft_uring_buffer(ft_uring_t *ring, unsigned int b)
+{
+    return NULL;
+}
+
+void ft_uring_read(ft_uring_t *ring, int fd, unsigned int b, apr_size_t pos, apr_size_t len, apr_off_t offset)
+{
+}
+
+apr_status_t ft_uring_wait(ft_uring_t *ring, unsigned int *b, apr_int32_t *res)
+{
+    return APR_ENOTIMPL;
+}
+
+#endif /* HAVE_IO_URING */
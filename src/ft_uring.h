@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ft_uring.h
+ * @brief A Linux io_uring, driven through its system calls, to keep many
+ * reads in flight instead of one at a time.
+ *
+ * The ring owns its read buffers, registered to the kernel when the limit of
+ * locked memory allows it. Where io_uring is not available (other systems,
+ * kernels before 5.6, seccomp filters), ft_uring_make fails with APR_ENOTIMPL
+ * and the caller reads the files itself.
+ */
+#ifndef FT_URING_H
+#define FT_URING_H
+
+#include <apr_pools.h>
+
+typedef struct ft_uring_t ft_uring_t;
+
+/**
+ * Make a ring.
+ * @param ring The ring made.
+ * @param nb_buffers The number of buffers, which is also the number of reads
+ * in flight at most.
+ * @param buffer_len The size of each buffer, a multiple of the page size.
+ * @param pool The pool, the ring is destroyed with it if not before.
+ * @return APR_SUCCESS, or APR_ENOTIMPL if io_uring is not available.
+ */
+apr_status_t ft_uring_make(ft_uring_t **ring, unsigned int nb_buffers, apr_size_t buffer_len, apr_pool_t *pool);
+
+/**
+ * Destroy a ring, once all the reads queued are completed.
+ * @param ring The ring.
+ */
+void ft_uring_destroy(ft_uring_t *ring);
+
+/**
+ * Get a buffer of a ring, page aligned.
+ * @param ring The ring.
+ * @param b The index of the buffer.
+ * @return The buffer.
+ */
+unsigned char *ft_uring_buffer(ft_uring_t *ring, unsigned int b);
+
+/**
+ * Queue a read into a buffer, submitted by the next ft_uring_wait.
+ * @param ring The ring.
+ * @param fd The file descriptor to read from.
+ * @param b The index of the buffer, at most one read per buffer is in flight.
+ * @param pos The position in the buffer to read to.
+ * @param len The number of bytes to read, at most buffer_len - pos.
+ * @param offset The offset in the file to read from.
+ */
+void ft_uring_read(ft_uring_t *ring, int fd, unsigned int b, apr_size_t pos, apr_size_t len, apr_off_t offset);
+
+/**
+ * Submit the reads queued and wait for one to complete.
+ * @param ring The ring.
+ * @param b The index of the buffer read.
+ * @param res The result of read(2): the number of bytes read, or -errno.
+ * @return APR_SUCCESS, or an error of io_uring_enter().
+ */
+apr_status_t ft_uring_wait(ft_uring_t *ring, unsigned int *b, apr_int32_t *res);
+
+#endif /* FT_URING_H */
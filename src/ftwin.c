@@ -28,6 +28,10 @@
 #include <apr_getopt.h>
 #include <napr_hash.h>
 #include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
 #include <apr_user.h>
 
 #include "config.h"
@@ -43,8 +47,12 @@
 
 #include "checksum.h"
 #include "debug.h"
+#include "ft_cache.h"
 #include "ft_file.h"
+#include "ft_kernel.h"
 #include "napr_heap.h"
+#include "napr_mqueue.h"
+#include "napr_slab.h"
 
 #define is_option_set(mask, option)  ((mask & option) == option)
 
@@ -73,10 +81,44 @@
 #define OPTION_UNTAR 0x0100
 #endif
 
+#define OPTION_STATS 0x0200
+#define OPTION_MERGE 0x0400
+#define OPTION_TRUST 0x0800
+#define OPTION_XATTR 0x1000
+
+/* order in which the size groups are processed and reported */
+#define SCHEDULE_SIZE_DESC 0	/* biggest files first */
+#define SCHEDULE_SAVINGS_DESC 1	/* most reclaimable bytes first */
+#define SCHEDULE_CHEAPEST_FIRST 2	/* least bytes to read first */
+#define SCHEDULE_PHYSICAL 3	/* in the order of the files on their device */
+
+/* bytes that could have been read in the time of an open and a seek */
+#define SCHEDULE_SEEK_COST (256 * 1024)
+
+/* below, the head and tail blocks are too big a part of the files to help */
+#define TIER_MIN_SIZE (4 * CHECKSUM_BLOCK_LEN)
+
+/* files of at least --tree-size bytes are hashed by segments of that size, each one by any thread */
+#define TREE_SEGMENT_LEN (64 * 1024 * 1024)
+
+/* up to that many candidates left by the sieve are not hashed, comparing them reads each of them once anyway */
+#define HASHLESS_GROUP_MAX 8
+
+/*
+ * Directories are stored once, each file only keeps its basename and a
+ * pointer to its directory, the full path is rebuilt by ft_file_path.
+ */
+typedef struct ft_dir_t
+{
+    struct ft_dir_t *parent;	/* NULL for a directory given on the command line */
+    char *name;
+} ft_dir_t;
+
 typedef struct ft_file_t
 {
     apr_off_t size;
-    char *path;
+    ft_dir_t *dir;		/* NULL for a file given on the command line */
+    char *name;
 #if HAVE_ARCHIVE
     char *subpath;
 #endif
@@ -84,12 +126,15 @@ typedef struct ft_file_t
     PuzzleCvec cvec;
     int cvec_ok:1;
 #endif
+    apr_uint32_t rank;		/* rank of its size group, see ft_conf_schedule */
+    ft_cache_entry_t *cached;	/* its digests from one run to the next, see ft_conf_file_lookup */
+    unsigned int xattr_flags:4;	/* FT_CACHE_* digests found in its extended attribute, see --xattr */
     int prioritized:1;
 } ft_file_t;
 
 typedef struct ft_chksum_t
 {
-    apr_uint32_t val_array[HASHSTATE];	/* 256 bits (using Bob Jenkins http://www.burtleburtle.net/bob/c/checksum.c) */
+    apr_uint32_t val_array[FT_DIGEST_WORDS];	/* digest of the file, see ft_digest.h */
     ft_file_t *file;
 } ft_chksum_t;
 
@@ -99,6 +144,8 @@ typedef struct ft_fsize_t
     ft_chksum_t *chksum_array;
     apr_uint32_t nb_files;
     apr_uint32_t nb_checksumed;
+    apr_uint32_t rank;
+    unsigned char hashed;	/* the checksums are digests, not zeros, see HASHLESS_GROUP_MAX */
 } ft_fsize_t;
 
 typedef struct ft_gid_t
@@ -106,6 +153,14 @@ typedef struct ft_gid_t
     gid_t val;
 } ft_gid_t;
 
+/* A group of twins read back from a report, for --merge */
+typedef struct ft_report_group_t
+{
+    apr_off_t size;		/* -1 if the report has been made without --display-size */
+    const char *text;		/* not NUL terminated */
+    apr_size_t len;
+} ft_report_group_t;
+
 typedef struct ft_conf_t
 {
     apr_off_t minsize;
@@ -114,7 +169,15 @@ typedef struct ft_conf_t
     double threshold;
 #endif
     apr_pool_t *pool;		/* Always needed somewhere ;) */
+    apr_array_header_t *files;	/* Will holds the files while browsing, until the heap is built */
+    napr_slab_t *file_slab;	/* ft_file_t records */
+    napr_slab_t *fsize_slab;	/* ft_fsize_t records */
+    napr_slab_t *dir_slab;	/* ft_dir_t records */
+    napr_slab_t *path_slab;	/* file and directory names */
     napr_heap_t *heap;		/* Will holds the files */
+    napr_heap_cmp_callback_fn_t *file_cmp;	/* order of the files in the heap */
+    const ft_digest_t *digest;	/* used to checksum the files */
+    ft_cache_t *cache;		/* digests of the previous runs, NULL without --cache or --xattr */
     napr_hash_t *sizes;		/* will holds the sizes hashed with http://www.burtleburtle.net/bob/hash/integer.html */
     napr_hash_t *gids;		/* will holds the gids hashed with http://www.burtleburtle.net/bob/hash/integer.html */
     napr_hash_t *ig_files;
@@ -126,7 +189,13 @@ typedef struct ft_conf_t
     apr_size_t p_path_len;
     apr_uid_t userid;
     apr_gid_t groupid;
+    apr_uint32_t shard;		/* only sizes hashed to shard modulo nb_shards are processed */
+    apr_uint32_t nb_shards;
+    unsigned int nb_jobs;	/* threads hashing the files, the main one included */
+    apr_off_t tree_size;	/* files of at least that size are hashed by segments */
+    unsigned int verify_rate;	/* percentage of the groups compared anyway with --trust-hash */
     unsigned short int mask;
+    unsigned char schedule;
     char sep;
 } ft_conf_t;
 
@@ -149,6 +218,54 @@ static int ft_file_cmp(const void *param1, const void *param2)
     return 0;
 }
 
+/* Groups have distinct ranks, the ones of the files of a group are equal or consecutive, the lowest is extracted first */
+static int ft_file_rank_cmp(const void *param1, const void *param2)
+{
+    const ft_file_t *file1 = param1;
+    const ft_file_t *file2 = param2;
+
+    if (file1->rank > file2->rank)
+	return -1;
+    else if (file2->rank > file1->rank)
+	return 1;
+
+    return 0;
+}
+
+/**
+ * Rebuild the full path of a file.
+ * @param file The file.
+ * @param buf Buffer where the path is written, from its end.
+ * @param size Size of buf.
+ * @return The path, somewhere in buf, NULL if it does not fit in.
+ */
+static const char *ft_file_path(const ft_file_t *file, char *buf, apr_size_t size)
+{
+    const ft_dir_t *dir;
+    apr_size_t len, pos;
+
+    len = strlen(file->name) + 1;
+    if (len > size)
+	return NULL;
+    pos = size - len;
+    memcpy(buf + pos, file->name, len);
+
+    for (dir = file->dir; NULL != dir; dir = dir->parent) {
+	len = strlen(dir->name);
+	if ((0 == len) || ('/' != dir->name[len - 1])) {
+	    if (0 == pos)
+		return NULL;
+	    buf[--pos] = '/';
+	}
+	if (len > pos)
+	    return NULL;
+	pos -= len;
+	memcpy(buf + pos, dir->name, len);
+    }
+
+    return buf + pos;
+}
+
 static const void *ft_fsize_get_key(const void *opaque)
 {
     const ft_fsize_t *fsize = opaque;
@@ -192,6 +309,21 @@ static apr_uint32_t apr_uint32_key_hash(const void *key, apr_size_t klen)
     return i;
 }
 
+/*
+ * Twins have the same size, so giving each process of a --shard run its own
+ * slice of the sizes makes every group of twins fall in exactly one shard.
+ */
+static int ft_conf_size_in_shard(const ft_conf_t *conf, apr_off_t size)
+{
+    apr_uint32_t folded;
+
+    if (1 == conf->nb_shards)
+	return 1;
+    folded = (apr_uint32_t) size ^ (apr_uint32_t) ((apr_uint64_t) size >> 32);
+
+    return (apr_uint32_key_hash(&folded, sizeof(folded)) % conf->nb_shards) == conf->shard;
+}
+
 static void ft_hash_add_ignore_list(napr_hash_t *hash, const char *file_list)
 {
     const char *filename, *end;
@@ -220,16 +352,19 @@ static void ft_hash_add_ignore_list(napr_hash_t *hash, const char *file_list)
  * The function used to add recursively or not file and dirs.
  * @param conf Configuration structure.
  * @param filename name of a file or directory to add to the list of twinchecker.
+ * @param dir directory node of filename, NULL if it has been given by the user.
+ * @param name basename of filename, or filename if dir is NULL.
  * @param gc_pool garbage collecting pool, will be cleaned by the caller.
  * @return APR_SUCCESS if no error occured.
  */
 #define MATCH_VECTOR_SIZE 210
-static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_pool_t *gc_pool, struct stats const *stats)
+static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, ft_dir_t *dir, const char *name,
+				     apr_pool_t *gc_pool, struct stats const *stats)
 {
     int ovector[MATCH_VECTOR_SIZE];
     char errbuf[128];
     apr_finfo_t finfo;
-    apr_dir_t *dir;
+    apr_dir_t *apr_dir;
     apr_int32_t statmask =
 	APR_FINFO_SIZE | APR_FINFO_TYPE | APR_FINFO_USER | APR_FINFO_GROUP | APR_FINFO_UPROT | APR_FINFO_GPROT;
     apr_size_t fname_len = 0;
@@ -240,7 +375,6 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
     /* Step 1 : Check if it's a directory and get the size if not */
     if (!is_option_set(conf->mask, OPTION_FSYML))
 	statmask |= APR_FINFO_LINK;
-
     if (APR_SUCCESS != (status = apr_stat(&finfo, filename, statmask, gc_pool))) {
 	if (is_option_set(conf->mask, OPTION_FSYML)) {
 	    statmask ^= APR_FINFO_LINK;
@@ -302,19 +436,37 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 	    }
 	}
 
-	if (APR_SUCCESS != (status = apr_dir_open(&dir, filename, gc_pool))) {
+	ft_dir_t *node;
+	struct stats const *ancestor;
+
+	/* skip a recursive loop before anything is allocated for it */
+	if (stats && stats->stat.inode) {
+	    for (ancestor = stats; (ancestor = ancestor->parent) != 0;)
+		if (ancestor->stat.inode == stats->stat.inode && ancestor->stat.device == stats->stat.device) {
+		    if (is_option_set(conf->mask, OPTION_VERBO))
+			fprintf(stderr, "Warning: %s: recursive directory loop\n", filename);
+		    return APR_SUCCESS;
+		}
+	}
+
+	if (APR_SUCCESS != (status = apr_dir_open(&apr_dir, filename, gc_pool))) {
 	    DEBUG_ERR("error calling apr_dir_open(%s): %s", filename, apr_strerror(status, errbuf, 128));
 	    return status;
 	}
+	if ((NULL == (node = napr_slab_alloc(conf->dir_slab)))
+	    || (NULL == (node->name = napr_slab_strdup(conf->path_slab, name)))) {
+	    apr_dir_close(apr_dir);
+	    return APR_ENOMEM;
+	}
+	node->parent = dir;
 	fname_len = strlen(filename);
-	while ((APR_SUCCESS == (status = apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, dir)))
+	while ((APR_SUCCESS == (status = apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, apr_dir)))
 	       && (NULL != finfo.name)) {
 	    /* Check if it has to be ignored */
 	    char *fullname;
 	    apr_size_t fullname_len;
 	    /* for recursive loop detection */
 	    struct stats child;
-	    struct stats const *ancestor;
 
 	    if (NULL != napr_hash_search(conf->ig_files, finfo.name, strlen(finfo.name), NULL))
 		continue;
@@ -333,20 +485,10 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 		&& (0 > (rc = pcre_exec(conf->wl_regex, NULL, fullname, fullname_len, 0, 0, ovector, MATCH_VECTOR_SIZE))))
 		continue;
 
-	    if (stats) {
-		if (stats->stat.inode)
-		    for (ancestor = stats; (ancestor = ancestor->parent) != 0;)
-			if (ancestor->stat.inode == stats->stat.inode && ancestor->stat.device == stats->stat.device) {
-			    if (is_option_set(conf->mask, OPTION_VERBO))
-				fprintf(stderr, "Warning: %s: recursive directory loop\n", filename);
-			    /* skip it */
-			    return APR_SUCCESS;
-			}
-	    }
 	    child.parent = stats;
 	    child.stat = finfo;
 
-	    status = ft_conf_add_file(conf, fullname, gc_pool, &child);
+	    status = ft_conf_add_file(conf, fullname, node, finfo.name, gc_pool, &child);
 
 	    if (APR_SUCCESS != status) {
 		DEBUG_ERR("error recursively calling ft_conf_add_file: %s", apr_strerror(status, errbuf, 128));
@@ -358,14 +500,13 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 	    return status;
 	}
 
-	if (APR_SUCCESS != (status = apr_dir_close(dir))) {
+	if (APR_SUCCESS != (status = apr_dir_close(apr_dir))) {
 	    DEBUG_ERR("error calling apr_dir_close: %s", apr_strerror(status, errbuf, 128));
 	    return status;
 	}
     }
     else if (APR_REG == finfo.filetype || ((APR_LNK == finfo.filetype) && (is_option_set(conf->mask, OPTION_FSYML)))) {
 	apr_off_t finfosize;
-	char *fname;
 #if HAVE_ARCHIVE
 	const char *subpath;
 	/* XXX La */
@@ -374,7 +515,6 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 	int rv;
 #endif
 
-	fname = apr_pstrdup(conf->pool, filename);
 	finfosize = finfo.size;
 #if HAVE_ARCHIVE
 	subpath = NULL;
@@ -407,7 +547,7 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 
 	do {
 #endif
-	    if (finfosize >= conf->minsize
+	    if (finfosize >= conf->minsize && ft_conf_size_in_shard(conf, finfosize)
 #if HAVE_ARCHIVE
 		&& ((NULL == a) || ((NULL != entry) && !(AE_IFDIR & archive_entry_filetype(entry))))
 #endif
@@ -415,12 +555,15 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 		ft_file_t *file;
 		ft_fsize_t *fsize;
 
-		file = apr_palloc(conf->pool, sizeof(struct ft_file_t));
-		file->path = fname;
+		/* each entry of an archive has its own copy of the name, released with it */
+		if ((NULL == (file = napr_slab_alloc(conf->file_slab)))
+		    || (NULL == (file->name = napr_slab_strdup(conf->path_slab, name))))
+		    return APR_ENOMEM;
+		file->dir = dir;
 		file->size = finfosize;
 #if HAVE_ARCHIVE
 		if (subpath) {
-		    file->subpath = apr_pstrdup(conf->pool, subpath);
+		    file->subpath = napr_slab_strdup(conf->path_slab, subpath);
 		}
 		else {
 		    file->subpath = NULL;
@@ -437,13 +580,17 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 #if HAVE_PUZZLE
 		file->cvec_ok &= 0x0;
 #endif
-		napr_heap_insert(conf->heap, file);
+		file->cached = NULL;
+		file->xattr_flags = 0;
+		APR_ARRAY_PUSH(conf->files, ft_file_t *) = file;
 
 		if (NULL == (fsize = napr_hash_search(conf->sizes, &finfosize, 1, &hash_value))) {
-		    fsize = apr_palloc(conf->pool, sizeof(struct ft_fsize_t));
+		    if (NULL == (fsize = napr_slab_alloc(conf->fsize_slab)))
+			return APR_ENOMEM;
 		    fsize->val = finfosize;
 		    fsize->chksum_array = NULL;
 		    fsize->nb_checksumed = 0;
+		    fsize->hashed = 0;
 		    fsize->nb_files = 0;
 		    napr_hash_set(conf->sizes, fsize, hash_value);
 		}
@@ -463,7 +610,7 @@ static apr_status_t ft_conf_add_file(ft_conf_t *conf, const char *filename, apr_
 			 * be processing a bad file, ignore it silently.
 			 */
 			if (NULL != subpath) {
-			    DEBUG_ERR("error calling archive_read_next_header(%s): %s", fname, archive_error_string(a));
+			    DEBUG_ERR("error calling archive_read_next_header(%s): %s", filename, archive_error_string(a));
 			    return APR_EGENERAL;
 			}
 			else {
@@ -508,12 +655,19 @@ static int copy_data(struct archive *ar, struct archive *aw)
 
 static char *ft_untar_file(ft_file_t *file, apr_pool_t *p)
 {
+    char pathbuf[APR_PATH_MAX];
     struct archive *a = NULL;
     struct archive *ext = NULL;
     struct archive_entry *entry = NULL;
+    const char *path;
     char *tmpfile = NULL;
     int rv;
 
+    if (NULL == (path = ft_file_path(file, pathbuf, sizeof(pathbuf)))) {
+	DEBUG_ERR("path too long for file %s", file->name);
+	return NULL;
+    }
+
     a = archive_read_new();
     if (NULL == a) {
 	DEBUG_ERR("error calling archive_read_new()");
@@ -529,9 +683,9 @@ static char *ft_untar_file(ft_file_t *file, apr_pool_t *p)
 	DEBUG_ERR("error calling archive_read_support_format_all(): %s", archive_error_string(a));
 	return NULL;
     }
-    rv = archive_read_open_file(a, file->path, 10240);
+    rv = archive_read_open_file(a, path, 10240);
     if (0 != rv) {
-	DEBUG_ERR("error calling archive_read_open_file(%s): %s", file->path, archive_error_string(a));
+	DEBUG_ERR("error calling archive_read_open_file(%s): %s", path, archive_error_string(a));
 	return NULL;
     }
 
@@ -544,11 +698,11 @@ static char *ft_untar_file(ft_file_t *file, apr_pool_t *p)
     for (;;) {
 	rv = archive_read_next_header(a, &entry);
 	if (rv == ARCHIVE_EOF) {
-	    DEBUG_ERR("subpath [%s] not found in archive [%s]", file->subpath, file->path);
+	    DEBUG_ERR("subpath [%s] not found in archive [%s]", file->subpath, path);
 	    return NULL;
 	}
 	if (rv != ARCHIVE_OK) {
-	    DEBUG_ERR("error in archive (%s): %s", file->path, archive_error_string(a));
+	    DEBUG_ERR("error in archive (%s): %s", path, archive_error_string(a));
 	    return NULL;
 	}
 
@@ -575,13 +729,13 @@ static char *ft_untar_file(ft_file_t *file, apr_pool_t *p)
 	    if (rv == ARCHIVE_OK) {
 		rv = copy_data(a, ext);
 		if (rv != ARCHIVE_OK) {
-		    DEBUG_ERR("error while copying data from archive (%s)", file->path);
+		    DEBUG_ERR("error while copying data from archive (%s)", path);
 		    apr_file_remove(tmpfile, p);
 		    return NULL;
 		}
 	    }
 	    else {
-		DEBUG_ERR("error in archive (%s): %s", file->path, archive_error_string(a));
+		DEBUG_ERR("error in archive (%s): %s", path, archive_error_string(a));
 		apr_file_remove(tmpfile, p);
 		return NULL;
 	    }
@@ -598,328 +752,1510 @@ static char *ft_untar_file(ft_file_t *file, apr_pool_t *p)
 
 #endif
 
-static apr_status_t ft_conf_process_sizes(ft_conf_t *conf)
+static void ft_hash_display_stats(const char *name, const napr_hash_t *hash)
 {
-    char errbuf[128];
-    ft_file_t *file;
-    ft_fsize_t *fsize;
-    napr_heap_t *tmp_heap;
-    apr_pool_t *gc_pool;
-    apr_uint32_t hash_value;
-    apr_status_t status;
-    apr_size_t nb_processed, nb_files;
+    napr_hash_stats_t stats;
 
-    if (is_option_set(conf->mask, OPTION_VERBO))
-	fprintf(stderr, "Referencing files and sizes:\n");
+    napr_hash_get_stats(hash, &stats);
+    fprintf(stderr,
+	    "[stats] hash %-10s: %" APR_SIZE_T_FMT " elements, %" APR_SIZE_T_FMT " buckets (%" APR_SIZE_T_FMT
+	    " used), chain max %" APR_SIZE_T_FMT " avg %.2f, %" APR_SIZE_T_FMT " rebuilds, %" APR_SIZE_T_FMT " bytes\n",
+	    name, stats.nel, stats.size, stats.used, stats.max_chain, stats.avg_chain, stats.nb_rebuilds, stats.bytes);
+}
 
-    if (APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool))) {
-	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
-	apr_terminate();
-	return -1;
-    }
-    nb_processed = 0;
-    nb_files = napr_heap_size(conf->heap);
+static void ft_heap_display_stats(const char *name, const napr_heap_t *heap)
+{
+    napr_heap_stats_t stats;
 
-    tmp_heap = napr_heap_make(conf->pool, ft_file_cmp);
-    while (NULL != (file = napr_heap_extract(conf->heap))) {
-	if (NULL != (fsize = napr_hash_search(conf->sizes, &file->size, 1, &hash_value))) {
-	    /* More than two files, we will need to checksum because :
-	     * - 1 file of a size means no twin.
-	     * - 2 files of a size means that anyway we must read the both, so
-	     *   we will probably cmp them at that time instead of running CPU
-	     *   intensive function like checksum.
-	     */
-	    if (1 == fsize->nb_files) {
-		/* No twin possible, remove the entry */
-		/*DEBUG_DBG("only one file of size %"APR_OFF_T_FMT, fsize->val); */
-		napr_hash_remove(conf->sizes, fsize, hash_value);
-	    }
-	    else {
-		if (NULL == fsize->chksum_array)
-		    fsize->chksum_array = apr_palloc(conf->pool, fsize->nb_files * sizeof(struct ft_chksum_t));
-
-		fsize->chksum_array[fsize->nb_checksumed].file = file;
-		/* no multiple check, just a memcmp will be needed, don't call checksum on 0-length file too */
-		if ((2 == fsize->nb_files) || (0 == fsize->val)) {
-		    /*DEBUG_DBG("two files of size %"APR_OFF_T_FMT, fsize->val); */
-		    memset(fsize->chksum_array[fsize->nb_checksumed].val_array, 0, HASHSTATE * sizeof(apr_int32_t));
-		}
-		else {
-		    char *filepath;
+    napr_heap_get_stats(heap, &stats);
+    fprintf(stderr, "[stats] heap %-10s: %u elements (peak %u), %u slots, %u reallocations, %lu bytes\n", name,
+	    stats.count, stats.peak, stats.max, stats.nb_reallocs, stats.bytes);
+}
+
+static void ft_slab_display_stats(const char *name, const napr_slab_t *slab, napr_slab_stats_t *total)
+{
+    napr_slab_stats_t stats;
+
+    napr_slab_get_stats(slab, &stats);
+    fprintf(stderr, "[stats] slab %-10s: %" APR_SIZE_T_FMT " objects, %" APR_SIZE_T_FMT " bytes used, %" APR_SIZE_T_FMT
+	    " chunks, %" APR_SIZE_T_FMT " bytes (peak %" APR_SIZE_T_FMT ")\n", name, stats.nb_objects, stats.used,
+	    stats.nb_chunks, stats.bytes, stats.peak);
+    total->used += stats.used;
+    total->bytes += stats.bytes;
+    total->peak += stats.peak;
+}
+
+static void ft_conf_display_stats(const ft_conf_t *conf)
+{
+    napr_slab_stats_t stats, total = { 0, 0, 0, 0, 0 };
+    unsigned long int pages = 0;
+
+    ft_hash_display_stats("sizes", conf->sizes);
+    ft_hash_display_stats("gids", conf->gids);
+    ft_hash_display_stats("ig_files", conf->ig_files);
+    if (NULL != conf->heap)
+	ft_heap_display_stats("twins", conf->heap);
+    ft_slab_display_stats("files", conf->file_slab, &total);
+    ft_slab_display_stats("sizes", conf->fsize_slab, &total);
+    ft_slab_display_stats("dirs", conf->dir_slab, &total);
+    ft_slab_display_stats("paths", conf->path_slab, &total);
+    napr_slab_get_stats(conf->file_slab, &stats);
+    if (0 < stats.nb_objects)
+	fprintf(stderr, "[stats] records: %" APR_SIZE_T_FMT " bytes per file (%" APR_SIZE_T_FMT " reserved)\n",
+		total.used / stats.nb_objects, total.bytes / stats.nb_objects);
+    /* records are released group by group, what matters is the peak */
+    fprintf(stderr, "[stats] records: %" APR_SIZE_T_FMT " bytes held (peak %" APR_SIZE_T_FMT ")\n", total.bytes,
+	    total.peak);
+    GET_MEMUSAGE(pages);
+    fprintf(stderr, "[stats] process size: %lu pages\n", pages);
+}
+
+/* Give the memory of a file back as soon as it is not needed anymore */
+static void ft_conf_file_release(ft_conf_t *conf, ft_file_t *file)
+{
+    napr_slab_free_size(conf->path_slab, file->name, strlen(file->name) + 1);
 #if HAVE_ARCHIVE
-		    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath)) {
-			filepath = ft_untar_file(file, gc_pool);
-			if (NULL == filepath) {
-			    DEBUG_ERR("error calling ft_untar_file");
-			    apr_pool_destroy(gc_pool);
-			    return APR_EGENERAL;
-			}
-		    }
-		    else {
-			filepath = file->path;
-		    }
-#else
-		    filepath = file->path;
+    if (NULL != file->subpath)
+	napr_slab_free_size(conf->path_slab, file->subpath, strlen(file->subpath) + 1);
 #endif
-		    status =
-			checksum_file(filepath, file->size, conf->excess_size,
-				      fsize->chksum_array[fsize->nb_checksumed].val_array, gc_pool);
+    napr_slab_free(conf->file_slab, file);
+}
+
+/* Same for a size group, once its twins are reported or none is possible */
+static void ft_conf_fsize_release(ft_conf_t *conf, ft_fsize_t *fsize, apr_uint32_t hash_value)
+{
+    napr_hash_remove(conf->sizes, fsize, hash_value);
+    free(fsize->chksum_array);
+    napr_slab_free(conf->fsize_slab, fsize);
+}
+
+/*
+ * Look up what the cache knows of a file, once it is a twin candidate: a
+ * file alone of its size is never read, and needs no entry. It stays NULL for
+ * an archived file, or one that has changed since it was collected.
+ */
+static void ft_conf_file_lookup(ft_conf_t *conf, ft_file_t *file, apr_pool_t *gc_pool)
+{
+    char pathbuf[APR_PATH_MAX];
+    apr_finfo_t finfo;
+    const char *path;
+
 #if HAVE_ARCHIVE
-		    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath))
-			apr_file_remove(filepath, gc_pool);
+    if (NULL != file->subpath)
+	return;
 #endif
-		    /*
-		     * no return status if != APR_SUCCESS , because : 
-		     * Fault-check has been removed in case files disappear
-		     * between collecting and comparing or special files (like
-		     * device or /proc) are tried to access
-		     */
-		    if ((APR_SUCCESS != status) && (is_option_set(conf->mask, OPTION_VERBO)))
-			fprintf(stderr, "\nskipping %s because: %s\n", file->path, apr_strerror(status, errbuf, 128));
-		}
-		if (APR_SUCCESS == status) {
-		    fsize->nb_checksumed++;
-		    napr_heap_insert(tmp_heap, file);
-		}
-	    }
-	    if (is_option_set(conf->mask, OPTION_VERBO)) {
-		fprintf(stderr, "\rProgress [%" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT "] %d%% ", nb_processed, nb_files,
-			(int) ((float) nb_processed / (float) nb_files * 100.0));
-		nb_processed++;
-	    }
-	}
-	else {
-	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->path);
-	    apr_pool_destroy(gc_pool);
+    /* what the cache knows of a file is only taken while these are unchanged */
+    if ((NULL == (path = ft_file_path(file, pathbuf, sizeof(pathbuf))))
+	|| (APR_SUCCESS != apr_stat(&finfo, path, APR_FINFO_SIZE | APR_FINFO_IDENT | APR_FINFO_MTIME | APR_FINFO_CTIME,
+				    gc_pool))
+	|| (finfo.size != file->size))
+	return;
+    file->cached = ft_cache_lookup(conf->cache, &finfo);
+    if (is_option_set(conf->mask, OPTION_XATTR))
+	file->xattr_flags = ft_cache_xattr_get(conf->cache, file->cached, path);
+}
+
+static int ft_fsize_savings_cmp(const void *param1, const void *param2)
+{
+    const ft_fsize_t *fsize1 = *(ft_fsize_t * const *) param1;
+    const ft_fsize_t *fsize2 = *(ft_fsize_t * const *) param2;
+    apr_off_t savings1, savings2;
+
+    savings1 = (apr_off_t) (fsize1->nb_files - 1) * fsize1->val;
+    savings2 = (apr_off_t) (fsize2->nb_files - 1) * fsize2->val;
+    if (savings1 != savings2)
+	return (savings1 > savings2) ? -1 : 1;
+    if (fsize1->val != fsize2->val)
+	return (fsize1->val > fsize2->val) ? -1 : 1;
+
+    return 0;
+}
+
+static int ft_fsize_cost_cmp(const void *param1, const void *param2)
+{
+    const ft_fsize_t *fsize1 = *(ft_fsize_t * const *) param1;
+    const ft_fsize_t *fsize2 = *(ft_fsize_t * const *) param2;
+    apr_off_t cost1, cost2;
+
+    /* every file of the group is read, and each one costs at least a seek */
+    cost1 = (apr_off_t) fsize1->nb_files * (fsize1->val + SCHEDULE_SEEK_COST);
+    cost2 = (apr_off_t) fsize2->nb_files * (fsize2->val + SCHEDULE_SEEK_COST);
+    if (cost1 != cost2)
+	return (cost1 < cost2) ? -1 : 1;
+    if (fsize1->val != fsize2->val)
+	return (fsize1->val > fsize2->val) ? -1 : 1;
+
+    return 0;
+}
+
+/* Where a collected file starts on its device, see ft_file_locate */
+typedef struct ft_location_t
+{
+    ft_file_t *file;
+    ft_fsize_t *fsize;
+    apr_uint64_t device;
+    apr_uint64_t offset;
+    apr_uint32_t index;		/* in the order of the walk */
+    int physical;
+} ft_location_t;
+
+static int ft_location_cmp(const void *param1, const void *param2)
+{
+    const ft_location_t *loc1 = param1;
+    const ft_location_t *loc2 = param2;
+
+    if (loc1->device != loc2->device)
+	return (loc1->device < loc2->device) ? -1 : 1;
+    if (loc1->offset != loc2->offset)
+	return (loc1->offset < loc2->offset) ? -1 : 1;
+
+    return (loc1->index < loc2->index) ? -1 : (loc1->index > loc2->index);
+}
+
+/* files of a group together, in the order of the disk */
+static int ft_location_rank_cmp(const void *param1, const void *param2)
+{
+    const ft_location_t *loc1 = param1;
+    const ft_location_t *loc2 = param2;
+
+    if (loc1->fsize->rank != loc2->fsize->rank)
+	return (loc1->fsize->rank < loc2->fsize->rank) ? -1 : 1;
+
+    return ft_location_cmp(param1, param2);
+}
+
+/* the order of size-desc, files of a size in the order of the walk */
+static int ft_location_size_cmp(const void *param1, const void *param2)
+{
+    const ft_location_t *loc1 = param1;
+    const ft_location_t *loc2 = param2;
+
+    if (loc1->file->size != loc2->file->size)
+	return (loc1->file->size > loc2->file->size) ? -1 : 1;
+
+    return (loc1->index < loc2->index) ? -1 : (loc1->index > loc2->index);
+}
+
+/* bytes the heads of a device travel over to read the files located by FIEMAP in that order */
+static apr_uint64_t ft_location_seek_distance(const ft_location_t *locs, int nb)
+{
+    const ft_location_t *prev = NULL;
+    apr_uint64_t distance = 0;
+    int i;
+
+    for (i = 0; i < nb; i++) {
+	if (!locs[i].physical)
+	    continue;
+	if ((NULL != prev) && (prev->device == locs[i].device))
+	    distance += (prev->offset < locs[i].offset) ? locs[i].offset - prev->offset : prev->offset - locs[i].offset;
+	prev = &locs[i];
+    }
+
+    return distance;
+}
+
+/**
+ * Rank the files in the order of the disk, for the physical schedule policy:
+ * a group comes at the place of its first file on the disk, and its files
+ * follow each other in the order of the disk. Files not located by FIEMAP
+ * are taken in the order of their inodes, a fair guess on most file systems.
+ * @param conf The configuration, with conf->files filled by the walk.
+ * @param gc_pool Pool for temporary allocations.
+ * @return APR_SUCCESS if no error occured.
+ */
+static apr_status_t ft_conf_schedule_physical(ft_conf_t *conf, apr_pool_t *gc_pool)
+{
+    char pathbuf[APR_PATH_MAX];
+    ft_location_t *locs;
+    const char *path;
+    apr_uint64_t before = 0;
+    apr_uint32_t hash_value, rank;
+    int i, nb_physical, nb_inode;
+
+    locs = apr_pcalloc(gc_pool, conf->files->nelts * sizeof(ft_location_t));
+    for (i = 0, nb_physical = 0, nb_inode = 0; i < conf->files->nelts; i++) {
+	locs[i].file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+	locs[i].index = i;
+	if (NULL == (locs[i].fsize = napr_hash_search(conf->sizes, &locs[i].file->size, 1, &hash_value))) {
+	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s",
+		      locs[i].file->size, locs[i].file->name);
 	    return APR_EGENERAL;
 	}
+	locs[i].fsize->rank = (apr_uint32_t) -1;
+	/* a file alone of its size is never read, one that can't be opened is skipped when it is */
+	if ((2 > locs[i].fsize->nb_files) || (NULL == (path = ft_file_path(locs[i].file, pathbuf, sizeof(pathbuf))))
+	    || (APR_SUCCESS != ft_file_locate(path, &locs[i].device, &locs[i].offset, &locs[i].physical)))
+	    continue;
+	if (locs[i].physical)
+	    nb_physical++;
+	else
+	    nb_inode++;
     }
-    if (is_option_set(conf->mask, OPTION_VERBO)) {
-	fprintf(stderr, "\rProgress [%" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT "] %d%% ", nb_processed, nb_files,
-		(int) ((float) nb_processed / (float) nb_files * 100.0));
-	fprintf(stderr, "\n");
+    if (is_option_set(conf->mask, OPTION_STATS)) {
+	qsort(locs, conf->files->nelts, sizeof(ft_location_t), ft_location_size_cmp);
+	before = ft_location_seek_distance(locs, conf->files->nelts);
     }
 
-    apr_pool_destroy(gc_pool);
-    conf->heap = tmp_heap;
+    qsort(locs, conf->files->nelts, sizeof(ft_location_t), ft_location_cmp);
+    for (i = 0, rank = 0; i < conf->files->nelts; i++)
+	if ((apr_uint32_t) -1 == locs[i].fsize->rank)
+	    locs[i].fsize->rank = rank++;
+    qsort(locs, conf->files->nelts, sizeof(ft_location_t), ft_location_rank_cmp);
+    for (i = 0; i < conf->files->nelts; i++)
+	locs[i].file->rank = i;
+    conf->file_cmp = ft_file_rank_cmp;
+
+    if (is_option_set(conf->mask, OPTION_STATS)) {
+	fprintf(stderr, "[stats] schedule: %d files located by FIEMAP, %d by inode\n", nb_physical, nb_inode);
+	fprintf(stderr, "[stats] schedule: seek distance %" APR_UINT64_T_FMT " bytes in size-desc order, %"
+		APR_UINT64_T_FMT " in physical order\n", before, ft_location_seek_distance(locs, conf->files->nelts));
+    }
 
     return APR_SUCCESS;
 }
 
-static int chksum_cmp(const void *chksum1, const void *chksum2)
+/**
+ * Rank the size groups according to the schedule policy, and give each
+ * collected file the rank of its group, so that the heap hands the groups out
+ * in that order. Nothing to do for size-desc, the order of ft_file_cmp.
+ * @param conf The configuration, with conf->files filled by the walk.
+ * @param gc_pool Pool for temporary allocations.
+ * @return APR_SUCCESS if no error occured.
+ */
+static apr_status_t ft_conf_schedule(ft_conf_t *conf, apr_pool_t *gc_pool)
 {
-    const ft_chksum_t *chk1 = chksum1;
-    const ft_chksum_t *chk2 = chksum2;
+    apr_array_header_t *groups;
+    napr_hash_index_t *hi;
+    ft_fsize_t *fsize;
+    ft_file_t *file;
+    apr_uint32_t hash_value;
     int i;
 
-    if (0 == (i = memcmp(chk1->val_array, chk2->val_array, HASHSTATE))) {
-	return chk1->file->prioritized - chk2->file->prioritized;
+    if (SCHEDULE_SIZE_DESC == conf->schedule) {
+	conf->file_cmp = ft_file_cmp;
+	return APR_SUCCESS;
     }
-    else {
-	i <<= 1;
+    if (SCHEDULE_PHYSICAL == conf->schedule)
+	return ft_conf_schedule_physical(conf, gc_pool);
+
+    groups = apr_array_make(gc_pool, 1024, sizeof(ft_fsize_t *));
+    for (hi = napr_hash_first(gc_pool, conf->sizes); NULL != hi; hi = napr_hash_next(hi)) {
+	napr_hash_this(hi, NULL, NULL, (void **) &fsize);
+	APR_ARRAY_PUSH(groups, ft_fsize_t *) = fsize;
+    }
+    qsort(groups->elts, groups->nelts, sizeof(ft_fsize_t *),
+	  (SCHEDULE_SAVINGS_DESC == conf->schedule) ? ft_fsize_savings_cmp : ft_fsize_cost_cmp);
+    for (i = 0; i < groups->nelts; i++)
+	APR_ARRAY_IDX(groups, i, ft_fsize_t *)->rank = i;
+
+    for (i = 0; i < conf->files->nelts; i++) {
+	file = APR_ARRAY_IDX(conf->files, i, ft_file_t *);
+	if (NULL == (fsize = napr_hash_search(conf->sizes, &file->size, 1, &hash_value))) {
+	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->name);
+	    return APR_EGENERAL;
+	}
+	file->rank = fsize->rank;
     }
+    conf->file_cmp = ft_file_rank_cmp;
 
-    return i;
+    return APR_SUCCESS;
 }
 
-#if HAVE_PUZZLE
-
-static apr_status_t ft_conf_image_twin_report(ft_conf_t *conf)
+static int ft_block_cmp(const void *chksum1, const void *chksum2)
 {
-    PuzzleContext context;
-    double d;
-    ft_file_t *file, *file_cmp;
-    int i, heap_size;
-    unsigned char already_printed;
+    const ft_chksum_t *chk1 = chksum1;
+    const ft_chksum_t *chk2 = chksum2;
 
-    puzzle_init_context(&context);
-    puzzle_set_max_width(&context, 5000);
-    puzzle_set_max_height(&context, 5000);
-    puzzle_set_lambdas(&context, 13);
+    return memcmp(chk1->val_array, chk2->val_array, sizeof(chk1->val_array));
+}
 
-    heap_size = napr_heap_size(conf->heap);
-    for (i = 0; i < heap_size; i++) {
+/* is the block of the i-th of the nb sorted chksums shared by another file */
+static int ft_block_shared(const ft_chksum_t *chksums, unsigned int i, unsigned int nb)
+{
+    return ((0 < i) && (0 == ft_block_cmp(&chksums[i - 1], &chksums[i])))
+	|| (((i + 1) < nb) && (0 == ft_block_cmp(&chksums[i], &chksums[i + 1])));
+}
 
-	file = napr_heap_get_nth(conf->heap, i);
-	puzzle_init_cvec(&context, &(file->cvec));
-	if (0 == puzzle_fill_cvec_from_file(&context, &(file->cvec), file->path)) {
-	    file->cvec_ok |= 0x1;
+/**
+ * Hash a block of each candidate of a size group, and drop the ones whose
+ * block is not shared by any other: they can't have a twin. Nothing is
+ * released nor displayed, so that it runs in a worker.
+ * @param conf The configuration.
+ * @param fsize The size group, its chksum_array is used as scratch space.
+ * @param files The candidates, the ones left are moved at the start, the
+ *        dropped ones after them.
+ * @param statuses One per candidate, for the dropped ones: APR_SUCCESS if
+ *        their block is unique, why it could not be read otherwise.
+ * @param nb The number of candidates.
+ * @param offset Where the block starts in the files.
+ * @param gc_pool Pool for temporary allocations.
+ * @return The number of candidates left.
+ */
+static unsigned int ft_conf_sieve(ft_conf_t *conf, ft_fsize_t *fsize, ft_file_t **files, apr_status_t *statuses,
+				  unsigned int nb, apr_off_t offset, apr_pool_t *gc_pool)
+{
+    char pathbuf[APR_PATH_MAX];
+    ft_chksum_t *chksums = fsize->chksum_array;
+    ft_cache_entry_t *cached;
+    apr_uint32_t *block, flag = (0 == offset) ? FT_CACHE_HEAD : FT_CACHE_TAIL;
+    const char *path;
+    apr_status_t status;
+    unsigned int i, nb_hashed, nb_failed, nb_left;
+
+    /* hashed ones from the start of chksums, the unreadable ones from its end */
+    for (i = 0, nb_hashed = 0, nb_failed = 0; i < nb; i++) {
+	/* the entries of distinct files are distinct, even for hard links */
+	if (NULL != (cached = files[i]->cached)) {
+	    block = (FT_CACHE_HEAD == flag) ? cached->head : cached->tail;
+	    if (cached->flags & flag) {
+		memcpy(chksums[nb_hashed].val_array, block, sizeof(chksums[nb_hashed].val_array));
+		chksums[nb_hashed++].file = files[i];
+		continue;
+	    }
 	}
-	else {
-	    DEBUG_ERR("error calling puzzle_fill_cvec_from_file, ignoring file: %s", file->path);
+	if (NULL != (path = ft_file_path(files[i], pathbuf, sizeof(pathbuf))))
+	    status = checksum_file_block(path, offset, CHECKSUM_BLOCK_LEN, conf->digest, chksums[nb_hashed].val_array,
+					 gc_pool);
+	else
+	    status = APR_ENAMETOOLONG;
+	if (APR_SUCCESS != status) {
+	    nb_failed++;
+	    chksums[nb - nb_failed].file = files[i];
+	    statuses[nb - nb_failed] = status;
+	    continue;
 	}
+	if (NULL != cached) {
+	    memcpy(block, chksums[nb_hashed].val_array, sizeof(chksums[nb_hashed].val_array));
+	    cached->flags |= flag;
+	}
+	chksums[nb_hashed++].file = files[i];
+    }
 
-	if (is_option_set(conf->mask, OPTION_VERBO)) {
-	    fprintf(stderr, "\rProgress [%i/%i] %d%% ", i, heap_size, (int) ((float) i / (float) heap_size * 100.0));
+    qsort(chksums, nb_hashed, sizeof(ft_chksum_t), ft_block_cmp);
+    for (i = 0, nb_left = 0; i < nb_hashed; i++)
+	if (ft_block_shared(chksums, i, nb_hashed))
+	    files[nb_left++] = chksums[i].file;
+    for (i = 0, nb = nb_left; i < nb_hashed; i++) {
+	if (!ft_block_shared(chksums, i, nb_hashed)) {
+	    statuses[nb] = APR_SUCCESS;
+	    files[nb++] = chksums[i].file;
 	}
     }
-    if (is_option_set(conf->mask, OPTION_VERBO)) {
-	fprintf(stderr, "\rProgress [%i/%i] %d%% ", i, heap_size, (int) ((float) i / (float) heap_size * 100.0));
-	fprintf(stderr, "\n");
+    for (i = nb_hashed; i < nb_hashed + nb_failed; i++)
+	files[i] = chksums[i].file;
+
+    return nb_left;
+}
+
+/*
+ * Hash nb (at most FT_DIGEST_LANES) files of a same size at once with the
+ * multi-buffer jenkins, states[k] and statuses[k] are those of files[k].
+ */
+static void ft_conf_checksum_lanes(ft_file_t **files, int nb, apr_uint32_t (*states)[FT_DIGEST_WORDS],
+				   apr_status_t *statuses, apr_pool_t *gc_pool)
+{
+    char pathbufs[FT_DIGEST_LANES][APR_PATH_MAX];
+    apr_uint32_t lane_states[FT_DIGEST_LANES][FT_DIGEST_WORDS];
+    apr_status_t lane_statuses[FT_DIGEST_LANES], status;
+    const char *paths[FT_DIGEST_LANES];
+    int lane_of[FT_DIGEST_LANES];
+    int k, nb_lanes;
+
+    for (k = 0, nb_lanes = 0; k < nb; k++) {
+	if (NULL == (paths[nb_lanes] = ft_file_path(files[k], pathbufs[nb_lanes], APR_PATH_MAX)))
+	    statuses[k] = APR_ENAMETOOLONG;
+	else
+	    lane_of[nb_lanes++] = k;
     }
+    if (0 == nb_lanes)
+	return;
 
-    while (NULL != (file = napr_heap_extract(conf->heap))) {
-	if (!(file->cvec_ok & 0x1))
-	    continue;
-	already_printed = 0;
-	heap_size = napr_heap_size(conf->heap);
-	for (i = 0; i < heap_size; i++) {
-	    file_cmp = napr_heap_get_nth(conf->heap, i);
-	    if (!(file_cmp->cvec_ok & 0x1))
-		continue;
+    if (APR_SUCCESS != (status = checksum_files(paths, nb_lanes, files[0]->size, lane_states, lane_statuses, gc_pool))) {
+	for (k = 0; k < nb_lanes; k++)
+	    statuses[lane_of[k]] = status;
+	return;
+    }
+    for (k = 0; k < nb_lanes; k++) {
+	statuses[lane_of[k]] = lane_statuses[k];
+	memcpy(states[lane_of[k]], lane_states[k], sizeof(lane_states[k]));
+    }
+}
 
-	    d = puzzle_vector_normalized_distance(&context, &(file->cvec), &(file_cmp->cvec), 0);
-	    if (d < conf->threshold) {
-		if (!already_printed) {
-		    printf("%s%c", file->path, conf->sep);
-		    already_printed = 1;
-		}
-		else {
-		    printf("%c", conf->sep);
-		}
-		printf("%s", file_cmp->path);
-	    }
-	}
+/* Hash the whole content of a file, extracting it first if it is archived */
+static apr_status_t ft_conf_checksum_file(ft_conf_t *conf, ft_file_t *file, apr_uint32_t *val_array,
+					  apr_pool_t *gc_pool)
+{
+    char pathbuf[APR_PATH_MAX];
+    const char *filepath;
 
-	if (already_printed)
-	    printf("\n\n");
+    filepath = ft_file_path(file, pathbuf, sizeof(pathbuf));
+#if HAVE_ARCHIVE
+    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath)) {
+	apr_status_t status;
 
-	puzzle_free_cvec(&context, &(file->cvec));
-    }
+	if (NULL == (filepath = ft_untar_file(file, gc_pool))) {
+	    DEBUG_ERR("error calling ft_untar_file");
+	    return APR_EGENERAL;
+	}
+	status = checksum_file(filepath, file->size, conf->excess_size, conf->digest, val_array, gc_pool);
+	apr_file_remove(filepath, gc_pool);
 
-    puzzle_free_context(&context);
+	return status;
+    }
+#endif
+    if (NULL == filepath)
+	return APR_ENAMETOOLONG;
 
-    return APR_SUCCESS;
+    return checksum_file(filepath, file->size, conf->excess_size, conf->digest, val_array, gc_pool);
+}
+
+/*
+ * A size group of twin candidates, from the moment it is taken out of the
+ * sorted files to the moment its checksums are merged, in order, by the main
+ * thread.
+ */
+typedef struct ft_group_t
+{
+    ft_fsize_t *fsize;
+    apr_uint32_t hash_value;
+    ft_file_t **files;		/* the candidates, see ft_conf_sieve for their order */
+    apr_status_t *statuses;	/* one per candidate */
+    unsigned int nb;		/* candidates found */
+    unsigned int nb_head;	/* left by the head block */
+    unsigned int nb_tail;	/* left by the tail block, the ones fully hashed */
+    unsigned int nb_cached;	/* of these, the first ones, whose digest is known by the cache */
+    int tiered;
+    int lanes;			/* hashed FT_DIGEST_LANES at a time by the multi-buffer jenkins */
+    int archived;
+    int tree;			/* hashed by segments, see ft_digest_tree */
+    unsigned int nb_segments;
+    apr_uint32_t (*segments)[FT_DIGEST_WORDS];	/* nb_segments digests per candidate */
+    apr_status_t *segment_statuses;
+} ft_group_t;
+
+/*
+ * A piece of work on a group: its sieve if nb is 0, else the hashing of the
+ * candidates k to k + nb - 1, or of the given segment of the candidate k.
+ */
+typedef struct ft_job_t
+{
+    ft_group_t *group;
+    unsigned int k;
+    unsigned int nb;
+    unsigned int segment;
+} ft_job_t;
+
+static void ft_job_run(ft_conf_t *conf, ft_job_t *job, apr_pool_t *gc_pool)
+{
+    apr_uint32_t lane_states[FT_DIGEST_LANES][FT_DIGEST_WORDS];
+    ft_group_t *group = job->group;
+    ft_chksum_t *chksums = group->fsize->chksum_array;
+    unsigned int k;
+
+    if (0 == job->nb) {
+	/*
+	 * Before reading whole files, most of the candidates are told apart
+	 * by their first block, then by their last one.
+	 */
+	group->nb_head = ft_conf_sieve(conf, group->fsize, group->files, group->statuses, group->nb, 0, gc_pool);
+	group->nb_tail = group->nb_head;
+	if (3 <= group->nb_head)
+	    group->nb_tail =
+		ft_conf_sieve(conf, group->fsize, group->files, group->statuses, group->nb_head,
+			      group->fsize->val - CHECKSUM_BLOCK_LEN, gc_pool);
+	return;
+    }
+
+    /* each candidate has its own slot, the main thread packs them */
+    if (group->tree) {
+	char pathbuf[APR_PATH_MAX];
+	const char *path;
+	apr_off_t offset = (apr_off_t) job->segment * TREE_SEGMENT_LEN;
+	unsigned int s = job->k * group->nb_segments + job->segment;
+
+	if (NULL != (path = ft_file_path(group->files[job->k], pathbuf, sizeof(pathbuf))))
+	    group->segment_statuses[s] =
+		checksum_file_segment(path, offset, MIN(TREE_SEGMENT_LEN, group->fsize->val - offset), conf->digest,
+				      group->segments[s], gc_pool);
+	else
+	    group->segment_statuses[s] = APR_ENAMETOOLONG;
+	return;
+    }
+    if (group->lanes) {
+	ft_conf_checksum_lanes(group->files + job->k, job->nb, lane_states, group->statuses + job->k, gc_pool);
+	for (k = 0; k < job->nb; k++)
+	    memcpy(chksums[job->k + k].val_array, lane_states[k], sizeof(lane_states[k]));
+	return;
+    }
+    for (k = job->k; k < job->k + job->nb; k++)
+	group->statuses[k] = ft_conf_checksum_file(conf, group->files[k], chksums[k].val_array, gc_pool);
+}
+
+/*
+ * The hashing threads of --jobs. The main thread queues the jobs of a window,
+ * works on them too and waits for all of them to be done. Jobs are taken out
+ * of a napr_mqueue, the ones reading the most bytes first, so that no big
+ * file is left to a single thread at the end of a window; the mutex only
+ * guards the counting of the jobs done.
+ */
+typedef struct ft_workers_t
+{
+    ft_conf_t *conf;
+    napr_mqueue_t *queue;	/* the jobs not taken yet */
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *work;	/* jobs are there, or the workers have to stop */
+    apr_thread_cond_t *done;	/* the last job is done */
+    apr_thread_t **threads;
+    unsigned int nb_threads;
+    unsigned int nb_jobs, nb_done;
+    int stop;
+} ft_workers_t;
+
+typedef struct ft_worker_t
+{
+    ft_workers_t *workers;
+    apr_pool_t *pool;		/* only used by this thread */
+} ft_worker_t;
+
+/* bytes a job reads, the key of its job in the queue */
+static apr_off_t ft_job_cost(const ft_job_t *job)
+{
+    const ft_group_t *group = job->group;
+    apr_off_t offset;
+
+    if (0 == job->nb)
+	return (apr_off_t) group->nb * 2 * CHECKSUM_BLOCK_LEN;
+    if (group->tree) {
+	offset = (apr_off_t) job->segment * TREE_SEGMENT_LEN;
+	return MIN(TREE_SEGMENT_LEN, group->fsize->val - offset);
+    }
+
+    return (apr_off_t) job->nb * group->fsize->val;
+}
+
+/* take and run jobs until there is none left, called and returning with the mutex held */
+static void ft_workers_take(ft_workers_t *workers, apr_pool_t *pool)
+{
+    ft_job_t *job;
+
+    apr_thread_mutex_unlock(workers->mutex);
+    while (NULL != (job = napr_mqueue_extract(workers->queue, NULL))) {
+	ft_job_run(workers->conf, job, pool);
+	apr_pool_clear(pool);
+	apr_thread_mutex_lock(workers->mutex);
+	if (++workers->nb_done == workers->nb_jobs)
+	    apr_thread_cond_signal(workers->done);
+	apr_thread_mutex_unlock(workers->mutex);
+    }
+    apr_thread_mutex_lock(workers->mutex);
+}
+
+static void *APR_THREAD_FUNC ft_worker(apr_thread_t *thread, void *data)
+{
+    ft_worker_t *worker = data;
+    ft_workers_t *workers = worker->workers;
+
+    apr_thread_mutex_lock(workers->mutex);
+    while (!workers->stop) {
+	ft_workers_take(workers, worker->pool);
+	/* jobs are queued with the mutex held, none can be missed */
+	if (!workers->stop && (0 == napr_mqueue_size(workers->queue)))
+	    apr_thread_cond_wait(workers->work, workers->mutex);
+    }
+    apr_thread_mutex_unlock(workers->mutex);
+    apr_thread_exit(thread, APR_SUCCESS);
+
+    return NULL;
+}
+
+/* run the jobs, with the workers if any, pool is the one of the main thread and is cleared after each job */
+static void ft_workers_run(ft_conf_t *conf, ft_workers_t *workers, ft_job_t *jobs, unsigned int nb_jobs,
+			   apr_pool_t *pool)
+{
+    apr_off_t key;
+    unsigned int k;
+
+    if (NULL == workers) {
+	for (k = 0; k < nb_jobs; k++) {
+	    ft_job_run(conf, &jobs[k], pool);
+	    apr_pool_clear(pool);
+	}
+	return;
+    }
+
+    /* the counts are reset before any job is queued: a worker may take one as soon as it is */
+    apr_thread_mutex_lock(workers->mutex);
+    workers->nb_jobs = nb_jobs;
+    workers->nb_done = 0;
+    for (k = 0; k < nb_jobs; k++) {
+	/* the jobs come in the order of the disk with --schedule physical, keep it rather than the biggest first */
+	key = (SCHEDULE_PHYSICAL == conf->schedule) ? (apr_off_t) (nb_jobs - k) : ft_job_cost(&jobs[k]);
+	if (0 != napr_mqueue_insert(workers->queue, key, &jobs[k])) {
+	    /* run by this thread then */
+	    ft_job_run(conf, &jobs[k], pool);
+	    apr_pool_clear(pool);
+	    workers->nb_done++;
+	}
+    }
+    apr_thread_cond_broadcast(workers->work);
+    ft_workers_take(workers, pool);
+    while (workers->nb_done < workers->nb_jobs)
+	apr_thread_cond_wait(workers->done, workers->mutex);
+    workers->nb_jobs = 0;
+    apr_thread_mutex_unlock(workers->mutex);
+}
+
+static ft_workers_t *ft_workers_make(ft_conf_t *conf, unsigned int nb_threads, apr_pool_t *pool)
+{
+    char errbuf[128];
+    ft_workers_t *workers;
+    ft_worker_t *worker;
+    apr_status_t status;
+    unsigned int i;
+
+    workers = apr_pcalloc(pool, sizeof(ft_workers_t));
+    workers->conf = conf;
+    workers->threads = apr_pcalloc(pool, nb_threads * sizeof(apr_thread_t *));
+    worker = apr_pcalloc(pool, nb_threads * sizeof(ft_worker_t));
+    if ((APR_SUCCESS != (status = apr_thread_mutex_create(&workers->mutex, APR_THREAD_MUTEX_DEFAULT, pool)))
+	|| (APR_SUCCESS != (status = apr_thread_cond_create(&workers->work, pool)))
+	|| (APR_SUCCESS != (status = apr_thread_cond_create(&workers->done, pool)))) {
+	DEBUG_ERR("error creating the workers: %s", apr_strerror(status, errbuf, 128));
+	return NULL;
+    }
+    if (NULL == (workers->queue = napr_mqueue_make(pool, nb_threads + 1))) {
+	DEBUG_ERR("error calling napr_mqueue_make");
+	return NULL;
+    }
+    /* the threads are not started before their pools exist, a pool must only be used by its thread */
+    for (i = 0; i < nb_threads; i++) {
+	worker[i].workers = workers;
+	if (APR_SUCCESS != (status = apr_pool_create(&worker[i].pool, pool))) {
+	    DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	    return NULL;
+	}
+    }
+    for (i = 0; i < nb_threads; i++) {
+	if (APR_SUCCESS != (status = apr_thread_create(&workers->threads[i], NULL, ft_worker, &worker[i], pool))) {
+	    DEBUG_ERR("error calling apr_thread_create: %s", apr_strerror(status, errbuf, 128));
+	    break;
+	}
+	workers->nb_threads++;
+    }
+
+    return workers;
+}
+
+static void ft_workers_destroy(ft_workers_t *workers)
+{
+    apr_status_t status;
+    unsigned int i;
+
+    apr_thread_mutex_lock(workers->mutex);
+    workers->stop = 1;
+    apr_thread_cond_broadcast(workers->work);
+    apr_thread_mutex_unlock(workers->mutex);
+    for (i = 0; i < workers->nb_threads; i++)
+	apr_thread_join(&status, workers->threads[i]);
+    napr_mqueue_destroy(workers->queue);
+}
+
+/* groups are hashed in windows of about that many candidates per job, so that all the workers have something to do */
+#define WINDOW_FILES_PER_JOB 64
+
+typedef struct ft_window_t
+{
+    apr_array_header_t *groups;
+    apr_pool_t *pool;		/* cleared once the window is merged */
+    unsigned int nb_files;
+    apr_size_t nb_processed, nb_files_total, nb_head_dropped, nb_tail_dropped, nb_full_hashed, nb_full_cached;
+} ft_window_t;
+
+/* Merge the checksums of a group in its chksum_array, and the candidates kept in files[0..*nb_kept] */
+static void ft_group_merge(ft_conf_t *conf, ft_window_t *window, ft_group_t *group, ft_file_t **files,
+			   unsigned int *nb_kept)
+{
+    char errbuf[128], pathbuf[APR_PATH_MAX];
+    ft_fsize_t *fsize = group->fsize;
+    ft_file_t *file;
+    const char *path;
+    unsigned int k;
+
+    for (k = 0; k < group->nb; k++) {
+	file = group->files[k];
+	if (APR_SUCCESS != group->statuses[k]) {
+	    /*
+	     * no return status if != APR_SUCCESS , because :
+	     * Fault-check has been removed in case files disappear
+	     * between collecting and comparing or special files (like
+	     * device or /proc) are tried to access
+	     */
+	    if (is_option_set(conf->mask, OPTION_VERBO)) {
+		path = ft_file_path(file, pathbuf, sizeof(pathbuf));
+		fprintf(stderr, "\nskipping %s because: %s\n", (NULL != path) ? path : file->name,
+			apr_strerror(group->statuses[k], errbuf, 128));
+	    }
+	    ft_conf_file_release(conf, file);
+	}
+	else if (k >= group->nb_head) {
+	    window->nb_head_dropped++;
+	    ft_conf_file_release(conf, file);
+	}
+	else if (k >= group->nb_tail) {
+	    window->nb_tail_dropped++;
+	    ft_conf_file_release(conf, file);
+	}
+	else {
+	    if (fsize->nb_checksumed != k)
+		memcpy(fsize->chksum_array[fsize->nb_checksumed].val_array, fsize->chksum_array[k].val_array,
+		       sizeof(fsize->chksum_array[k].val_array));
+	    fsize->chksum_array[fsize->nb_checksumed++].file = file;
+	    /* in no heap order: napr_heap_make_from_array() heapifies them once all groups are done */
+	    files[(*nb_kept)++] = file;
+	}
+    }
+
+    /* see if a twin is still possible */
+    if (2 > fsize->nb_checksumed) {
+	*nb_kept -= fsize->nb_checksumed;
+	if (1 == fsize->nb_checksumed)
+	    ft_conf_file_release(conf, files[*nb_kept]);
+	ft_conf_fsize_release(conf, fsize, group->hash_value);
+    }
+}
+
+static void ft_window_display_progress(ft_window_t *window)
+{
+    fprintf(stderr, "\rProgress [%" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT "] %d%% ", window->nb_processed,
+	    window->nb_files_total, (int) ((float) window->nb_processed / (float) window->nb_files_total * 100.0));
+}
+
+/*
+ * Move the candidates whose digest is known by the cache to the start of the
+ * group, with their digest, and return how many they are.
+ */
+static unsigned int ft_group_cached(ft_conf_t *conf, ft_group_t *group)
+{
+    ft_chksum_t *chksums = group->fsize->chksum_array;
+    ft_file_t *file;
+    apr_uint32_t flags;
+    unsigned int k, nb_cached;
+
+    /* a digest combined from segments is not the one of the whole content */
+    flags = FT_CACHE_FULL;
+    if ((group->fsize->val >= conf->tree_size) && !group->archived)
+	flags |= FT_CACHE_TREE;
+    for (k = 0, nb_cached = 0; k < group->nb_tail; k++) {
+	file = group->files[k];
+	if ((NULL == file->cached) || (flags != (file->cached->flags & (FT_CACHE_FULL | FT_CACHE_TREE))))
+	    continue;
+	group->files[k] = group->files[nb_cached];
+	group->files[nb_cached] = file;
+	memcpy(chksums[nb_cached].val_array, file->cached->full, sizeof(chksums[nb_cached].val_array));
+	group->statuses[nb_cached++] = APR_SUCCESS;
+    }
+
+    return nb_cached;
+}
+
+/* small groups are compared without being hashed, unless the cache knows the digests of all of them */
+static int ft_group_hashless(const ft_group_t *group)
+{
+    if (0 == group->fsize->val)
+	return 1;
+
+    return (HASHLESS_GROUP_MAX >= group->nb_tail) && ((0 == group->nb_tail) || (group->nb_cached < group->nb_tail));
+}
+
+/*
+ * Hash the groups of the window, with the workers if any, then merge them in
+ * order on the main thread: the result does not depend on the number of
+ * jobs.
+ */
+static void ft_window_flush(ft_conf_t *conf, ft_window_t *window, ft_workers_t *workers, ft_file_t **files,
+			    unsigned int *nb_kept, apr_pool_t *job_pool)
+{
+    char pathbuf[APR_PATH_MAX];
+    ft_group_t *groups = (ft_group_t *) window->groups->elts, *group;
+    ft_file_t *file;
+    ft_job_t *jobs;
+    const char *path;
+    unsigned int g, k, s, nb, nb_jobs;
+
+    jobs = apr_palloc(window->pool, window->groups->nelts * sizeof(ft_job_t));
+    for (g = 0, nb_jobs = 0; g < window->groups->nelts; g++) {
+	if (groups[g].tiered && (3 <= groups[g].nb)) {
+	    jobs[nb_jobs].group = &groups[g];
+	    jobs[nb_jobs++].nb = 0;
+	}
+    }
+    ft_workers_run(conf, workers, jobs, nb_jobs, job_pool);
+
+    for (g = 0, nb_jobs = 0; g < window->groups->nelts; g++) {
+	group = &groups[g];
+	if ((NULL != conf->cache) && (0 != group->fsize->val))
+	    group->nb_cached = ft_group_cached(conf, group);
+	/* they are all compared at once by filecmp_group, don't call checksum on 0-length file too */
+	if (ft_group_hashless(group)) {
+	    for (k = 0; k < group->nb_tail; k++) {
+		memset(group->fsize->chksum_array[k].val_array, 0, sizeof(group->fsize->chksum_array[k].val_array));
+		group->statuses[k] = APR_SUCCESS;
+	    }
+	    continue;
+	}
+	group->tree = (group->fsize->val >= conf->tree_size) && !group->archived;
+	if (group->tree) {
+	    group->nb_segments = (group->fsize->val + TREE_SEGMENT_LEN - 1) / TREE_SEGMENT_LEN;
+	    group->segments = apr_palloc(window->pool, group->nb_tail * group->nb_segments * sizeof(*group->segments));
+	    group->segment_statuses =
+		apr_palloc(window->pool, group->nb_tail * group->nb_segments * sizeof(apr_status_t));
+	    nb_jobs += (group->nb_tail - group->nb_cached) * group->nb_segments;
+	}
+	else {
+	    nb_jobs += group->nb_tail - group->nb_cached;
+	}
+    }
+
+    jobs = apr_palloc(window->pool, nb_jobs * sizeof(ft_job_t));
+    for (g = 0, nb_jobs = 0; g < window->groups->nelts; g++) {
+	group = &groups[g];
+	if (ft_group_hashless(group))
+	    continue;
+	window->nb_full_hashed += group->nb_tail - group->nb_cached;
+	window->nb_full_cached += group->nb_cached;
+	group->fsize->hashed = 1;
+	if (group->tree) {
+	    for (k = group->nb_cached; k < group->nb_tail; k++) {
+		for (s = 0; s < group->nb_segments; s++) {
+		    jobs[nb_jobs].group = group;
+		    jobs[nb_jobs].k = k;
+		    jobs[nb_jobs].nb = 1;
+		    jobs[nb_jobs++].segment = s;
+		}
+	    }
+	    continue;
+	}
+	/* the multi-buffer jenkins hashes up to FT_DIGEST_LANES files in one pass */
+	group->lanes = (&ft_digest_jenkins == conf->digest) && !group->archived;
+	nb = group->lanes ? FT_DIGEST_LANES : 1;
+	for (k = group->nb_cached; k < group->nb_tail; k += nb) {
+	    jobs[nb_jobs].group = group;
+	    jobs[nb_jobs].k = k;
+	    jobs[nb_jobs].nb = MIN(nb, group->nb_tail - k);
+	    /* extracting an archived file is left to the main thread */
+	    if (group->archived)
+		ft_workers_run(conf, NULL, &jobs[nb_jobs], 1, job_pool);
+	    else
+		nb_jobs++;
+	}
+    }
+    ft_workers_run(conf, workers, jobs, nb_jobs, job_pool);
+
+    for (g = 0; g < window->groups->nelts; g++) {
+	group = &groups[g];
+	if (!group->tree)
+	    continue;
+	for (k = group->nb_cached; k < group->nb_tail; k++) {
+	    group->statuses[k] = APR_SUCCESS;
+	    for (s = 0; s < group->nb_segments; s++)
+		if (APR_SUCCESS != group->segment_statuses[k * group->nb_segments + s])
+		    group->statuses[k] = group->segment_statuses[k * group->nb_segments + s];
+	    if (APR_SUCCESS == group->statuses[k])
+		ft_digest_tree(conf->digest, group->segments + k * group->nb_segments, group->nb_segments,
+			       group->fsize->chksum_array[k].val_array);
+	}
+    }
+
+    /* the digests computed are kept for the next runs */
+    for (g = 0; (NULL != conf->cache) && (g < window->groups->nelts); g++) {
+	group = &groups[g];
+	if (ft_group_hashless(group))
+	    continue;
+	for (k = group->nb_cached; k < group->nb_tail; k++) {
+	    if ((APR_SUCCESS != group->statuses[k]) || (NULL == group->files[k]->cached))
+		continue;
+	    memcpy(group->files[k]->cached->full, group->fsize->chksum_array[k].val_array,
+		   sizeof(group->files[k]->cached->full));
+	    group->files[k]->cached->flags &= ~(FT_CACHE_TREE | FT_CACHE_XATTR(FT_CACHE_FULL));
+	    group->files[k]->cached->flags |= FT_CACHE_FULL | (group->tree ? FT_CACHE_TREE : 0);
+	}
+    }
+
+    /* and on the files themselves with --xattr, before the ones dropped are released */
+    for (g = 0; is_option_set(conf->mask, OPTION_XATTR) && (g < window->groups->nelts); g++) {
+	group = &groups[g];
+	for (k = 0; k < group->nb; k++) {
+	    file = group->files[k];
+	    if ((NULL == file->cached) || (file->xattr_flags == (file->cached->flags & FT_CACHE_DIGESTS)))
+		continue;
+	    /* a read-only file system or a file of another user keeps none, it is read again by the next run */
+	    if (NULL != (path = ft_file_path(file, pathbuf, sizeof(pathbuf))))
+		ft_cache_xattr_set(conf->cache, file->cached, path, window->pool);
+	}
+    }
+
+    for (g = 0; g < window->groups->nelts; g++) {
+	ft_group_merge(conf, window, &groups[g], files, nb_kept);
+	if (is_option_set(conf->mask, OPTION_VERBO)) {
+	    window->nb_processed += groups[g].nb;
+	    ft_window_display_progress(window);
+	}
+    }
+
+    apr_pool_clear(window->pool);
+    window->groups = apr_array_make(window->pool, 64, sizeof(ft_group_t));
+    window->nb_files = 0;
+}
+
+static apr_status_t ft_conf_process_sizes(ft_conf_t *conf)
+{
+    char errbuf[128];
+    ft_file_t *file, **files;
+    ft_fsize_t *fsize;
+    ft_group_t *group;
+    ft_window_t window;
+    ft_workers_t *workers = NULL;
+    napr_heap_t *tmp_heap;
+    apr_pool_t *gc_pool, *job_pool;
+    apr_uint32_t hash_value;
+    apr_status_t status;
+    unsigned int i, j, k, nb_sorted, nb_kept, window_size;
+    int archived;
+
+    if (is_option_set(conf->mask, OPTION_VERBO))
+	fprintf(stderr, "Referencing files and sizes:\n");
+
+    if ((APR_SUCCESS != (status = apr_pool_create(&gc_pool, conf->pool)))
+	|| (APR_SUCCESS != (status = apr_pool_create(&job_pool, gc_pool)))
+	|| (APR_SUCCESS != (status = apr_pool_create(&window.pool, gc_pool)))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	apr_terminate();
+	return -1;
+    }
+    if ((1 < conf->nb_jobs) && (NULL == (workers = ft_workers_make(conf, conf->nb_jobs - 1, gc_pool)))) {
+	apr_pool_destroy(gc_pool);
+	return APR_EGENERAL;
+    }
+    /* a single job merges each group right away, as files are released the sooner */
+    window_size = (1 < conf->nb_jobs) ? WINDOW_FILES_PER_JOB * conf->nb_jobs : 1;
+    window.groups = apr_array_make(window.pool, 64, sizeof(ft_group_t));
+    window.nb_files = 0;
+    window.nb_processed = 0;
+    window.nb_head_dropped = window.nb_tail_dropped = window.nb_full_hashed = window.nb_full_cached = 0;
+    nb_kept = 0;
+    files = (ft_file_t **) napr_heap_drain_sorted(conf->heap, &nb_sorted);
+    window.nb_files_total = nb_sorted;
+
+    /* files of a size are contiguous, process them group by group */
+    for (i = 0; i < nb_sorted; i = j) {
+	file = files[i];
+	if (NULL == (fsize = napr_hash_search(conf->sizes, &file->size, 1, &hash_value))) {
+	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->name);
+	    if (NULL != workers)
+		ft_workers_destroy(workers);
+	    apr_pool_destroy(gc_pool);
+	    return APR_EGENERAL;
+	}
+	archived = 0;
+	for (j = i + 1; (j < nb_sorted) && (files[j]->size == fsize->val); j++) {
+#if HAVE_ARCHIVE
+	    if ((NULL != files[j]->subpath) || (NULL != file->subpath))
+		archived = 1;
+#endif
+	}
+
+	/* More than two files, we will need to checksum because :
+	 * - 1 file of a size means no twin.
+	 * - 2 files of a size means that anyway we must read the both, so
+	 *   we will probably cmp them at that time instead of running CPU
+	 *   intensive function like checksum.
+	 */
+	if (1 == fsize->nb_files) {
+	    /* No twin possible, remove the entry */
+	    /*DEBUG_DBG("only one file of size %"APR_OFF_T_FMT, fsize->val); */
+	    ft_conf_fsize_release(conf, fsize, hash_value);
+	    ft_conf_file_release(conf, file);
+	    if (is_option_set(conf->mask, OPTION_VERBO)) {
+		window.nb_processed++;
+		ft_window_display_progress(&window);
+	    }
+	    continue;
+	}
+
+	/* not from a pool, so that it is freed once the group is reported */
+	if ((NULL == fsize->chksum_array)
+	    && (NULL == (fsize->chksum_array = malloc(fsize->nb_files * sizeof(struct ft_chksum_t))))) {
+	    DEBUG_ERR("allocation failed");
+	    if (NULL != workers)
+		ft_workers_destroy(workers);
+	    apr_pool_destroy(gc_pool);
+	    return APR_ENOMEM;
+	}
+	if ((NULL != conf->cache) && (0 != fsize->val))
+	    for (k = i; k < j; k++)
+		ft_conf_file_lookup(conf, files[k], window.pool);
+	group = apr_array_push(window.groups);
+	group->fsize = fsize;
+	group->hash_value = hash_value;
+	group->files = files + i;
+	group->nb = group->nb_head = group->nb_tail = j - i;
+	group->statuses = apr_palloc(window.pool, group->nb * sizeof(apr_status_t));
+	group->archived = archived;
+	/* reading a block of an archived file means extracting it */
+	group->tiered = (fsize->val >= TIER_MIN_SIZE) && !archived;
+	group->nb_cached = 0;
+	group->lanes = 0;
+	group->tree = 0;
+	window.nb_files += group->nb;
+	if (window.nb_files >= window_size)
+	    ft_window_flush(conf, &window, workers, files, &nb_kept, job_pool);
+    }
+    ft_window_flush(conf, &window, workers, files, &nb_kept, job_pool);
+    if (NULL != workers)
+	ft_workers_destroy(workers);
+
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	ft_window_display_progress(&window);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Dropped by head block: %" APR_SIZE_T_FMT ", by tail block: %" APR_SIZE_T_FMT
+		", fully hashed: %" APR_SIZE_T_FMT ", from the cache: %" APR_SIZE_T_FMT "\n", window.nb_head_dropped,
+		window.nb_tail_dropped, window.nb_full_hashed, window.nb_full_cached);
+    }
+
+    apr_pool_destroy(gc_pool);
+    if (NULL == (tmp_heap = napr_heap_make_from_array(conf->pool, conf->file_cmp, (void **) files, nb_kept))) {
+	DEBUG_ERR("error calling napr_heap_make_from_array");
+	return APR_ENOMEM;
+    }
+    if (is_option_set(conf->mask, OPTION_STATS))
+	ft_heap_display_stats("files", conf->heap);
+    napr_heap_destroy(conf->heap);
+    conf->heap = tmp_heap;
+
+    return APR_SUCCESS;
+}
+
+static int chksum_cmp(const void *chksum1, const void *chksum2)
+{
+    const ft_chksum_t *chk1 = chksum1;
+    const ft_chksum_t *chk2 = chksum2;
+    int i;
+
+    if (0 == (i = memcmp(chk1->val_array, chk2->val_array, sizeof(chk1->val_array)))) {
+	return chk1->file->prioritized - chk2->file->prioritized;
+    }
+    else {
+	i <<= 1;
+    }
+
+    return i;
+}
+
+#if HAVE_PUZZLE
+
+static apr_status_t ft_conf_image_twin_report(ft_conf_t *conf)
+{
+    PuzzleContext context;
+    double d;
+    char pathbuf[APR_PATH_MAX], pathbuf_cmp[APR_PATH_MAX];
+    ft_file_t *file, *file_cmp;
+    const char *path, *path_cmp;
+    int i, heap_size;
+    unsigned char already_printed;
+
+    puzzle_init_context(&context);
+    puzzle_set_max_width(&context, 5000);
+    puzzle_set_max_height(&context, 5000);
+    puzzle_set_lambdas(&context, 13);
+
+    heap_size = napr_heap_size(conf->heap);
+    for (i = 0; i < heap_size; i++) {
+
+	file = napr_heap_get_nth(conf->heap, i);
+	puzzle_init_cvec(&context, &(file->cvec));
+	path = ft_file_path(file, pathbuf, sizeof(pathbuf));
+	if ((NULL != path) && (0 == puzzle_fill_cvec_from_file(&context, &(file->cvec), path))) {
+	    file->cvec_ok |= 0x1;
+	}
+	else {
+	    DEBUG_ERR("error calling puzzle_fill_cvec_from_file, ignoring file: %s", file->name);
+	}
+
+	if (is_option_set(conf->mask, OPTION_VERBO)) {
+	    fprintf(stderr, "\rProgress [%i/%i] %d%% ", i, heap_size, (int) ((float) i / (float) heap_size * 100.0));
+	}
+    }
+    if (is_option_set(conf->mask, OPTION_VERBO)) {
+	fprintf(stderr, "\rProgress [%i/%i] %d%% ", i, heap_size, (int) ((float) i / (float) heap_size * 100.0));
+	fprintf(stderr, "\n");
+    }
+
+    while (NULL != (file = napr_heap_extract(conf->heap))) {
+	if (!(file->cvec_ok & 0x1))
+	    continue;
+	already_printed = 0;
+	heap_size = napr_heap_size(conf->heap);
+	for (i = 0; i < heap_size; i++) {
+	    file_cmp = napr_heap_get_nth(conf->heap, i);
+	    if (!(file_cmp->cvec_ok & 0x1))
+		continue;
+
+	    d = puzzle_vector_normalized_distance(&context, &(file->cvec), &(file_cmp->cvec), 0);
+	    if ((d < conf->threshold) && (NULL != (path = ft_file_path(file, pathbuf, sizeof(pathbuf))))
+		&& (NULL != (path_cmp = ft_file_path(file_cmp, pathbuf_cmp, sizeof(pathbuf_cmp))))) {
+		if (!already_printed) {
+		    printf("%s%c", path, conf->sep);
+		    already_printed = 1;
+		}
+		else {
+		    printf("%c", conf->sep);
+		}
+		printf("%s", path_cmp);
+	    }
+	}
+
+	if (already_printed)
+	    printf("\n\n");
+
+	puzzle_free_cvec(&context, &(file->cvec));
+    }
+
+    puzzle_free_context(&context);
+
+    return APR_SUCCESS;
+}
+#endif
+
+/* print a file of a group of twins, its path in the archive too with --untar */
+static void ft_conf_twin_print(const ft_conf_t *conf, const ft_file_t *file, const char *path)
+{
+#if HAVE_ARCHIVE
+    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != file->subpath)) {
+	printf("%s%c%s", path, (':' != conf->sep) ? ':' : '|', file->subpath);
+	return;
+    }
+#endif
+    printf("%s", path);
+}
+
+/* a digest only found in the extended attribute of its file could be forged, it proves nothing */
+static int ft_chksum_forgeable(const ft_chksum_t *chksums, apr_size_t nb)
+{
+    apr_size_t n;
+
+    for (n = 0; n < nb; n++)
+	if ((NULL != chksums[n].file->cached) && (chksums[n].file->cached->flags & FT_CACHE_XATTR(FT_CACHE_FULL)))
+	    return 1;
+
+    return 0;
+}
+
+/*
+ * Report the twins among nb files of a same size and checksum: instead of
+ * comparing them two by two, which reads the first one again for each other,
+ * they are read all at once, see filecmp_group, then each content found more
+ * than once is printed as a group, its files in their order. If trusted, the
+ * checksum is a strong digest taken for their content, they are not read.
+ */
+static apr_status_t ft_conf_twin_group_report(ft_conf_t *conf, apr_off_t size, const ft_chksum_t *chksums, apr_size_t nb,
+					      int trusted, apr_pool_t *pool)
+{
+    char errbuf[128], pathbuf[APR_PATH_MAX];
+    const ft_file_t **files;
+    const char **paths, **fpaths, *path;
+    apr_status_t *statuses;
+    apr_size_t i, j, n;
+    int *classes;
+    apr_status_t status;
+    unsigned char already_printed;
+
+    files = apr_palloc(pool, nb * sizeof(const ft_file_t *));
+    paths = apr_palloc(pool, nb * sizeof(const char *));
+    fpaths = apr_palloc(pool, nb * sizeof(const char *));
+    classes = apr_palloc(pool, nb * sizeof(int));
+    statuses = apr_palloc(pool, nb * sizeof(apr_status_t));
+    for (i = 0, n = 0, status = APR_SUCCESS; i < nb; i++) {
+	if (NULL == (path = ft_file_path(chksums[i].file, pathbuf, sizeof(pathbuf)))) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "\nskipping %s because its path is too long\n", chksums[i].file->name);
+	    continue;
+	}
+	files[n] = chksums[i].file;
+	paths[n] = fpaths[n] = apr_pstrdup(pool, path);
+	classes[n] = 0;
+#if HAVE_ARCHIVE
+	/* an archived file is extracted once for the whole group */
+	if (!trusted && is_option_set(conf->mask, OPTION_UNTAR) && (NULL != files[n]->subpath)
+	    && (NULL == (fpaths[n] = ft_untar_file(chksums[i].file, pool)))) {
+	    DEBUG_ERR("error calling ft_untar_file");
+	    status = APR_EGENERAL;
+	    break;
+	}
+#endif
+	n++;
+    }
+    if ((APR_SUCCESS == status) && !trusted)
+	status = filecmp_group(pool, fpaths, (int) n, size, classes, statuses);
+#if HAVE_ARCHIVE
+    for (i = 0; i < n; i++)
+	if (fpaths[i] != paths[i])
+	    apr_file_remove(fpaths[i], pool);
+#endif
+    if (APR_SUCCESS != status) {
+	DEBUG_ERR("error calling filecmp_group: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
+    for (i = 0; i < n; i++) {
+	/*
+	 * no return status if != APR_SUCCESS , because : 
+	 * Fault-check has been removed in case files disappear
+	 * between collecting and comparing or special files (like
+	 * device or /proc) are tried to access
+	 */
+	if (0 > classes[i]) {
+	    if (is_option_set(conf->mask, OPTION_VERBO))
+		fprintf(stderr, "\nskipping %s comparison because: %s\n", paths[i], apr_strerror(statuses[i], errbuf, 128));
+	    continue;
+	}
+	if ((int) i != classes[i])
+	    continue;
+	already_printed = 0;
+	for (j = i + 1; j < n; j++) {
+	    if ((int) i != classes[j])
+		continue;
+	    if (!already_printed) {
+		if (is_option_set(conf->mask, OPTION_SIZED))
+		    printf("size [%" APR_OFF_T_FMT "]:\n", size);
+		if (is_option_set(conf->mask, OPTION_TRUST))
+		    printf("verified by %s:\n", trusted ? conf->digest->name : "comparison");
+		ft_conf_twin_print(conf, files[i], paths[i]);
+		already_printed = 1;
+	    }
+	    printf("%c", conf->sep);
+	    ft_conf_twin_print(conf, files[j], paths[j]);
+	    fflush(stdout);
+	}
+	if (already_printed)
+	    printf("\n\n");
+    }
+
+    return APR_SUCCESS;
 }
-#endif
 
 static apr_status_t ft_conf_twin_report(ft_conf_t *conf)
 {
     char errbuf[128];
     apr_off_t old_size = -1;
+    apr_pool_t *run_pool;
     ft_file_t *file;
     ft_fsize_t *fsize;
     apr_uint32_t hash_value;
     apr_size_t i, j;
-    int rv;
     apr_status_t status;
-    unsigned char already_printed;
     apr_uint32_t chksum_array_sz = 0U;
+    int trusted;
 
     if (is_option_set(conf->mask, OPTION_VERBO))
 	fprintf(stderr, "Reporting duplicate files:\n");
 
+    if (APR_SUCCESS != (status = apr_pool_create(&run_pool, conf->pool))) {
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return status;
+    }
+
     while (NULL != (file = napr_heap_extract(conf->heap))) {
-	if (file->size == old_size)
+	/* the group of this size has already been reported */
+	if (file->size == old_size) {
+	    ft_conf_file_release(conf, file);
 	    continue;
+	}
 
 	old_size = file->size;
 	if (NULL != (fsize = napr_hash_search(conf->sizes, &file->size, 1, &hash_value))) {
 	    chksum_array_sz = MIN(fsize->nb_files, fsize->nb_checksumed);
 	    qsort(fsize->chksum_array, chksum_array_sz, sizeof(ft_chksum_t), chksum_cmp);
-	    for (i = 0; i < fsize->nb_files; i++) {
-		if (NULL == fsize->chksum_array[i].file)
+	    for (i = 0; i < chksum_array_sz; i = j) {
+		for (j = i + 1; (j < chksum_array_sz)
+		     && (0 == memcmp(fsize->chksum_array[i].val_array, fsize->chksum_array[j].val_array,
+				     sizeof(fsize->chksum_array[i].val_array))); j++);
+		if (2 > j - i)
 		    continue;
-		already_printed = 0;
-		for (j = i + 1; j < fsize->nb_files; j++) {
-		    if (0 == memcmp(fsize->chksum_array[i].val_array, fsize->chksum_array[j].val_array, HASHSTATE)) {
-			char *fpathi, *fpathj;
-#if HAVE_ARCHIVE
-			if (is_option_set(conf->mask, OPTION_UNTAR)) {
-			    if (NULL != fsize->chksum_array[i].file->subpath) {
-				fpathi = ft_untar_file(fsize->chksum_array[i].file, conf->pool);
-				if (NULL == fpathi) {
-				    DEBUG_ERR("error calling ft_untar_file");
-				    return APR_EGENERAL;
-				}
-			    }
-			    else {
-				fpathi = fsize->chksum_array[i].file->path;
-			    }
-			    if (NULL != fsize->chksum_array[j].file->subpath) {
-				fpathj = ft_untar_file(fsize->chksum_array[j].file, conf->pool);
-				if (NULL == fpathj) {
-				    DEBUG_ERR("error calling ft_untar_file");
-				    return APR_EGENERAL;
-				}
-			    }
-			    else {
-				fpathj = fsize->chksum_array[j].file->path;
-			    }
-			}
-			else {
-			    fpathi = fsize->chksum_array[i].file->path;
-			    fpathj = fsize->chksum_array[j].file->path;
-			}
-#else
-			fpathi = fsize->chksum_array[i].file->path;
-			fpathj = fsize->chksum_array[j].file->path;
-#endif
-			status = filecmp(conf->pool, fpathi, fpathj, fsize->val, conf->excess_size, &rv);
-#if HAVE_ARCHIVE
-			if (is_option_set(conf->mask, OPTION_UNTAR)) {
-			    if (NULL != fsize->chksum_array[i].file->subpath)
-				apr_file_remove(fpathi, conf->pool);
-			    if (NULL != fsize->chksum_array[j].file->subpath)
-				apr_file_remove(fpathj, conf->pool);
-			}
-#endif
-			/*
-			 * no return status if != APR_SUCCESS , because : 
-			 * Fault-check has been removed in case files disappear
-			 * between collecting and comparing or special files (like
-			 * device or /proc) are tried to access
-			 */
-			if (APR_SUCCESS != status) {
-			    if (is_option_set(conf->mask, OPTION_VERBO))
-				fprintf(stderr, "\nskipping %s and %s comparison because: %s\n",
-					fsize->chksum_array[i].file->path, fsize->chksum_array[j].file->path,
-					apr_strerror(status, errbuf, 128));
-			    rv = 1;
-			}
-
-			if (0 == rv) {
-			    if (!already_printed) {
-				if (is_option_set(conf->mask, OPTION_SIZED))
-				    printf("size [%" APR_OFF_T_FMT "]:\n", fsize->val);
-#if HAVE_ARCHIVE
-				if (is_option_set(conf->mask, OPTION_UNTAR)
-				    && (NULL != fsize->chksum_array[i].file->subpath))
-				    printf("%s%c%s%c", fsize->chksum_array[i].file->path, (':' != conf->sep) ? ':' : '|',
-					   fsize->chksum_array[i].file->subpath, conf->sep);
-				else
-#endif
-				    printf("%s%c", fsize->chksum_array[i].file->path, conf->sep);
-				already_printed = 1;
-			    }
-			    else {
-				printf("%c", conf->sep);
-			    }
-#if HAVE_ARCHIVE
-			    if (is_option_set(conf->mask, OPTION_UNTAR) && (NULL != fsize->chksum_array[j].file->subpath))
-				printf("%s%c%s", fsize->chksum_array[j].file->path, (':' != conf->sep) ? ':' : '|',
-				       fsize->chksum_array[j].file->subpath);
-			    else
-#endif
-				printf("%s", fsize->chksum_array[j].file->path);
-			    /* mark j as a twin ! */
-			    fsize->chksum_array[j].file = NULL;
-			    fflush(stdout);
-			}
-		    }
-		    else {
-			/* hash are ordered, so at first mismatch we check the next */
-			break;
-		    }
+		/* the digest taken for the content, but for a sample of the groups */
+		trusted = is_option_set(conf->mask, OPTION_TRUST) && fsize->hashed
+		    && (fsize->chksum_array[i].val_array[0] % 100 >= conf->verify_rate)
+		    && !ft_chksum_forgeable(fsize->chksum_array + i, j - i);
+		status = ft_conf_twin_group_report(conf, fsize->val, fsize->chksum_array + i, j - i, trusted, run_pool);
+		apr_pool_clear(run_pool);
+		if (APR_SUCCESS != status) {
+		    apr_pool_destroy(run_pool);
+		    return status;
 		}
-		if (already_printed)
-		    printf("\n\n");
 	    }
+	    /* the other files of this size are released when extracted */
+	    ft_conf_fsize_release(conf, fsize, hash_value);
 	}
 	else {
-	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->path);
+	    DEBUG_ERR("inconsistency error found, no size[%" APR_OFF_T_FMT "] in hash for file %s", file->size, file->name);
+	    apr_pool_destroy(run_pool);
 	    return APR_EGENERAL;
 	}
+	ft_conf_file_release(conf, file);
+    }
+    apr_pool_destroy(run_pool);
+
+    return APR_SUCCESS;
+}
+
+static int ft_report_group_cmp(const void *param1, const void *param2)
+{
+    const ft_report_group_t *group1 = param1;
+    const ft_report_group_t *group2 = param2;
+    int rc;
+
+    /* same order as a single run, biggest files first */
+    if (group1->size != group2->size)
+	return (group1->size > group2->size) ? -1 : 1;
+    if (0 != (rc = memcmp(group1->text, group2->text, MIN(group1->len, group2->len))))
+	return rc;
+    if (group1->len != group2->len)
+	return (group1->len < group2->len) ? -1 : 1;
+
+    return 0;
+}
+
+static int ft_report_entry_cmp(const void *param1, const void *param2)
+{
+    return strcmp(*(char *const *) param1, *(char *const *) param2);
+}
+
+/*
+ * The order of the twins inside a group depends on the order they were
+ * collected in, sort them (prioritized ones first, as in ft_conf_twin_report)
+ * so that a group reads the same whatever the shard that found it.
+ */
+static void ft_report_group_normalize(const ft_conf_t *conf, ft_report_group_t *group, apr_pool_t *pool)
+{
+    apr_array_header_t *entries;
+    char *text, *entry, *p, *end, *out;
+    int i, nb_prioritized;
+
+    text = apr_pstrndup(pool, group->text, group->len);
+    end = text + group->len;
+    out = apr_palloc(pool, group->len + 1);
+    group->text = out;
+    if (-1 != group->size) {
+	/* keep the "size [...]:" line first */
+	p = strchr(text, '\n');
+	p = (NULL != p) ? p + 1 : end;
+	memcpy(out, text, p - text);
+	out += p - text;
+	text = p;
+    }
+    if (!strncmp(text, "verified by ", 12)) {
+	/* and the one of --trust-hash */
+	p = strchr(text, '\n');
+	p = (NULL != p) ? p + 1 : end;
+	memcpy(out, text, p - text);
+	out += p - text;
+	text = p;
+    }
+
+    entries = apr_array_make(pool, 16, sizeof(char *));
+    nb_prioritized = 0;
+    for (entry = text; entry < end; entry = p + 1) {
+	if (NULL == (p = memchr(entry, conf->sep, end - entry)))
+	    p = end;
+	*p = '\0';
+	APR_ARRAY_PUSH(entries, char *) = entry;
+	if ((NULL != conf->p_path) && !strncmp(entry, conf->p_path, conf->p_path_len)) {
+	    /* move it to the prioritized part, at the head */
+	    APR_ARRAY_IDX(entries, entries->nelts - 1, char *) = APR_ARRAY_IDX(entries, nb_prioritized, char *);
+	    APR_ARRAY_IDX(entries, nb_prioritized, char *) = entry;
+	    nb_prioritized++;
+	}
+    }
+    qsort(entries->elts, nb_prioritized, sizeof(char *), ft_report_entry_cmp);
+    qsort((char **) entries->elts + nb_prioritized, entries->nelts - nb_prioritized, sizeof(char *),
+	  ft_report_entry_cmp);
+
+    for (i = 0; i < entries->nelts; i++) {
+	entry = APR_ARRAY_IDX(entries, i, char *);
+	if (0 < i)
+	    *out++ = conf->sep;
+	memcpy(out, entry, strlen(entry));
+	out += strlen(entry);
+    }
+    group->len = out - group->text;
+}
+
+/**
+ * Merge the reports of several --shard runs into one, on the standard
+ * output. The groups are sorted by size (when displayed) then by content, so
+ * that the result only depends on the groups found, not on the number of
+ * shards nor on the order of the reports.
+ * @param conf The configuration, for the separator and the priority path.
+ * @param nb_reports Number of reports.
+ * @param reports Their filenames.
+ * @param pool Pool to read the reports in.
+ * @return APR_SUCCESS if no error occured.
+ */
+static apr_status_t ft_merge_reports(const ft_conf_t *conf, int nb_reports, const char **reports, apr_pool_t *pool)
+{
+    char errbuf[128];
+    apr_array_header_t *groups;
+    ft_report_group_t *group;
+    apr_finfo_t finfo;
+    apr_file_t *fd;
+    apr_status_t status;
+    apr_size_t len;
+    char *buf, *p, *end, *eog;
+    int i;
+
+    groups = apr_array_make(pool, 1024, sizeof(ft_report_group_t));
+    for (i = 0; i < nb_reports; i++) {
+	if (APR_SUCCESS != (status = apr_file_open(&fd, reports[i], APR_READ | APR_BINARY, APR_OS_DEFAULT, pool))) {
+	    DEBUG_ERR("error calling apr_file_open(%s): %s", reports[i], apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	if (APR_SUCCESS != (status = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd))) {
+	    DEBUG_ERR("error calling apr_file_info_get(%s): %s", reports[i], apr_strerror(status, errbuf, 128));
+	    apr_file_close(fd);
+	    return status;
+	}
+	buf = apr_palloc(pool, finfo.size + 1);
+	status = apr_file_read_full(fd, buf, finfo.size, &len);
+	apr_file_close(fd);
+	if ((APR_SUCCESS != status) && (APR_EOF != status)) {
+	    DEBUG_ERR("error calling apr_file_read_full(%s): %s", reports[i], apr_strerror(status, errbuf, 128));
+	    return status;
+	}
+	buf[len] = '\0';
+
+	/* groups are ended by an empty line, see ft_conf_twin_report */
+	for (p = buf, end = buf + len; p < end; p = eog + 2) {
+	    if (NULL == (eog = strstr(p, "\n\n")))
+		eog = end;
+	    if (eog == p)
+		continue;
+	    group = apr_array_push(groups);
+	    group->text = p;
+	    group->len = eog - p;
+	    group->size = -1;
+	    if (!strncmp(p, "size [", 6) && (APR_SUCCESS != apr_strtoff(&group->size, p + 6, NULL, 10)))
+		group->size = -1;
+	    ft_report_group_normalize(conf, group, pool);
+	}
+    }
+
+    qsort(groups->elts, groups->nelts, sizeof(ft_report_group_t), ft_report_group_cmp);
+    for (i = 0; i < groups->nelts; i++) {
+	group = &APR_ARRAY_IDX(groups, i, ft_report_group_t);
+	/* the same report given twice */
+	if ((0 < i) && (0 == ft_report_group_cmp(group - 1, group)))
+	    continue;
+	fwrite(group->text, 1, group->len, stdout);
+	printf("\n\n");
     }
 
     return APR_SUCCESS;
@@ -1023,38 +2359,58 @@ int main(int argc, const char **argv)
 {
     static const apr_getopt_option_t opt_option[] = {
 	{"case-unsensitive", 'c', FALSE, "this option applies to regex match."},
+	{"cache", 'C', TRUE, "\t\tfile keeping the digests of the files from one\n\t\t\t\trun to the next, created if needed."},
 	{"display-size", 'd', FALSE, "\tdisplay size before duplicates."},
+	{"drop-cache", 'D', FALSE, "\tdrop the files read from the page cache, not to\n\t\t\t\tevict what other processes use."},
 	{"regex-ignore-file", 'e', TRUE, "filenames that match this are ignored."},
 	{"follow-symlink", 'f', FALSE, "follow symbolic links."},
+	{"schedule", 'g', TRUE, "\torder of the size groups: size-desc (default),\n\t\t\t\tsavings-desc, cheapest-first or physical."},
 	{"help", 'h', FALSE, "\t\tdisplay usage."},
+	{"hash", 'H', TRUE, "\t\tdigest of the files: murmur3 (default), sha256\n\t\t\t\tor jenkins (ftwin <= 0.8.8)."},
 #if HAVE_PUZZLE
 	{"image-cmp", 'I', FALSE, "\twill run ftwin in image cmp mode (using libpuzzle)."},
 	{"image-threshold", 'T', TRUE,
 	 "will change the image similarity threshold\n\t\t\t\t (default is [1], accepted [2/3/4/5])."},
 #endif
 	{"ignore-list", 'i', TRUE, "\tcomma-separated list of file names to ignore."},
+	{"jobs", 'j', TRUE, "\t\tnumber of threads hashing the files, default: 1."},
+	{"shard", 'k', TRUE, "\t\tonly process the k-th slice of N of the sizes,\n\t\t\t\tgiven as k/N with k from 0 to N-1."},
+	{"kernel", 'K', TRUE, "\t\tforce the implementation of the hash and compare\n\t\t\t\tloops: generic or avx2, default: the fastest\n\t\t\t\tone the CPU supports."},
 	{"minimal-length", 'm', TRUE, "minimum size of file to process."},
+	{"merge", 'M', FALSE, "\t\tmerge the reports of --shard runs given as\n\t\t\t\tparameters, instead of files."},
 	{"optimize-memory", 'o', FALSE, "reduce memory usage, but increase process time."},
 	{"priority-path", 'p', TRUE, "\tfile in this path are displayed first when\n\t\t\t\tduplicates are reported."},
+	{"queue-depth", 'Q', TRUE, "\tdepth of the reads ahead, by io_uring or by\n\t\t\t\treader threads without it, 0 to read\n\t\t\t\tsynchronously, default: 8."},
 	{"recurse-subdir", 'r', FALSE, "recurse subdirectories."},
+	{"read-size", 'R', TRUE, "\tsize in bytes of the reads of files not mapped,\n\t\t\t\tdefault: 1048576."},
 	{"separator", 's', TRUE, "\tseparator character between twins, default: \\n."},
+	{"stats", 'S', FALSE, "\t\tdisplay statistics about internal structures."},
 #if HAVE_ARCHIVE
 	{"tar-cmp", 't', FALSE, "\twill process files archived in .tar default: off."},
 #endif
+	{"trust-hash", 'u', FALSE, "\ttake equal sha256 digests for equal contents,\n\t\t\t\tinstead of comparing the files."},
+	{"verify-rate", 'U', TRUE, "\tpercentage of the groups compared anyway with\n\t\t\t\t--trust-hash, default: 0."},
 	{"verbose", 'v', FALSE, "\tdisplay a progress bar."},
 	{"version", 'V', FALSE, "\tdisplay version."},
 	{"whitelist-regex-file", 'w', TRUE, "filenames that doesn't match this are ignored."},
 	{"excessive-size", 'x', TRUE, "excessive size of file that switch off mmap use."},
+	{"xattr", 'X', FALSE, "\t\tkeep the digests of the files in extended\n\t\t\t\tattributes, user.ftwin.<hash>, and use them."},
+	{"tree-size", 'z', TRUE, "\tsize in bytes from which segments of a file are\n\t\t\t\thashed by several jobs, default: 1073741824."},
 	{NULL, 0, 0, NULL},	/* end (a.k.a. sentinel) */
     };
     char errbuf[128];
     char *regex = NULL, *wregex = NULL, *arregex = NULL;
+    const char *cache_file = NULL;
     ft_conf_t conf;
+    const ft_kernel_t *kernel = NULL;
+    apr_size_t read_size = FT_READ_LEN;
+    unsigned long int read_depth = FT_READ_DEPTH;
+    int read_flags = 0;
     apr_getopt_t *os;
     apr_pool_t *pool, *gc_pool;
     apr_uint32_t hash_value;
     const char *optarg;
-    int optch, i;
+    int optch, i, digest_set = 0;
     apr_status_t status;
 
     if (APR_SUCCESS != (status = apr_initialize())) {
@@ -1075,7 +2431,18 @@ int main(int argc, const char **argv)
     }
 
     conf.pool = pool;
-    conf.heap = napr_heap_make(pool, ft_file_cmp);
+    conf.files = NULL;
+    conf.heap = NULL;
+    conf.file_cmp = ft_file_cmp;
+    conf.file_slab = napr_slab_make(pool, sizeof(struct ft_file_t), NAPR_SLAB_HUGEPAGE);
+    conf.fsize_slab = napr_slab_make(pool, sizeof(struct ft_fsize_t), 0);
+    conf.dir_slab = napr_slab_make(pool, sizeof(struct ft_dir_t), 0);
+    conf.path_slab = napr_slab_make(pool, 0, NAPR_SLAB_HUGEPAGE);
+    if ((NULL == conf.file_slab) || (NULL == conf.fsize_slab) || (NULL == conf.dir_slab) || (NULL == conf.path_slab)) {
+	DEBUG_ERR("error calling napr_slab_make");
+	apr_terminate();
+	return -1;
+    }
     conf.ig_files = napr_hash_str_make(pool, 32, 8);
     conf.sizes = napr_hash_make(pool, 4096, 8, ft_fsize_get_key, get_one, apr_uint32_key_cmp, apr_uint32_key_hash);
     conf.gids = napr_hash_make(pool, 4096, 8, ft_gids_get_key, get_one, apr_uint32_key_cmp, apr_uint32_key_hash);
@@ -1093,6 +2460,14 @@ int main(int argc, const char **argv)
     conf.sep = '\n';
     conf.excess_size = 50 * 1024 * 1024;
     conf.mask = 0x0000;
+    conf.schedule = SCHEDULE_SIZE_DESC;
+    conf.digest = &ft_digest_murmur3;
+    conf.cache = NULL;
+    conf.shard = 0;
+    conf.nb_shards = 1;
+    conf.nb_jobs = 1;
+    conf.tree_size = (apr_off_t) 1024 * 1024 * 1024;
+    conf.verify_rate = 0;
 #if HAVE_ARCHIVE
     conf.threshold = PUZZLE_CVEC_SIMILARITY_LOWER_THRESHOLD;
 #endif
@@ -1102,18 +2477,47 @@ int main(int argc, const char **argv)
 	case 'c':
 	    set_option(&conf.mask, OPTION_ICASE, 1);
 	    break;
+	case 'C':
+	    cache_file = optarg;
+	    break;
 	case 'd':
 	    set_option(&conf.mask, OPTION_SIZED, 1);
 	    break;
+	case 'D':
+	    read_flags |= FT_READ_DONTNEED;
+	    break;
 	case 'e':
 	    regex = apr_pstrdup(pool, optarg);
 	    break;
 	case 'f':
 	    set_option(&conf.mask, OPTION_FSYML, 1);
 	    break;
+	case 'g':
+	    if (!strcmp(optarg, "size-desc"))
+		conf.schedule = SCHEDULE_SIZE_DESC;
+	    else if (!strcmp(optarg, "savings-desc"))
+		conf.schedule = SCHEDULE_SAVINGS_DESC;
+	    else if (!strcmp(optarg, "cheapest-first"))
+		conf.schedule = SCHEDULE_CHEAPEST_FIRST;
+	    else if (!strcmp(optarg, "physical"))
+		conf.schedule = SCHEDULE_PHYSICAL;
+	    else {
+		DEBUG_ERR("can't parse %s for -g / --schedule", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'h':
 	    usage(argv[0], opt_option);
 	    return 0;
+	case 'H':
+	    if (NULL == (conf.digest = ft_digest_find(optarg))) {
+		DEBUG_ERR("can't parse %s for -H / --hash", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    digest_set = 1;
+	    break;
 	case 'i':
 	    ft_hash_add_ignore_list(conf.ig_files, optarg);
 	    break;
@@ -1148,6 +2552,37 @@ int main(int argc, const char **argv)
 	    }
 	    break;
 #endif
+	case 'j':
+	    conf.nb_jobs = strtoul(optarg, NULL, 10);
+	    if (0 == conf.nb_jobs) {
+		DEBUG_ERR("can't parse %s for -j / --jobs", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
+	case 'k':
+	    {
+		char *slash;
+
+		conf.shard = strtoul(optarg, &slash, 10);
+		if (('/' != *slash) || (0 == (conf.nb_shards = strtoul(slash + 1, NULL, 10)))
+		    || (conf.shard >= conf.nb_shards)) {
+		    DEBUG_ERR("can't parse %s for -k / --shard", optarg);
+		    apr_terminate();
+		    return -1;
+		}
+	    }
+	    break;
+	case 'M':
+	    set_option(&conf.mask, OPTION_MERGE, 1);
+	    break;
+	case 'K':
+	    if (NULL == (kernel = ft_kernel_find(optarg))) {
+		DEBUG_ERR("can't parse %s for -K / --kernel", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'm':
 	    conf.minsize = strtoul(optarg, NULL, 10);
 	    if (ULONG_MAX == conf.minsize) {
@@ -1163,18 +2598,48 @@ int main(int argc, const char **argv)
 	    conf.p_path = apr_pstrdup(pool, optarg);
 	    conf.p_path_len = strlen(conf.p_path);
 	    break;
+	case 'Q':
+	    read_depth = strtoul(optarg, NULL, 10);
+	    if ((ULONG_MAX == read_depth) || (4096 < read_depth)) {
+		DEBUG_ERR("can't parse %s for -Q / --queue-depth", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'r':
 	    set_option(&conf.mask, OPTION_RECSD, 1);
 	    break;
+	case 'R':
+	    read_size = strtoul(optarg, NULL, 10);
+	    if ((0 == read_size) || (ULONG_MAX == read_size)) {
+		DEBUG_ERR("can't parse %s for -R / --read-size", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 's':
 	    conf.sep = *optarg;
 	    break;
+	case 'S':
+	    set_option(&conf.mask, OPTION_STATS, 1);
+	    break;
 #if HAVE_ARCHIVE
 	case 't':
 	    set_option(&conf.mask, OPTION_UNTAR, 1);
 	    arregex = apr_pstrdup(pool, ".*(\\.tar)?\\.(gz|Z|bz2)$");
 	    break;
 #endif
+	case 'u':
+	    set_option(&conf.mask, OPTION_TRUST, 1);
+	    break;
+	case 'U':
+	    conf.verify_rate = strtoul(optarg, NULL, 10);
+	    if (100 < conf.verify_rate) {
+		DEBUG_ERR("can't parse %s for -U / --verify-rate", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	case 'v':
 	    set_option(&conf.mask, OPTION_VERBO, 1);
 	    break;
@@ -1192,9 +2657,79 @@ int main(int argc, const char **argv)
 		return -1;
 	    }
 	    break;
+	case 'X':
+#if !HAVE_XATTR
+	    DEBUG_ERR("-X / --xattr is not supported by this build");
+	    apr_terminate();
+	    return -1;
+#endif
+	    set_option(&conf.mask, OPTION_XATTR, 1);
+	    break;
+	case 'z':
+	    conf.tree_size = strtoul(optarg, NULL, 10);
+	    if ((0 == conf.tree_size) || (ULONG_MAX == conf.tree_size)) {
+		DEBUG_ERR("can't parse %s for -z / --tree-size", optarg);
+		apr_terminate();
+		return -1;
+	    }
+	    break;
 	}
     }
 
+    if (is_option_set(conf.mask, OPTION_TRUST) && !conf.digest->strong) {
+	if (digest_set) {
+	    DEBUG_ERR("-u / --trust-hash needs a collision resistant digest: -H sha256");
+	    apr_terminate();
+	    return -1;
+	}
+	conf.digest = &ft_digest_sha256;
+    }
+
+    if (APR_SUCCESS != ft_kernel_select(kernel)) {
+	DEBUG_ERR("the %s kernel is not supported by this CPU", kernel->name);
+	apr_terminate();
+	return -1;
+    }
+    if (is_option_set(conf.mask, OPTION_VERBO))
+	fprintf(stderr, "Using the %s kernel\n", ft_kernel_current()->name);
+    ft_file_read_setup(read_size, (unsigned int) read_depth, read_flags);
+
+    if (is_option_set(conf.mask, OPTION_MERGE)) {
+	if (os->ind == argc) {
+	    DEBUG_ERR("Please submit at least one report...");
+	    usage(argv[0], opt_option);
+	    return -1;
+	}
+	if (APR_SUCCESS != (status = ft_merge_reports(&conf, argc - os->ind, argv + os->ind, pool))) {
+	    DEBUG_ERR("error calling ft_merge_reports: %s", apr_strerror(status, errbuf, 128));
+	    apr_terminate();
+	    return -1;
+	}
+	apr_terminate();
+	return 0;
+    }
+#if HAVE_PUZZLE
+    /* similar images may have any size */
+    if (is_option_set(conf.mask, OPTION_PUZZL) && (1 < conf.nb_shards)) {
+	DEBUG_ERR("-k / --shard can't be used with -I / --image-cmp");
+	apr_terminate();
+	return -1;
+    }
+    if (is_option_set(conf.mask, OPTION_PUZZL) && ((NULL != cache_file) || is_option_set(conf.mask, OPTION_XATTR))) {
+	DEBUG_ERR("-C / --cache and -X / --xattr can't be used with -I / --image-cmp");
+	apr_terminate();
+	return -1;
+    }
+#endif
+
+    /* it is looked up as the files are collected, before any of them is read */
+    if (((NULL != cache_file) || is_option_set(conf.mask, OPTION_XATTR))
+	&& (APR_SUCCESS != (status = ft_cache_open(&conf.cache, cache_file, conf.digest, pool)))) {
+	DEBUG_ERR("error calling ft_cache_open: %s", apr_strerror(status, errbuf, 128));
+	apr_terminate();
+	return -1;
+    }
+
     if (APR_SUCCESS != (status = apr_uid_current(&(conf.userid), &(conf.groupid), pool))) {
 	DEBUG_ERR("error calling apr_uid_current: %s", apr_strerror(status, errbuf, 128));
 	apr_terminate();
@@ -1243,14 +2778,35 @@ int main(int argc, const char **argv)
 	apr_terminate();
 	return -1;
     }
+    conf.files = apr_array_make(gc_pool, 4096, sizeof(ft_file_t *));
     for (i = os->ind; i < argc; i++) {
-	if (APR_SUCCESS != (status = ft_conf_add_file(&conf, argv[i], gc_pool, NULL))) {
+	if (APR_SUCCESS != (status = ft_conf_add_file(&conf, argv[i], NULL, argv[i], gc_pool, NULL))) {
 	    DEBUG_ERR("error calling ft_conf_add_file: %s", apr_strerror(status, errbuf, 128));
 	    apr_terminate();
 	    return -1;
 	}
     }
+#if HAVE_PUZZLE
+    /* image twins are not grouped by size */
+    if (is_option_set(conf.mask, OPTION_PUZZL))
+	conf.schedule = SCHEDULE_SIZE_DESC;
+#endif
+    if (APR_SUCCESS != (status = ft_conf_schedule(&conf, gc_pool))) {
+	DEBUG_ERR("error calling ft_conf_schedule: %s", apr_strerror(status, errbuf, 128));
+	apr_terminate();
+	return -1;
+    }
+    /* Building the heap at once is O(n), where inserting each file is O(n lg n) */
+    conf.heap = napr_heap_make_from_array(pool, conf.file_cmp, (void **) conf.files->elts, conf.files->nelts);
+    conf.files = NULL;
     apr_pool_destroy(gc_pool);
+    if (NULL == conf.heap) {
+	DEBUG_ERR("error calling napr_heap_make_from_array");
+	apr_terminate();
+	return -1;
+    }
+    if (is_option_set(conf.mask, OPTION_STATS))
+	ft_hash_display_stats("sizes/walk", conf.sizes);
 
     if (0 < napr_heap_size(conf.heap)) {
 #if HAVE_PUZZLE
@@ -1277,9 +2833,28 @@ int main(int argc, const char **argv)
 		apr_terminate();
 		return status;
 	    }
+
+	    /* Step 4: Keep the digests for the next run, the twins are reported anyway */
+	    if (NULL != conf.cache) {
+		ft_cache_stats_t cache_stats;
+
+		if ((NULL != cache_file) && (APR_SUCCESS != (status = ft_cache_save(conf.cache))))
+		    DEBUG_ERR("error calling ft_cache_save: %s", apr_strerror(status, errbuf, 128));
+		ft_cache_get_stats(conf.cache, &cache_stats);
+		if (is_option_set(conf.mask, OPTION_VERBO) && (NULL != cache_file))
+		    fprintf(stderr, "Cache: %" APR_SIZE_T_FMT " hits, %" APR_SIZE_T_FMT " misses (%" APR_SIZE_T_FMT
+			    " stale), %" APR_SIZE_T_FMT " entries saved, %" APR_SIZE_T_FMT " dropped\n",
+			    cache_stats.nb_hits, cache_stats.nb_misses, cache_stats.nb_stale, cache_stats.nb_saved,
+			    cache_stats.nb_dropped);
+		if (is_option_set(conf.mask, OPTION_VERBO) && is_option_set(conf.mask, OPTION_XATTR))
+		    fprintf(stderr, "Extended attributes: %" APR_SIZE_T_FMT " read, %" APR_SIZE_T_FMT " written\n",
+			    cache_stats.nb_xattr_read, cache_stats.nb_xattr_written);
+	    }
 #if HAVE_PUZZLE
 	}
 #endif
+	if (is_option_set(conf.mask, OPTION_STATS))
+	    ft_conf_display_stats(&conf);
     }
     else {
 	DEBUG_ERR("Please submit at least two files...");
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "napr_dheap.h"
+
+#define INITIAL_MAX 256
+#define CACHE_LINE 64
+
+typedef struct napr_dheap_node_t
+{
+    apr_off_t key;
+    void *datum;
+} napr_dheap_node_t;
+
+struct napr_dheap_t
+{
+    apr_pool_t *pool;
+    /* what has been returned by posix_memalign */
+    void *mem;
+    /*
+     * tree[0] is the root, the children of position p are in
+     * [(p << shift) + 1, (p << shift) + arity], tree is shifted from mem by
+     * arity - 1 nodes in order to start each group of children on a cache
+     * line.
+     */
+    napr_dheap_node_t *tree;
+    unsigned int count, max;
+    unsigned int arity;
+    unsigned int shift;
+};
+
+static apr_status_t napr_dheap_cleanup(void *data)
+{
+    napr_dheap_t *heap = data;
+
+    free(heap->mem);
+    heap->mem = NULL;
+    heap->tree = NULL;
+
+    return APR_SUCCESS;
+}
+
+static int napr_dheap_reserve(napr_dheap_t *heap, unsigned int nb)
+{
+    void *mem;
+    unsigned int new_max;
+
+    if (heap->max >= nb)
+	return 0;
+
+    for (new_max = INITIAL_MAX; new_max < nb; new_max *= 2);
+
+    if (0 != posix_memalign(&mem, CACHE_LINE, (new_max + heap->arity - 1) * sizeof(napr_dheap_node_t))) {
+	DEBUG_ERR("allocation failed");
+	return -1;
+    }
+    if (NULL != heap->mem)
+	memcpy((napr_dheap_node_t *) mem + heap->arity - 1, heap->tree, heap->count * sizeof(napr_dheap_node_t));
+    free(heap->mem);
+    heap->mem = mem;
+    heap->tree = (napr_dheap_node_t *) mem + heap->arity - 1;
+    heap->max = new_max;
+
+    return 0;
+}
+
+napr_dheap_t *napr_dheap_make(apr_pool_t *pool, unsigned int arity)
+{
+    napr_dheap_t *heap;
+    apr_pool_t *local_pool;
+    apr_status_t status;
+
+    if ((2 != arity) && (4 != arity) && (8 != arity)) {
+	DEBUG_ERR("unsupported arity %u", arity);
+	return NULL;
+    }
+
+    if (APR_SUCCESS != (status = apr_pool_create(&local_pool, pool))) {
+	char errbuf[128];
+	DEBUG_ERR("error calling apr_pool_create: %s", apr_strerror(status, errbuf, 128));
+	return NULL;
+    }
+
+    heap = apr_pcalloc(local_pool, sizeof(struct napr_dheap_t));
+    heap->pool = local_pool;
+    heap->arity = arity;
+    for (heap->shift = 0; (1U << heap->shift) < arity; heap->shift++);
+    apr_pool_cleanup_register(local_pool, heap, napr_dheap_cleanup, apr_pool_cleanup_null);
+
+    if (0 != napr_dheap_reserve(heap, INITIAL_MAX)) {
+	apr_pool_destroy(local_pool);
+	return NULL;
+    }
+
+    return heap;
+}
+
+void napr_dheap_destroy(napr_dheap_t *heap)
+{
+    apr_pool_destroy(heap->pool);
+}
+
+int napr_dheap_insert(napr_dheap_t *heap, apr_off_t key, void *datum)
+{
+    napr_dheap_node_t *tree;
+    unsigned int ipos, ppos;
+
+    if ((heap->max <= heap->count) && (0 != napr_dheap_reserve(heap, heap->count + 1))) {
+	DEBUG_ERR("error calling napr_dheap_reserve");
+	return -1;
+    }
+
+    /* move the hole up instead of swapping */
+    tree = heap->tree;
+    ipos = heap->count;
+    while (ipos > 0) {
+	ppos = (ipos - 1) >> heap->shift;
+	if (tree[ppos].key >= key)
+	    break;
+	tree[ipos] = tree[ppos];
+	ipos = ppos;
+    }
+    tree[ipos].key = key;
+    tree[ipos].datum = datum;
+    heap->count++;
+
+    return 0;
+}
+
+void *napr_dheap_extract(napr_dheap_t *heap, apr_off_t *key)
+{
+    napr_dheap_node_t *tree, last;
+    unsigned int ipos, cpos, mpos, end;
+    void *ret;
+
+    if (0 == heap->count)
+	return NULL;
+
+    tree = heap->tree;
+    ret = tree[0].datum;
+    if (NULL != key)
+	*key = tree[0].key;
+
+    heap->count--;
+    last = tree[heap->count];
+
+    /* move the hole down to the place of the last element */
+    ipos = 0;
+    while (1) {
+	cpos = (ipos << heap->shift) + 1;
+	if (cpos >= heap->count)
+	    break;
+	end = cpos + heap->arity;
+	if (end > heap->count)
+	    end = heap->count;
+	for (mpos = cpos++; cpos < end; cpos++) {
+	    if (tree[cpos].key > tree[mpos].key)
+		mpos = cpos;
+	}
+	if (tree[mpos].key <= last.key)
+	    break;
+	tree[ipos] = tree[mpos];
+	ipos = mpos;
+    }
+    tree[ipos] = last;
+
+    return ret;
+}
+
+void *napr_dheap_top(const napr_dheap_t *heap, apr_off_t *key)
+{
+    if (0 == heap->count)
+	return NULL;
+
+    if (NULL != key)
+	*key = heap->tree[0].key;
+
+    return heap->tree[0].datum;
+}
+
+unsigned int napr_dheap_size(const napr_dheap_t *heap)
+{
+    return heap->count;
+}
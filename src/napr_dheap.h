@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file napr_dheap.h
+ * @brief d-ary heap with inline keys.
+ *
+ * Same job as napr_heap (return the highest element of a set), but the sort
+ * key (e.g. a file size) is stored next to the pointer, so sifting compares
+ * keys without dereferencing data nor calling a callback, and the d children
+ * of a node lie in the same cache line (4-ary) or two (8-ary).
+ */
+#ifndef NAPR_DHEAP_H
+#define NAPR_DHEAP_H
+
+#include <apr.h>
+#include <apr_pools.h>
+
+typedef struct napr_dheap_t napr_dheap_t;
+
+/**
+ * Make a new d-ary heap structure.
+ * @param pool The associated pool.
+ * @param arity The number of children of each node: 2, 4 or 8.
+ * @return Return a pointer to a newly allocated heap NULL if an error occured.
+ */
+napr_dheap_t *napr_dheap_make(apr_pool_t *pool, unsigned int arity);
+
+/**
+ * Deallocate the heap.
+ * @param heap The heap you are working with.
+ */
+void napr_dheap_destroy(napr_dheap_t *heap);
+
+/**
+ * Insert an element in the heap.
+ * @param heap The heap you are working with.
+ * @param key The key used to order the element, the highest comes first.
+ * @param datum The datum you want to insert.
+ * @return 0 if no error occured, -1 otherwise.
+ */
+int napr_dheap_insert(napr_dheap_t *heap, apr_off_t key, void *datum);
+
+/**
+ * Extract the element of the heap which has the highest key.
+ * @param heap The heap you are working with.
+ * @param key If not NULL, will be filled with the key of the element.
+ * @return The element, NULL if the heap is empty.
+ */
+void *napr_dheap_extract(napr_dheap_t *heap, apr_off_t *key);
+
+/**
+ * Get the element of the heap which has the highest key, without removing it.
+ * @param heap The heap you are working with.
+ * @param key If not NULL, will be filled with the key of the element.
+ * @return The element, NULL if the heap is empty.
+ */
+void *napr_dheap_top(const napr_dheap_t *heap, apr_off_t *key);
+
+/**
+ * Get the number of elements in the heap.
+ * @param heap The heap you are working with.
+ * @return The number of elements.
+ */
+unsigned int napr_dheap_size(const napr_dheap_t *heap);
+
+#endif /* NAPR_DHEAP_H */
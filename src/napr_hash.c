@@ -73,6 +73,10 @@ struct napr_hash_t
 
     /* the number of element contained in all the buckets of the table */
     apr_size_t nel;
+    /* the number of times the table has been rebuilt */
+    apr_size_t nb_rebuilds;
+    /* the number of bytes allocated in own_pool */
+    apr_size_t bytes;
     /* the number of buckets */
     apr_size_t size;
     /* desired density */
@@ -130,6 +134,7 @@ extern napr_hash_t *napr_hash_make(apr_pool_t *pool, apr_size_t nel, apr_size_t
 	DEBUG_ERR("allocation error");
 	return NULL;
     }
+    result->bytes = result->size * (sizeof(void **) + sizeof(apr_size_t));
 
     return result;
 }
@@ -193,6 +198,8 @@ static inline apr_status_t napr_hash_rebuild(napr_hash_t *hash)
     hash->size = tmp->size;
     hash->mask = tmp->mask;
     hash->power = tmp->power;
+    hash->bytes = tmp->bytes;
+    hash->nb_rebuilds++;
     apr_pool_destroy(hash->own_pool);
     hash->own_pool = tmp->own_pool;
 
@@ -240,6 +247,7 @@ extern apr_status_t napr_hash_set(napr_hash_t *hash, void *data, apr_uint32_t ha
 
     if ((0 == (nel = hash->filling_table[bucket])) & (NULL == hash->table[bucket])) {
 	hash->table[bucket] = (void **) apr_pcalloc(hash->own_pool, hash->ffactor * sizeof(void *));
+	hash->bytes += hash->ffactor * sizeof(void *);
     }
     // DEBUG_DBG( "set data %.*s in bucket %u at nel %u", hash->datum_get_key_len(data), hash->datum_get_key(data), bucket, nel);
     hash->table[bucket][nel] = data;
@@ -294,6 +302,27 @@ extern apr_size_t napr_hash_get_nel(const napr_hash_t *hash)
     return hash->nel;
 }
 
+extern void napr_hash_get_stats(const napr_hash_t *hash, napr_hash_stats_t *stats)
+{
+    apr_size_t i;
+
+    memset(stats, 0, sizeof(napr_hash_stats_t));
+    stats->nel = hash->nel;
+    stats->size = hash->size;
+    stats->nb_rebuilds = hash->nb_rebuilds;
+    stats->bytes = hash->bytes;
+
+    for (i = 0; i < hash->size; i++) {
+	if (0 != hash->filling_table[i]) {
+	    stats->used++;
+	    if (hash->filling_table[i] > stats->max_chain)
+		stats->max_chain = hash->filling_table[i];
+	}
+    }
+    if (0 != stats->used)
+	stats->avg_chain = (double) hash->nel / (double) stats->used;
+}
+
 apr_pool_t *napr_hash_pool_get(const napr_hash_t *thehash)
 {
     return thehash->pool;
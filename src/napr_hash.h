@@ -28,6 +28,20 @@ typedef int (key_cmp_callback_fn_t) (const void *, const void *, apr_size_t);
 typedef apr_uint32_t (hash_callback_fn_t) (register const void *, register apr_size_t);
 typedef apr_status_t (function_callback_fn_t) (const void *, void *);
 
+/**
+ * Internal figures of a hash table, to tune nel and ffactor.
+ */
+typedef struct napr_hash_stats_t
+{
+    apr_size_t nel;		/* number of elements */
+    apr_size_t size;		/* number of buckets */
+    apr_size_t used;		/* number of non-empty buckets */
+    apr_size_t max_chain;	/* number of elements of the fullest bucket */
+    double avg_chain;		/* average number of elements of non-empty buckets */
+    apr_size_t nb_rebuilds;	/* number of times the table has grown */
+    apr_size_t bytes;		/* bytes allocated in the own pool of the table */
+} napr_hash_stats_t;
+
 /** 
  * Create a hash table with a custom hash function.
  * @param pool The pool to allocate the hash table out of
@@ -78,6 +92,14 @@ apr_status_t napr_hash_apply_function(const napr_hash_t *hash, function_callback
 apr_size_t napr_hash_get_size(const napr_hash_t *hash);
 apr_size_t napr_hash_get_nel(const napr_hash_t *hash);
 
+/**
+ * Fill a napr_hash_stats_t with the figures of a hash table.
+ * @param hash The hash table your working on.
+ * @param stats The structure to fill.
+ * @remark This walks all the buckets, it is not meant to be called often.
+ */
+void napr_hash_get_stats(const napr_hash_t *hash, napr_hash_stats_t *stats);
+
 /**
  * Get a pointer to the pool which the hash table was created in.
  */
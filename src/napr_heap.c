@@ -14,8 +14,8 @@
  * limitations under the License.
  */
 
-#ifndef HAVE_APR
 #include <stdlib.h>
+#ifndef HAVE_APR
 #include <pthread.h>
 #else
 #include <apr_thread_mutex.h>
@@ -46,6 +46,7 @@ struct napr_heap_t
     napr_heap_del_callback_fn_t *del;
 #endif
     unsigned int count, max;
+    unsigned int peak, nb_reallocs;
     int mutex_set;		/* true (i.e. 1) if napr_heap_make_r has been
 				   called instead of non-reentrant function */
 };
@@ -58,6 +59,18 @@ apr_pool_t *napr_heap_get_allocator(const napr_heap_t *heap)
 }
 #endif
 
+#ifdef HAVE_APR
+static apr_status_t napr_heap_tree_cleanup(void *data)
+{
+    napr_heap_t *heap = data;
+
+    free(heap->tree);
+    heap->tree = NULL;
+
+    return APR_SUCCESS;
+}
+#endif
+
 napr_heap_t *napr_heap_make(
 #ifdef HAVE_APR
 			       apr_pool_t *pool,
@@ -75,7 +88,18 @@ napr_heap_t *napr_heap_make(
     if (APR_SUCCESS == (apr_pool_create(&local_pool, pool))) {
 	heap = apr_palloc(local_pool, sizeof(napr_heap_t));
 	heap->pool = local_pool;
-	heap->tree = (void **) apr_pcalloc(local_pool, sizeof(void *) * INITIAL_MAX);
+	/*
+	 * The tree is not taken from the pool, because a pool can't give back
+	 * memory: each growth would abandon the previous array until the heap
+	 * is destroyed. Use realloc instead and free it along with the pool.
+	 */
+	if (NULL != (heap->tree = (void **) calloc(INITIAL_MAX, sizeof(void *)))) {
+	    apr_pool_cleanup_register(local_pool, heap, napr_heap_tree_cleanup, apr_pool_cleanup_null);
+	}
+	else {
+	    apr_pool_destroy(local_pool);
+	    heap = NULL;
+	}
     }
 #else /* !HAVE_APR */
     if (NULL != (heap = malloc(sizeof(napr_heap_t)))) {
@@ -89,6 +113,8 @@ napr_heap_t *napr_heap_make(
     if (NULL != heap) {
 	heap->max = INITIAL_MAX;
 	heap->count = 0;
+	heap->peak = 0;
+	heap->nb_reallocs = 0;
 	heap->cmp = cmp;
 	heap->mutex_set = 0;
 #ifdef HAVE_APR
@@ -119,38 +145,85 @@ void napr_heap_destroy(napr_heap_t *heap)
 #endif
 }
 
-int napr_heap_insert(napr_heap_t *heap, void *datum)
+/*
+ * Make room for at least nb elements, reallocation by power of 2.
+ */
+static int napr_heap_reserve(napr_heap_t *heap, unsigned int nb)
 {
     void **tmp;
-    unsigned int ipos, ppos;
+    unsigned int new_max;
 
-    if (heap->max <= heap->count) {
-	/*
-	 * reallocation by power of 2:
-	 */
-	unsigned int new_max;
+    if (heap->max >= nb)
+	return 0;
 
-	for (new_max = 1; new_max <= heap->max; new_max *= 2);
+    for (new_max = 1; new_max < nb; new_max *= 2);
 
-#ifdef HAVE_APR
-	tmp = apr_palloc(heap->pool, new_max * sizeof(void *));
-#else
-	tmp = realloc(heap->tree, new_max * sizeof(void *));
-#endif
-	if (NULL != tmp) {
-#ifdef HAVE_APR
-	    memcpy(tmp, (heap->tree), (heap->count) * sizeof(void *));
-#endif
-	    memset((tmp + (heap->count)), 0, (new_max - (heap->count + 1)) * sizeof(void *));
-	    heap->tree = tmp;
-	    heap->max = new_max;
+    if (NULL != (tmp = realloc(heap->tree, new_max * sizeof(void *)))) {
+	memset((tmp + (heap->count)), 0, (new_max - heap->count) * sizeof(void *));
+	heap->tree = tmp;
+	heap->max = new_max;
+	heap->nb_reallocs++;
+    }
+    else {
+	DEBUG_ERR("allocation failed");
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Move down the element at position ipos until both of its children are
+ * smaller, considering only the count first elements of tree.
+ */
+static void napr_heap_sift_down(void **tree, unsigned int count, unsigned int ipos, napr_heap_cmp_callback_fn_t *cmp)
+{
+    void *tmp;
+    unsigned int rpos, lpos, mpos;
+
+    while (1) {
+	lpos = NAPR_HEAP_LEFT(ipos);
+	rpos = NAPR_HEAP_RIGHT(ipos);
+
+	if (lpos < count) {
+	    if (cmp(tree[lpos], tree[ipos]) > 0) {
+		mpos = lpos;
+	    }
+	    else {
+		mpos = ipos;
+	    }
+	    if ((rpos < count) && (cmp(tree[rpos], tree[mpos])) > 0) {
+		mpos = rpos;
+	    }
+	}
+	else {
+	    mpos = ipos;
+	}
+
+	if (mpos != ipos) {
+	    /*
+	     * Swap the choosen children with the current node
+	     */
+	    tmp = tree[mpos];
+	    tree[mpos] = tree[ipos];
+	    tree[ipos] = tmp;
+	    ipos = mpos;
 	}
 	else {
-	    heap->tree = NULL;
-	    DEBUG_ERR("allocation failed");
-	    return -1;
+	    break;
 	}
     }
+}
+
+int napr_heap_insert(napr_heap_t *heap, void *datum)
+{
+    void *tmp;
+    unsigned int ipos, ppos;
+
+    if ((heap->max <= heap->count) && (0 != napr_heap_reserve(heap, heap->count + 1))) {
+	DEBUG_ERR("error calling napr_heap_reserve");
+	return -1;
+    }
 
     /*
      * insertion of the datum after the last one of the tree...
@@ -173,14 +246,15 @@ int napr_heap_insert(napr_heap_t *heap, void *datum)
     }
 
     heap->count++;
+    if (heap->count > heap->peak)
+	heap->peak = heap->count;
 
     return 0;
 }
 
 void *napr_heap_extract(napr_heap_t *heap)
 {
-    void *ret = NULL, *tmp;
-    unsigned int ipos, rpos, lpos, mpos;
+    void *ret = NULL;
 
     if ((0 != heap->count) && (NULL != heap->tree)) {
 	/* keep the value to return */
@@ -189,45 +263,83 @@ void *napr_heap_extract(napr_heap_t *heap)
 	heap->tree[0] = heap->tree[heap->count - 1];
 	heap->tree[heap->count - 1] = NULL;
 	heap->count--;
-	ipos = 0;
-
-	while (1) {
-	    lpos = NAPR_HEAP_LEFT(ipos);
-	    rpos = NAPR_HEAP_RIGHT(ipos);
-
-	    if (lpos < heap->count) {
-		if (heap->cmp(heap->tree[lpos], heap->tree[ipos]) > 0) {
-		    mpos = lpos;
-		}
-		else {
-		    mpos = ipos;
-		}
-		if ((rpos < heap->count) && (heap->cmp(heap->tree[rpos], heap->tree[mpos])) > 0) {
-		    mpos = rpos;
-		}
-	    }
-	    else {
-		mpos = ipos;
-	    }
-
-	    if (mpos != ipos) {
-		/*
-		 * Swap the choosen children with the current node
-		 */
-		tmp = heap->tree[mpos];
-		heap->tree[mpos] = heap->tree[ipos];
-		heap->tree[ipos] = tmp;
-		ipos = mpos;
-	    }
-	    else {
-		break;
-	    }
-	}
+	napr_heap_sift_down(heap->tree, heap->count, 0, heap->cmp);
     }
 
     return ret;
 }
 
+napr_heap_t *napr_heap_make_from_array(
+#ifdef HAVE_APR
+					  apr_pool_t *pool,
+#endif
+					  napr_heap_cmp_callback_fn_t *cmp,
+#ifndef HAVE_APR		/* !HAVE_APR */
+					  napr_heap_del_callback_fn_t *del,
+#endif
+					  void **array, unsigned int nb)
+{
+    napr_heap_t *heap;
+    unsigned int i;
+
+    if (NULL == (heap = napr_heap_make(
+#ifdef HAVE_APR
+					  pool,
+#endif
+					  cmp
+#ifndef HAVE_APR		/* !HAVE_APR */
+					  , del
+#endif
+		 )))
+	return NULL;
+
+    if (0 != napr_heap_reserve(heap, nb)) {
+	DEBUG_ERR("error calling napr_heap_reserve");
+	napr_heap_destroy(heap);
+	return NULL;
+    }
+
+    if (0 < nb) {
+	memcpy(heap->tree, array, nb * sizeof(void *));
+	heap->count = nb;
+	heap->peak = nb;
+
+	/* Floyd: leaves are already heaps, fix every inner node bottom-up */
+	for (i = nb / 2; i > 0; i--)
+	    napr_heap_sift_down(heap->tree, nb, i - 1, cmp);
+    }
+
+    return heap;
+}
+
+void **napr_heap_drain_sorted(napr_heap_t *heap, unsigned int *nb)
+{
+    void *tmp;
+    unsigned int i, j;
+
+    *nb = heap->count;
+    if (NULL == heap->tree)
+	return NULL;
+
+    /* heapsort: move the highest element at the end of the shrinking heap */
+    for (i = heap->count; i > 1; i--) {
+	tmp = heap->tree[0];
+	heap->tree[0] = heap->tree[i - 1];
+	heap->tree[i - 1] = tmp;
+	napr_heap_sift_down(heap->tree, i - 1, 0, heap->cmp);
+    }
+
+    /* then reverse it, so elements come in the napr_heap_extract order */
+    for (i = 0, j = heap->count; i + 1 < j; i++, j--) {
+	tmp = heap->tree[i];
+	heap->tree[i] = heap->tree[j - 1];
+	heap->tree[j - 1] = tmp;
+    }
+    heap->count = 0;
+
+    return heap->tree;
+}
+
 void *napr_heap_get_nth(const napr_heap_t *heap, unsigned int n)
 {
     if ((n < heap->count) && (NULL != heap->tree))
@@ -285,21 +397,26 @@ napr_heap_t *napr_heap_make_r(
 
 int napr_heap_insert_r(napr_heap_t *heap, void *datum)
 {
-    int rc;
+    int rc, rc_unlock;
 
     if (1 == heap->mutex_set) {
 #ifdef HAVE_APR
 	if (APR_SUCCESS == (rc = apr_thread_mutex_lock(heap->mutex))) {
-	    if (0 == (rc = napr_heap_insert(heap, datum)))
-		rc = apr_thread_mutex_unlock(heap->mutex);
+	    rc = napr_heap_insert(heap, datum);
+	    /* unlock even if the insertion failed */
+	    if (APR_SUCCESS != (rc_unlock = apr_thread_mutex_unlock(heap->mutex))) {
+		DEBUG_ERR("unlocking failed");
+		rc = rc_unlock;
+	    }
 	}
 	else {
 	    DEBUG_ERR("locking failed");
 	}
 #else
 	if (0 == (rc = pthread_mutex_lock(&heap->mutex))) {
-	    if (0 == (rc = napr_heap_insert(heap, datum)))
-		rc = pthread_mutex_unlock(&heap->mutex);
+	    rc = napr_heap_insert(heap, datum);
+	    if (0 != (rc_unlock = pthread_mutex_unlock(&heap->mutex)))
+		rc = rc_unlock;
 	}
 #endif
     }
@@ -317,20 +434,19 @@ void *napr_heap_extract_r(napr_heap_t *heap)
     if (1 == heap->mutex_set) {
 #ifdef HAVE_APR
 	if (APR_SUCCESS == apr_thread_mutex_lock(heap->mutex)) {
-	    if (NULL != (result = napr_heap_extract(heap)))
-		if (APR_SUCCESS != apr_thread_mutex_unlock(heap->mutex)) {
-		    DEBUG_ERR("unlocking failed");
-		    result = NULL;
-		}
+	    result = napr_heap_extract(heap);
+	    /* unlock even if the heap was empty */
+	    if (APR_SUCCESS != apr_thread_mutex_unlock(heap->mutex))
+		DEBUG_ERR("unlocking failed");
 	}
 	else {
 	    DEBUG_ERR("locking failed");
 	}
 #else
 	if (0 == pthread_mutex_lock(&heap->mutex)) {
-	    if (NULL != (result = napr_heap_extract(heap)))
-		if (0 != pthread_mutex_unlock(&heap->mutex))
-		    result = NULL;
+	    result = napr_heap_extract(heap);
+	    if (0 != pthread_mutex_unlock(&heap->mutex))
+		DEBUG_ERR("unlocking failed");
 	}
 #endif
     }
@@ -338,6 +454,15 @@ void *napr_heap_extract_r(napr_heap_t *heap)
     return result;
 }
 
+void napr_heap_get_stats(const napr_heap_t *heap, napr_heap_stats_t *stats)
+{
+    stats->count = heap->count;
+    stats->peak = heap->peak;
+    stats->max = heap->max;
+    stats->nb_reallocs = heap->nb_reallocs;
+    stats->bytes = (unsigned long) heap->max * sizeof(void *);
+}
+
 void napr_heap_set_display_cb(napr_heap_t *heap, napr_heap_display_callback_fn_t display)
 {
     heap->display = display;
@@ -22,6 +22,18 @@ typedef int (napr_heap_cmp_callback_fn_t) (const void *, const void *);
 typedef void (napr_heap_display_callback_fn_t) (const void *);
 typedef void (napr_heap_del_callback_fn_t) (void *);
 
+/**
+ * Internal figures of a heap.
+ */
+typedef struct napr_heap_stats_t
+{
+    unsigned int count;		/* number of elements */
+    unsigned int peak;		/* highest number of elements seen */
+    unsigned int max;		/* number of allocated slots */
+    unsigned int nb_reallocs;	/* number of times the slots have grown */
+    unsigned long bytes;	/* bytes allocated for the slots */
+} napr_heap_stats_t;
+
 
 #ifdef HAVE_APR
 #include <apr_pools.h>
@@ -53,6 +65,19 @@ napr_heap_t *napr_heap_make(apr_pool_t *pool, napr_heap_cmp_callback_fn_t *cmp);
  */
 napr_heap_t *napr_heap_make_r(apr_pool_t *pool, napr_heap_cmp_callback_fn_t *cmp);
 
+/**
+ * Make a new heap filled with the elements of an array, the heap is built in
+ * a complexity of O(n) (Floyd) instead of O(n lg n) for n napr_heap_insert.
+ * @param pool The associated pool.
+ * @param cmp The function that compare two elements to return the smallest.
+ * @param array The elements to put in the heap, the array is copied and can be
+ * released once the heap is made.
+ * @param nb The number of elements in array.
+ * @return Return a pointer to a newly allocated heap NULL if an error occured.
+ */
+napr_heap_t *napr_heap_make_from_array(apr_pool_t *pool, napr_heap_cmp_callback_fn_t *cmp, void **array,
+				       unsigned int nb);
+
 #else /* !HAVE_APR */
 /**
  * Make a new heap structure, a heap is a structure that is able to return the
@@ -72,6 +97,19 @@ napr_heap_t *napr_heap_make(napr_heap_cmp_callback_fn_t *cmp, napr_heap_del_call
  * @return Return a pointer to a newly allocated heap NULL if an error occured.
  */
 napr_heap_t *napr_heap_make_r(napr_heap_cmp_callback_fn_t *cmp, napr_heap_del_callback_fn_t *del);
+
+/**
+ * Make a new heap filled with the elements of an array, the heap is built in
+ * a complexity of O(n) (Floyd) instead of O(n lg n) for n napr_heap_insert.
+ * @param cmp The function that compare two elements to return the smallest.
+ * @param del The function that destroy (de-allocate) an element.
+ * @param array The elements to put in the heap, the array is copied and can be
+ * released once the heap is made.
+ * @param nb The number of elements in array.
+ * @return Return a pointer to a newly allocated heap NULL if an error occured.
+ */
+napr_heap_t *napr_heap_make_from_array(napr_heap_cmp_callback_fn_t *cmp, napr_heap_del_callback_fn_t *del,
+				       void **array, unsigned int nb);
 #endif /* HAVE_APR */
 
 /**
@@ -100,6 +138,18 @@ int napr_heap_insert(napr_heap_t *heap, void *datum);
  */
 void *napr_heap_extract(napr_heap_t *heap);
 
+/**
+ * Sort in place (heapsort) all the elements of the heap and hand back the
+ * internal array, without copying it, the heap is left empty.
+ * @param heap The heap you are working with.
+ * @param nb Will be filled with the number of elements in the array.
+ * @return The array of elements, in the same order than successive calls to
+ * napr_heap_extract would have returned them.
+ * @remark The array still belongs to the heap: it is valid until the heap is
+ * destroyed or something is inserted in it.
+ */
+void **napr_heap_drain_sorted(napr_heap_t *heap, unsigned int *nb);
+
 /**
  * Get the nth element element in the heap.
  * @param heap The heap you are working with.
@@ -141,6 +191,13 @@ int napr_heap_insert_r(napr_heap_t *heap, void *datum);
  */
 void *napr_heap_extract_r(napr_heap_t *heap);
 
+/**
+ * Fill a napr_heap_stats_t with the figures of a heap.
+ * @param heap The heap you are working with.
+ * @param stats The structure to fill.
+ */
+void napr_heap_get_stats(const napr_heap_t *heap, napr_heap_stats_t *stats);
+
 /** 
  * Attach a callback to the heap in order to display the data stored.
  * @param heap The heap you are working with.
@@ -126,7 +126,7 @@ int napr_list_insert(napr_list_t *napr_list, void *element, int (*compare) (cons
 {
     int rc = 0;
 
-    if (0 != napr_list_member(napr_list, element, compare)) {
+    if (0 == napr_list_member(napr_list, element, compare)) {
 	/* if element is not member of the list */
 	rc = 1;
 	if (0 > napr_list_enqueue(napr_list, element))
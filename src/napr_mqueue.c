@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+#include "debug.h"
+#include "napr_dheap.h"
+#include "napr_mqueue.h"
+
+/* number of sub-heaps per thread, 2 gives a low contention already */
+#define NAPR_MQUEUE_FACTOR 2
+#define NAPR_MQUEUE_ARITY 4
+#define CACHE_LINE 64
+
+typedef struct napr_mqueue_shard_t
+{
+    apr_thread_mutex_t *mutex;
+    napr_dheap_t *heap;
+    /* Copies of the heap state, written under the mutex, read without it */
+    apr_off_t top;
+    apr_uint32_t nb;
+} napr_mqueue_shard_t;
+
+/* each shard on its own cache line, to avoid false sharing */
+typedef union napr_mqueue_slot_t
+{
+    napr_mqueue_shard_t shard;
+    char pad[CACHE_LINE];
+} napr_mqueue_slot_t;
+
+struct napr_mqueue_t
+{
+    napr_mqueue_slot_t *slots;
+    unsigned int nb_shards;
+    apr_uint32_t count;
+};
+
+static __thread apr_uint32_t napr_mqueue_seed = 0;
+
+/* xorshift, one state per thread */
+static inline unsigned int napr_mqueue_random(unsigned int modulo)
+{
+    apr_uint32_t x = napr_mqueue_seed;
+
+    if (0 == x)
+	x = (apr_uint32_t) ((apr_size_t) &x ^ (apr_uint32_t) apr_time_now()) | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    napr_mqueue_seed = x;
+
+    return x % modulo;
+}
+
+napr_mqueue_t *napr_mqueue_make(apr_pool_t *pool, unsigned int nb_threads)
+{
+    napr_mqueue_t *queue;
+    napr_mqueue_shard_t *shard;
+    apr_status_t status;
+    unsigned int i;
+    char *mem;
+
+    queue = apr_pcalloc(pool, sizeof(struct napr_mqueue_t));
+    /* a single thread gets a single heap, thus a strict order */
+    queue->nb_shards = (1 < nb_threads) ? NAPR_MQUEUE_FACTOR * nb_threads : 1;
+    mem = apr_pcalloc(pool, queue->nb_shards * sizeof(napr_mqueue_slot_t) + CACHE_LINE);
+    queue->slots = (napr_mqueue_slot_t *) (mem + CACHE_LINE - ((apr_size_t) mem % CACHE_LINE));
+
+    for (i = 0; i < queue->nb_shards; i++) {
+	shard = &queue->slots[i].shard;
+	if (APR_SUCCESS != (status = apr_thread_mutex_create(&shard->mutex, APR_THREAD_MUTEX_DEFAULT, pool))) {
+	    char errbuf[128];
+	    DEBUG_ERR("error calling apr_thread_mutex_create: %s", apr_strerror(status, errbuf, 128));
+	    return NULL;
+	}
+	if (NULL == (shard->heap = napr_dheap_make(pool, NAPR_MQUEUE_ARITY))) {
+	    DEBUG_ERR("error calling napr_dheap_make");
+	    return NULL;
+	}
+    }
+
+    return queue;
+}
+
+void napr_mqueue_destroy(napr_mqueue_t *queue)
+{
+    napr_mqueue_shard_t *shard;
+    unsigned int i;
+
+    for (i = 0; i < queue->nb_shards; i++) {
+	shard = &queue->slots[i].shard;
+	if (NULL != shard->mutex)
+	    apr_thread_mutex_destroy(shard->mutex);
+	if (NULL != shard->heap)
+	    napr_dheap_destroy(shard->heap);
+	shard->mutex = NULL;
+	shard->heap = NULL;
+    }
+}
+
+int napr_mqueue_insert(napr_mqueue_t *queue, apr_off_t key, void *datum)
+{
+    napr_mqueue_shard_t *shard;
+    unsigned int tries;
+    apr_off_t top;
+    int rc;
+
+    for (tries = 0;; tries++) {
+	shard = &queue->slots[napr_mqueue_random(queue->nb_shards)].shard;
+	if (APR_SUCCESS == apr_thread_mutex_trylock(shard->mutex))
+	    break;
+	/* everybody is busy, just wait */
+	if ((tries >= queue->nb_shards) && (APR_SUCCESS == apr_thread_mutex_lock(shard->mutex)))
+	    break;
+    }
+
+    if (0 == (rc = napr_dheap_insert(shard->heap, key, datum))) {
+	napr_dheap_top(shard->heap, &top);
+	__atomic_store_n(&shard->top, top, __ATOMIC_RELAXED);
+	__atomic_store_n(&shard->nb, napr_dheap_size(shard->heap), __ATOMIC_RELEASE);
+	__atomic_add_fetch(&queue->count, 1, __ATOMIC_RELEASE);
+    }
+    apr_thread_mutex_unlock(shard->mutex);
+
+    return rc;
+}
+
+/*
+ * Extract from a locked shard, return NULL if it has been emptied since it
+ * has been chosen.
+ */
+static void *napr_mqueue_shard_extract(napr_mqueue_t *queue, napr_mqueue_shard_t *shard, apr_off_t *key)
+{
+    void *datum = NULL;
+    apr_off_t top = 0;
+
+    if (0 < napr_dheap_size(shard->heap)) {
+	datum = napr_dheap_extract(shard->heap, key);
+	napr_dheap_top(shard->heap, &top);
+	__atomic_store_n(&shard->top, top, __ATOMIC_RELAXED);
+	__atomic_store_n(&shard->nb, napr_dheap_size(shard->heap), __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&queue->count, 1, __ATOMIC_RELEASE);
+    }
+    apr_thread_mutex_unlock(shard->mutex);
+
+    return datum;
+}
+
+void *napr_mqueue_extract(napr_mqueue_t *queue, apr_off_t *key)
+{
+    napr_mqueue_shard_t *shard, *other;
+    unsigned int i, tries;
+    void *datum;
+
+    for (tries = 0; 0 < __atomic_load_n(&queue->count, __ATOMIC_ACQUIRE); tries++) {
+	if (tries < 2 * queue->nb_shards) {
+	    /* two choices: the best top of two random shards */
+	    shard = &queue->slots[napr_mqueue_random(queue->nb_shards)].shard;
+	    other = &queue->slots[napr_mqueue_random(queue->nb_shards)].shard;
+	    if ((0 == __atomic_load_n(&shard->nb, __ATOMIC_ACQUIRE))
+		|| ((0 != __atomic_load_n(&other->nb, __ATOMIC_ACQUIRE))
+		    && (__atomic_load_n(&other->top, __ATOMIC_RELAXED) > __atomic_load_n(&shard->top, __ATOMIC_RELAXED))))
+		shard = other;
+	    if (0 == __atomic_load_n(&shard->nb, __ATOMIC_ACQUIRE))
+		continue;
+	    if (APR_SUCCESS != apr_thread_mutex_trylock(shard->mutex))
+		continue;
+	    if (NULL != (datum = napr_mqueue_shard_extract(queue, shard, key)))
+		return datum;
+	}
+	else {
+	    /* few elements left, random picks keep missing them, scan */
+	    for (i = 0; i < queue->nb_shards; i++) {
+		shard = &queue->slots[i].shard;
+		if (0 == __atomic_load_n(&shard->nb, __ATOMIC_ACQUIRE))
+		    continue;
+		if (APR_SUCCESS != apr_thread_mutex_lock(shard->mutex))
+		    continue;
+		if (NULL != (datum = napr_mqueue_shard_extract(queue, shard, key)))
+		    return datum;
+	    }
+	    /* the last elements are being taken by the other threads, let them run */
+	    apr_thread_yield();
+	    tries = 0;
+	}
+    }
+
+    return NULL;
+}
+
+unsigned int napr_mqueue_size(const napr_mqueue_t *queue)
+{
+    return __atomic_load_n(&queue->count, __ATOMIC_ACQUIRE);
+}
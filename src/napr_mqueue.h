@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file napr_mqueue.h
+ * @brief Concurrent relaxed priority queue (multi-queue).
+ *
+ * The queue is made of several sub-heaps (napr_dheap), each one protected by
+ * its own mutex. An insertion goes in a random unlocked sub-heap, an
+ * extraction looks at the top of two random sub-heaps and takes the highest.
+ * Threads almost never wait for each other, the price is that the extracted
+ * element is only one of the highest, not necessarily the highest.
+ * This is meant as a job queue where higher keys (e.g. bigger files) should
+ * be started first.
+ */
+#ifndef NAPR_MQUEUE_H
+#define NAPR_MQUEUE_H
+
+#include <apr.h>
+#include <apr_pools.h>
+
+typedef struct napr_mqueue_t napr_mqueue_t;
+
+/**
+ * Make a new concurrent priority queue.
+ * @param pool The associated pool, it must not be used concurrently while the
+ * queue is made.
+ * @param nb_threads The number of threads that will use the queue, used to
+ * choose the number of sub-heaps.
+ * @return Return a pointer to a newly allocated queue NULL if an error occured.
+ */
+napr_mqueue_t *napr_mqueue_make(apr_pool_t *pool, unsigned int nb_threads);
+
+/**
+ * Release the mutexes and the sub-heaps of a queue, no thread must use it
+ * anymore.
+ * @param queue The queue to destroy.
+ */
+void napr_mqueue_destroy(napr_mqueue_t *queue);
+
+/**
+ * Insert an element in the queue, thread safe.
+ * @param queue The queue you are working with.
+ * @param key The key used to order the element, the highest comes first.
+ * @param datum The datum you want to insert.
+ * @return 0 if no error occured, -1 otherwise.
+ */
+int napr_mqueue_insert(napr_mqueue_t *queue, apr_off_t key, void *datum);
+
+/**
+ * Extract one of the elements with the highest keys, thread safe.
+ * @param queue The queue you are working with.
+ * @param key If not NULL, will be filled with the key of the element.
+ * @return The element, NULL if the queue is empty.
+ */
+void *napr_mqueue_extract(napr_mqueue_t *queue, apr_off_t *key);
+
+/**
+ * Get the number of elements in the queue.
+ * @param queue The queue you are working with.
+ * @return The number of elements, that may have changed when you read it.
+ */
+unsigned int napr_mqueue_size(const napr_mqueue_t *queue);
+
+#endif /* NAPR_MQUEUE_H */
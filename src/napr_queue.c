@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+#include "debug.h"
+#include "napr_queue.h"
+
+#define CACHE_LINE 64
+
+/* backoff: spin up to 2^SPIN_ROUNDS pauses, then yield, then sleep */
+#define SPIN_ROUNDS 6
+#define YIELD_ROUNDS 16
+#define MAX_SLEEP 1000
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+typedef struct napr_queue_slot_t
+{
+    /*
+     * For the lap starting at position pos, the slot is free when seq == pos
+     * and filled when seq == pos + 1.
+     */
+    apr_uint64_t seq;
+    void *datum;
+} napr_queue_slot_t;
+
+struct napr_queue_t
+{
+    /* read-only once made */
+    napr_queue_slot_t *slots;
+    apr_uint64_t size, mask;
+    char pad0[CACHE_LINE - sizeof(napr_queue_slot_t *) - 2 * sizeof(apr_uint64_t)];
+    /* written by the producers */
+    apr_uint64_t tail;
+    char pad1[CACHE_LINE - sizeof(apr_uint64_t)];
+    /* written by the consumer */
+    apr_uint64_t head;
+    char pad2[CACHE_LINE - sizeof(apr_uint64_t)];
+    apr_uint32_t closed;
+};
+
+static void napr_queue_backoff(unsigned int *round)
+{
+    unsigned int i;
+
+    if (*round < SPIN_ROUNDS) {
+	for (i = 0; i < (1U << *round); i++)
+	    cpu_relax();
+    }
+    else if (*round < YIELD_ROUNDS) {
+	apr_thread_yield();
+    }
+    else {
+	apr_sleep((*round - YIELD_ROUNDS < 10) ? (1 << (*round - YIELD_ROUNDS)) : MAX_SLEEP);
+    }
+    (*round)++;
+}
+
+napr_queue_t *napr_queue_make(apr_pool_t *pool, unsigned int size)
+{
+    napr_queue_t *queue;
+    apr_uint64_t i;
+
+    if (0 == size) {
+	DEBUG_ERR("a queue can't be empty");
+	return NULL;
+    }
+
+    queue = apr_pcalloc(pool, sizeof(struct napr_queue_t));
+    for (queue->size = 1; queue->size < size; queue->size *= 2);
+    queue->mask = queue->size - 1;
+    if (NULL == (queue->slots = apr_palloc(pool, queue->size * sizeof(napr_queue_slot_t)))) {
+	DEBUG_ERR("allocation failed");
+	return NULL;
+    }
+    for (i = 0; i < queue->size; i++) {
+	queue->slots[i].seq = i;
+	queue->slots[i].datum = NULL;
+    }
+
+    return queue;
+}
+
+apr_status_t napr_queue_push(napr_queue_t *queue, void *datum)
+{
+    napr_queue_slot_t *slot;
+    apr_uint64_t pos, seq;
+
+    if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE))
+	return APR_EOF;
+
+    pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    while (1) {
+	slot = &queue->slots[pos & queue->mask];
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq == pos) {
+	    /* on failure, pos is reloaded with the current tail */
+	    if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		break;
+	}
+	else if ((apr_int64_t) (seq - pos) < 0) {
+	    /* the consumer has not read this slot yet during the previous lap */
+	    return APR_EAGAIN;
+	}
+	else {
+	    pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	}
+    }
+
+    slot->datum = datum;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return APR_SUCCESS;
+}
+
+apr_status_t napr_queue_push_wait(napr_queue_t *queue, void *datum)
+{
+    apr_status_t status;
+    unsigned int round = 0;
+
+    while (APR_EAGAIN == (status = napr_queue_push(queue, datum)))
+	napr_queue_backoff(&round);
+
+    return status;
+}
+
+unsigned int napr_queue_push_batch(napr_queue_t *queue, void **data, unsigned int nb)
+{
+    napr_queue_slot_t *slot;
+    apr_uint64_t pos, head, room, i;
+    apr_int64_t used;
+
+    if ((0 == nb) || __atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE))
+	return 0;
+
+    pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    do {
+	/*
+	 * The consumer frees the slots in order and publishes the head after
+	 * them, so every slot in [pos, head + size) is free for this lap.
+	 */
+	head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+	used = (apr_int64_t) (pos - head);
+	if (used >= (apr_int64_t) queue->size)
+	    return 0;
+	/* a stale pos may be behind the head, the exchange will then fail */
+	room = queue->size - ((0 < used) ? used : 0);
+	if (room > nb)
+	    room = nb;
+    } while (!__atomic_compare_exchange_n(&queue->tail, &pos, pos + room, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    for (i = 0; i < room; i++) {
+	slot = &queue->slots[(pos + i) & queue->mask];
+	slot->datum = data[i];
+	__atomic_store_n(&slot->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+
+    return (unsigned int) room;
+}
+
+apr_status_t napr_queue_push_batch_wait(napr_queue_t *queue, void **data, unsigned int nb)
+{
+    unsigned int done, round = 0, pushed;
+
+    for (done = 0; done < nb; done += pushed) {
+	if (0 < (pushed = napr_queue_push_batch(queue, data + done, nb - done)))
+	    round = 0;
+	else if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE))
+	    return APR_EOF;
+	else
+	    napr_queue_backoff(&round);
+    }
+
+    return APR_SUCCESS;
+}
+
+apr_status_t napr_queue_pop(napr_queue_t *queue, void **datum)
+{
+    napr_queue_slot_t *slot;
+    apr_uint64_t pos;
+
+    pos = queue->head;
+    slot = &queue->slots[pos & queue->mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+	/* look at the slot again once closed is seen, the last push may have landed in between */
+	if (!__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE))
+	    return APR_EAGAIN;
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+	    return APR_EOF;
+    }
+
+    *datum = slot->datum;
+    __atomic_store_n(&slot->seq, pos + queue->size, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->head, pos + 1, __ATOMIC_RELEASE);
+
+    return APR_SUCCESS;
+}
+
+apr_status_t napr_queue_pop_wait(napr_queue_t *queue, void **datum)
+{
+    apr_status_t status;
+    unsigned int round = 0;
+
+    while (APR_EAGAIN == (status = napr_queue_pop(queue, datum)))
+	napr_queue_backoff(&round);
+
+    return status;
+}
+
+unsigned int napr_queue_pop_batch(napr_queue_t *queue, void **data, unsigned int nb)
+{
+    napr_queue_slot_t *slot;
+    apr_uint64_t pos;
+    unsigned int i;
+
+    pos = queue->head;
+    for (i = 0; i < nb; i++, pos++) {
+	slot = &queue->slots[pos & queue->mask];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+	    break;
+	data[i] = slot->datum;
+	__atomic_store_n(&slot->seq, pos + queue->size, __ATOMIC_RELEASE);
+    }
+    /* a single store of the head for the whole batch */
+    if (0 < i)
+	__atomic_store_n(&queue->head, pos, __ATOMIC_RELEASE);
+
+    return i;
+}
+
+void napr_queue_close(napr_queue_t *queue)
+{
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_RELEASE);
+}
+
+unsigned int napr_queue_size(const napr_queue_t *queue)
+{
+    apr_uint64_t head, tail;
+
+    head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    /* tail counts the reserved slots, not yet filled ones included */
+    return (tail > head) ? (unsigned int) (tail - head) : 0;
+}
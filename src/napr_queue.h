@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file napr_queue.h
+ * @brief Bounded lock-free multi-producer/single-consumer FIFO.
+ *
+ * The queue is a ring of slots, each one carrying a sequence number telling
+ * whether it may be written or read for a given lap. Producers reserve slots
+ * with a compare-and-swap on the tail, the only consumer owns the head, so
+ * nobody ever holds a lock. It is meant to hand elements over between the
+ * stages of a pipeline (e.g. walker -> hasher -> comparer -> reporter).
+ */
+#ifndef NAPR_QUEUE_H
+#define NAPR_QUEUE_H
+
+#include <apr.h>
+#include <apr_errno.h>
+#include <apr_pools.h>
+
+typedef struct napr_queue_t napr_queue_t;
+
+/**
+ * Make a new queue.
+ * @param pool The associated pool.
+ * @param size The maximum number of elements, rounded up to a power of 2.
+ * @return Return a pointer to a newly allocated queue NULL if an error occured.
+ */
+napr_queue_t *napr_queue_make(apr_pool_t *pool, unsigned int size);
+
+/**
+ * Append an element to the queue, may be called by several threads.
+ * @param queue The queue you are working with.
+ * @param datum The datum you want to append.
+ * @return APR_SUCCESS, APR_EAGAIN if the queue is full, APR_EOF if it has
+ * been closed.
+ */
+apr_status_t napr_queue_push(napr_queue_t *queue, void *datum);
+
+/**
+ * Append an element to the queue, waiting for some room if it is full.
+ * @param queue The queue you are working with.
+ * @param datum The datum you want to append.
+ * @return APR_SUCCESS or APR_EOF if the queue has been closed.
+ */
+apr_status_t napr_queue_push_wait(napr_queue_t *queue, void *datum);
+
+/**
+ * Append several elements at once, they stay contiguous in the queue.
+ * @param queue The queue you are working with.
+ * @param data The array of data you want to append.
+ * @param nb The number of elements of data.
+ * @return The number of elements appended, from the start of data, less than
+ * nb if the queue is full or closed.
+ */
+unsigned int napr_queue_push_batch(napr_queue_t *queue, void **data, unsigned int nb);
+
+/**
+ * Append several elements at once, waiting for some room while the queue is
+ * full.
+ * @param queue The queue you are working with.
+ * @param data The array of data you want to append.
+ * @param nb The number of elements of data.
+ * @return APR_SUCCESS once all the elements are appended or APR_EOF if the
+ * queue has been closed.
+ */
+apr_status_t napr_queue_push_batch_wait(napr_queue_t *queue, void **data, unsigned int nb);
+
+/**
+ * Remove the first element of the queue, must be called by a single thread.
+ * @param queue The queue you are working with.
+ * @param datum Will be filled with the element.
+ * @return APR_SUCCESS, APR_EAGAIN if the queue is empty, APR_EOF if it is
+ * empty and has been closed.
+ */
+apr_status_t napr_queue_pop(napr_queue_t *queue, void **datum);
+
+/**
+ * Remove the first element of the queue, waiting for one if it is empty.
+ * @param queue The queue you are working with.
+ * @param datum Will be filled with the element.
+ * @return APR_SUCCESS or APR_EOF if the queue is empty and has been closed.
+ */
+apr_status_t napr_queue_pop_wait(napr_queue_t *queue, void **datum);
+
+/**
+ * Remove up to nb elements from the queue, must be called by a single thread.
+ * @param queue The queue you are working with.
+ * @param data An array that will be filled with the elements.
+ * @param nb The size of data.
+ * @return The number of elements removed, 0 if the queue is empty.
+ */
+unsigned int napr_queue_pop_batch(napr_queue_t *queue, void **data, unsigned int nb);
+
+/**
+ * Tell the consumer that no more elements will come, to be called once every
+ * producer is done.
+ * @param queue The queue you are working with.
+ */
+void napr_queue_close(napr_queue_t *queue);
+
+/**
+ * Get the number of elements in the queue.
+ * @param queue The queue you are working with.
+ * @return The number of elements, that may have changed when you read it.
+ */
+unsigned int napr_queue_size(const napr_queue_t *queue);
+
+#endif /* NAPR_QUEUE_H */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "napr_slab.h"
+
+#define CHUNK_SIZE (64 * 1024)
+#define HUGE_CHUNK_SIZE (2 * 1024 * 1024)
+#define SLAB_ALIGN sizeof(void *)
+
+typedef struct napr_slab_chunk_t napr_slab_chunk_t;
+struct napr_slab_chunk_t
+{
+    napr_slab_chunk_t *next, *prev;
+    apr_size_t size;
+    apr_size_t nb_live;		/* once 0, the chunk is unmapped */
+};
+
+/* the records start after the chunk header, keeping their alignment */
+#define CHUNK_HEADER_SIZE ((sizeof(napr_slab_chunk_t) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+struct napr_slab_t
+{
+    napr_slab_chunk_t *chunks;	/* the first one is the current one */
+    char *next;			/* first free byte of the current chunk */
+    char *end;
+    apr_size_t obj_size;
+    apr_size_t chunk_size;
+    apr_size_t nb_objects, nb_chunks, used, bytes, peak;
+    int flags;
+};
+
+static apr_status_t napr_slab_cleanup(void *data)
+{
+    napr_slab_t *slab = data;
+    napr_slab_chunk_t *chunk;
+
+    while (NULL != (chunk = slab->chunks)) {
+	slab->chunks = chunk->next;
+	munmap(chunk, chunk->size);
+    }
+    slab->next = slab->end = NULL;
+
+    return APR_SUCCESS;
+}
+
+napr_slab_t *napr_slab_make(apr_pool_t *pool, apr_size_t obj_size, int flags)
+{
+    napr_slab_t *slab;
+
+    slab = apr_pcalloc(pool, sizeof(struct napr_slab_t));
+    slab->obj_size = (obj_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    slab->flags = flags;
+    slab->chunk_size = (flags & NAPR_SLAB_HUGEPAGE) ? HUGE_CHUNK_SIZE : CHUNK_SIZE;
+    if (slab->obj_size > slab->chunk_size - CHUNK_HEADER_SIZE) {
+	DEBUG_ERR("object size %" APR_SIZE_T_FMT " is too big for a slab", obj_size);
+	return NULL;
+    }
+    apr_pool_cleanup_register(pool, slab, napr_slab_cleanup, apr_pool_cleanup_null);
+
+    return slab;
+}
+
+static napr_slab_chunk_t *napr_slab_chunk_make(napr_slab_t *slab, apr_size_t chunk_size)
+{
+    napr_slab_chunk_t *chunk;
+    apr_size_t align, head, page;
+    char *mem;
+
+    /*
+     * Chunks are aligned on the chunk size, so that the chunk of a record is
+     * found by masking its address (and huge pages need it). Map one more
+     * chunk and unmap what is around the aligned one: munmap() wants whole
+     * pages, so oversize chunks are rounded up to one.
+     */
+    page = getpagesize();
+    chunk_size = (chunk_size + page - 1) & ~(page - 1);
+    align = slab->chunk_size;
+    mem = mmap(NULL, chunk_size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == mem) {
+	DEBUG_ERR("allocation failed");
+	return NULL;
+    }
+    head = (align - (apr_size_t) mem % align) % align;
+    if (0 != head)
+	munmap(mem, head);
+    if (align != head)
+	munmap(mem + head + chunk_size, align - head);
+    mem += head;
+#ifdef MADV_HUGEPAGE
+    if (slab->flags & NAPR_SLAB_HUGEPAGE)
+	madvise(mem, chunk_size, MADV_HUGEPAGE);
+#endif
+    chunk = (napr_slab_chunk_t *) mem;
+    chunk->size = chunk_size;
+    chunk->nb_live = 0;
+    chunk->prev = NULL;
+    slab->nb_chunks++;
+    slab->bytes += chunk_size;
+    if (slab->bytes > slab->peak)
+	slab->peak = slab->bytes;
+
+    return chunk;
+}
+
+void *napr_slab_alloc(napr_slab_t *slab)
+{
+    return napr_slab_alloc_size(slab, slab->obj_size);
+}
+
+void *napr_slab_alloc_size(napr_slab_t *slab, apr_size_t size)
+{
+    napr_slab_chunk_t *chunk;
+    void *ret;
+
+    if ((apr_size_t) (slab->end - slab->next) < size) {
+	if (size > slab->chunk_size - CHUNK_HEADER_SIZE) {
+	    /*
+	     * A block longer than a chunk gets a chunk of its own, put behind
+	     * the current one which is kept for the next blocks.
+	     */
+	    if (NULL == (chunk = napr_slab_chunk_make(slab, size + CHUNK_HEADER_SIZE)))
+		return NULL;
+	    if (NULL != slab->chunks) {
+		chunk->prev = slab->chunks;
+		chunk->next = slab->chunks->next;
+		if (NULL != chunk->next)
+		    chunk->next->prev = chunk;
+		slab->chunks->next = chunk;
+	    }
+	    else {
+		chunk->next = NULL;
+		slab->chunks = chunk;
+		slab->next = slab->end = (char *) chunk + chunk->size;
+	    }
+	    chunk->nb_live++;
+	    slab->nb_objects++;
+	    slab->used += size;
+
+	    return (char *) chunk + CHUNK_HEADER_SIZE;
+	}
+	if (NULL == (chunk = napr_slab_chunk_make(slab, slab->chunk_size)))
+	    return NULL;
+	chunk->next = slab->chunks;
+	if (NULL != chunk->next)
+	    chunk->next->prev = chunk;
+	slab->chunks = chunk;
+	slab->next = (char *) chunk + CHUNK_HEADER_SIZE;
+	slab->end = (char *) chunk + chunk->size;
+    }
+
+    ret = slab->next;
+    slab->next += size;
+    slab->chunks->nb_live++;
+    slab->nb_objects++;
+    slab->used += size;
+
+    return ret;
+}
+
+void napr_slab_free(napr_slab_t *slab, void *obj)
+{
+    napr_slab_free_size(slab, obj, slab->obj_size);
+}
+
+void napr_slab_free_size(napr_slab_t *slab, void *obj, apr_size_t size)
+{
+    napr_slab_chunk_t *chunk;
+
+    chunk = (napr_slab_chunk_t *) ((apr_size_t) obj & ~(slab->chunk_size - 1));
+    slab->nb_objects--;
+    slab->used -= size;
+    if (0 != --chunk->nb_live)
+	return;
+
+    if (chunk == slab->chunks) {
+	/* the current chunk is kept, and filled again from its start */
+	slab->next = (char *) chunk + CHUNK_HEADER_SIZE;
+	return;
+    }
+    chunk->prev->next = chunk->next;
+    if (NULL != chunk->next)
+	chunk->next->prev = chunk->prev;
+    slab->nb_chunks--;
+    slab->bytes -= chunk->size;
+    munmap(chunk, chunk->size);
+}
+
+char *napr_slab_strdup(napr_slab_t *slab, const char *str)
+{
+    apr_size_t len = strlen(str) + 1;
+    char *ret;
+
+    if (NULL != (ret = napr_slab_alloc_size(slab, len)))
+	memcpy(ret, str, len);
+
+    return ret;
+}
+
+void napr_slab_get_stats(const napr_slab_t *slab, napr_slab_stats_t *stats)
+{
+    stats->nb_objects = slab->nb_objects;
+    stats->nb_chunks = slab->nb_chunks;
+    stats->used = slab->used;
+    stats->bytes = slab->bytes;
+    stats->peak = slab->peak;
+}
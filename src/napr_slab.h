@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2007 François Pesce : francois.pesce (at) gmail (dot) com
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file napr_slab.h
+ * @brief Slab allocator for records of the same type, and string arena.
+ *
+ * Records are packed back to back in big chunks, without the per allocation
+ * overhead and alignment padding of a pool, so that millions of small records
+ * (e.g. one per file) stay dense in memory. A slab made with an object size
+ * of 0 is an arena of variable size blocks, used for strings.
+ * Freed records are not reused, but a chunk is given back to the system as
+ * soon as all of its records are freed, so a program which frees what it
+ * allocated by phases shrinks instead of keeping its peak size.
+ */
+#ifndef NAPR_SLAB_H
+#define NAPR_SLAB_H
+
+#include <apr.h>
+#include <apr_pools.h>
+
+/** Ask for transparent huge pages on the chunks (2MB each). */
+#define NAPR_SLAB_HUGEPAGE 0x1
+
+typedef struct napr_slab_t napr_slab_t;
+
+typedef struct napr_slab_stats_t
+{
+    apr_size_t nb_objects;	/* number of records not freed */
+    apr_size_t nb_chunks;
+    apr_size_t used;		/* bytes of the records not freed */
+    apr_size_t bytes;		/* bytes held by the chunks */
+    apr_size_t peak;		/* highest value of bytes */
+} napr_slab_stats_t;
+
+/**
+ * Make a new slab.
+ * @param pool The associated pool, the chunks are freed along with it.
+ * @param obj_size The size of the records, 0 to make a string arena.
+ * @param flags 0 or NAPR_SLAB_HUGEPAGE.
+ * @return Return a pointer to a newly allocated slab NULL if an error occured.
+ */
+napr_slab_t *napr_slab_make(apr_pool_t *pool, apr_size_t obj_size, int flags);
+
+/**
+ * Get a record from a slab.
+ * @param slab The slab you are working with, not a string arena.
+ * @return An uninitialized record, NULL if an allocation error occured.
+ */
+void *napr_slab_alloc(napr_slab_t *slab);
+
+/**
+ * Get a block of any size from a string arena.
+ * @param slab The string arena you are working with.
+ * @param size The size of the block.
+ * @return An uninitialized block, not aligned, NULL if an allocation error
+ * occured.
+ */
+void *napr_slab_alloc_size(napr_slab_t *slab, apr_size_t size);
+
+/**
+ * Free a record of a slab.
+ * @param slab The slab you are working with, not a string arena.
+ * @param obj The record, given by napr_slab_alloc.
+ */
+void napr_slab_free(napr_slab_t *slab, void *obj);
+
+/**
+ * Free a block of a string arena.
+ * @param slab The string arena you are working with.
+ * @param obj The block, given by napr_slab_alloc_size or napr_slab_strdup.
+ * @param size The size of the block, strlen + 1 for a string.
+ */
+void napr_slab_free_size(napr_slab_t *slab, void *obj, apr_size_t size);
+
+/**
+ * Duplicate a string in a string arena.
+ * @param slab The string arena you are working with.
+ * @param str The string to copy.
+ * @return The copy, NULL if an allocation error occured.
+ */
+char *napr_slab_strdup(napr_slab_t *slab, const char *str);
+
+/**
+ * Get statistics about a slab.
+ * @param slab The slab you are working with.
+ * @param stats The structure to fill.
+ */
+void napr_slab_get_stats(const napr_slab_t *slab, napr_slab_stats_t *stats);
+
+#endif /* NAPR_SLAB_H */